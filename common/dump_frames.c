@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "dump_frames.h"
+
+#define GZIP_ID1	0x1f
+#define GZIP_ID2	0x8b
+#define GZIP_CM_DEFLATE	8
+#define GZIP_FEXTRA	0x04
+#define GZIP_OS_UNIX	3
+
+/* Offsets in the frame header */
+#define FRAME_XLEN	10
+#define FRAME_SI1	12
+#define FRAME_SI2	13
+#define FRAME_SUBLEN	14
+#define FRAME_SIZE	16
+#define FRAME_DATA_SIZE	20
+
+/*
+ * Index frame: the header up to the "OI" subfield data, 8 bytes of sizes
+ * per frame, then the tail: the offset of the previous index frame, the
+ * size of this one, INDEX_MAGIC, an empty deflate block and the gzip
+ * trailer of an empty member.
+ */
+#define INDEX_HDR_SIZE		16
+#define INDEX_TAIL_PREV		0
+#define INDEX_TAIL_SIZE		8
+#define INDEX_TAIL_MAGIC	12
+#define INDEX_TAIL_EMPTY	16
+#define INDEX_MAGIC		"ODIX"
+
+/* Empty final deflate block, CRC32 and ISIZE of no data */
+static const uint8_t index_empty[DUMP_FRAME_INDEX_TAIL_SIZE -
+				 INDEX_TAIL_EMPTY] = { 0x03, 0x00 };
+
+struct dump_frame_ctx {
+#ifdef HAVE_ZLIB
+	z_stream	deflate;
+	z_stream	inflate;
+	int		deflate_init;
+	int		inflate_init;
+#else
+	int		unused;
+#endif
+};
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le32toh(val);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le64toh(val);
+}
+
+static void put_le16(uint8_t *p, uint16_t val)
+{
+	val = htole16(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static void put_le32(uint8_t *p, uint32_t val)
+{
+	val = htole32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static void put_le64(uint8_t *p, uint64_t val)
+{
+	val = htole64(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+/*
+ * Largest frame len bytes of the dump can compress to
+ *
+ * This is compressBound() of zlib, which a frame holding raw deflate
+ * data stays under, so that a reader can check the size of a frame
+ * whether or not it was built with zlib.
+ */
+size_t dump_frame_bound(uint32_t len)
+{
+	return DUMP_FRAME_HDR_SIZE + len + (len >> 12) + (len >> 14) +
+	       (len >> 25) + 13 + DUMP_FRAME_TRAILER_SIZE;
+}
+
+/* Returns 1 if a frame of these sizes can have been written by us */
+static int frame_sizes_valid(uint32_t frame_size, uint32_t data_size)
+{
+	return data_size > 0 && data_size <= DUMP_FRAME_MAX &&
+	       frame_size >= DUMP_FRAME_HDR_SIZE + DUMP_FRAME_TRAILER_SIZE &&
+	       frame_size <= dump_frame_bound(data_size);
+}
+
+/* Returns 1 if buf starts like a gzip file */
+int dump_frame_is_compressed(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	return len >= 2 && p[0] == GZIP_ID1 && p[1] == GZIP_ID2;
+}
+
+/*
+ * Reads the sizes out of the DUMP_FRAME_HDR_SIZE bytes of a frame header
+ *
+ * Returns 0 on success, -1 if this is not the header of a dump frame.
+ */
+int dump_frame_header(const void *hdr, uint32_t *frame_size,
+		      uint32_t *data_size)
+{
+	const uint8_t *p = hdr;
+
+	if (p[0] != GZIP_ID1 || p[1] != GZIP_ID2 || p[2] != GZIP_CM_DEFLATE ||
+	    p[3] != GZIP_FEXTRA)
+		return -1;
+
+	if (p[FRAME_XLEN] != 12 || p[FRAME_XLEN + 1] != 0 ||
+	    p[FRAME_SI1] != 'O' || p[FRAME_SI2] != 'D' ||
+	    p[FRAME_SUBLEN] != 8 || p[FRAME_SUBLEN + 1] != 0)
+		return -1;
+
+	*frame_size = get_le32(p + FRAME_SIZE);
+	*data_size = get_le32(p + FRAME_DATA_SIZE);
+
+	if (!frame_sizes_valid(*frame_size, *data_size))
+		return -1;
+
+	return 0;
+}
+
+void dump_frame_index_init(struct dump_frame_index *index)
+{
+	index->prev = DUMP_FRAME_NO_INDEX;
+	index->nr_frames = 0;
+}
+
+/*
+ * Lists a frame just written in the index frame
+ *
+ * Returns 1 once DUMP_FRAME_INDEX_MAX frames are listed, the index frame
+ * must then be written with dump_frame_index_finish(), 0 otherwise.
+ */
+int dump_frame_index_add(struct dump_frame_index *index, uint32_t frame_size,
+			 uint32_t data_size)
+{
+	uint8_t *p = index->frame + INDEX_HDR_SIZE + 8 * index->nr_frames;
+
+	put_le32(p, frame_size);
+	put_le32(p + 4, data_size);
+
+	return ++index->nr_frames == DUMP_FRAME_INDEX_MAX;
+}
+
+/*
+ * Completes index->frame, to be written at offset of the compressed dump
+ * right after the frames it lists, and starts the next one
+ *
+ * A compressed dump must end with an index frame, even one listing no
+ * frame.
+ *
+ * Returns the size of index->frame.
+ */
+size_t dump_frame_index_finish(struct dump_frame_index *index,
+			       uint64_t offset)
+{
+	uint32_t size = DUMP_FRAME_INDEX_SIZE(index->nr_frames);
+	uint8_t *hdr = index->frame;
+	uint8_t *tail = hdr + size - DUMP_FRAME_INDEX_TAIL_SIZE;
+
+	memset(hdr, 0, INDEX_HDR_SIZE);
+	hdr[0] = GZIP_ID1;
+	hdr[1] = GZIP_ID2;
+	hdr[2] = GZIP_CM_DEFLATE;
+	hdr[3] = GZIP_FEXTRA;
+	hdr[9] = GZIP_OS_UNIX;
+	put_le16(hdr + FRAME_XLEN, size - INDEX_HDR_SIZE + 4 -
+		 sizeof(index_empty));
+	hdr[FRAME_SI1] = 'O';
+	hdr[FRAME_SI2] = 'I';
+	put_le16(hdr + FRAME_SUBLEN, size - INDEX_HDR_SIZE -
+		 sizeof(index_empty));
+
+	put_le64(tail + INDEX_TAIL_PREV, index->prev);
+	put_le32(tail + INDEX_TAIL_SIZE, size);
+	memcpy(tail + INDEX_TAIL_MAGIC, INDEX_MAGIC, 4);
+	memcpy(tail + INDEX_TAIL_EMPTY, index_empty, sizeof(index_empty));
+
+	index->prev = offset;
+	index->nr_frames = 0;
+
+	return size;
+}
+
+/*
+ * Reads the size of an index frame and the offset of the previous one out
+ * of the DUMP_FRAME_INDEX_TAIL_SIZE bytes it ends with
+ *
+ * Returns 0 on success, -1 if this is not the end of an index frame.
+ */
+int dump_frame_index_tail(const void *tail, uint32_t *index_size,
+			  uint64_t *prev)
+{
+	const uint8_t *p = tail;
+
+	if (memcmp(p + INDEX_TAIL_MAGIC, INDEX_MAGIC, 4) ||
+	    memcmp(p + INDEX_TAIL_EMPTY, index_empty, sizeof(index_empty)))
+		return -1;
+
+	*prev = get_le64(p + INDEX_TAIL_PREV);
+	*index_size = get_le32(p + INDEX_TAIL_SIZE);
+
+	if (*index_size < DUMP_FRAME_INDEX_SIZE(0) ||
+	    *index_size > DUMP_FRAME_INDEX_SIZE(DUMP_FRAME_INDEX_MAX) ||
+	    (*index_size - DUMP_FRAME_INDEX_SIZE(0)) % 8)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Reads the sizes of the frames listed by an index frame of index_size
+ * bytes, frames must have room for DUMP_FRAME_INDEX_MAX of them
+ *
+ * Returns 0 on success, -1 if this is not a valid index frame.
+ */
+int dump_frame_index_read(const void *frame, uint32_t index_size,
+			  struct dump_frame_sizes *frames,
+			  uint32_t *nr_frames)
+{
+	const uint8_t *p = frame;
+	uint32_t i;
+
+	if (index_size < DUMP_FRAME_INDEX_SIZE(0) ||
+	    index_size > DUMP_FRAME_INDEX_SIZE(DUMP_FRAME_INDEX_MAX) ||
+	    (index_size - DUMP_FRAME_INDEX_SIZE(0)) % 8)
+		return -1;
+
+	if (p[0] != GZIP_ID1 || p[1] != GZIP_ID2 || p[2] != GZIP_CM_DEFLATE ||
+	    p[3] != GZIP_FEXTRA || p[FRAME_SI1] != 'O' || p[FRAME_SI2] != 'I')
+		return -1;
+
+	if (get_le32(p + index_size - DUMP_FRAME_INDEX_TAIL_SIZE +
+		     INDEX_TAIL_SIZE) != index_size ||
+	    p[FRAME_XLEN] + (p[FRAME_XLEN + 1] << 8) !=
+	    index_size - INDEX_HDR_SIZE + 4 - sizeof(index_empty) ||
+	    p[FRAME_SUBLEN] + (p[FRAME_SUBLEN + 1] << 8) !=
+	    index_size - INDEX_HDR_SIZE - sizeof(index_empty))
+		return -1;
+
+	*nr_frames = (index_size - DUMP_FRAME_INDEX_SIZE(0)) / 8;
+	for (i = 0; i < *nr_frames; i++) {
+		frames[i].size = get_le32(p + INDEX_HDR_SIZE + 8 * i);
+		frames[i].data_size = get_le32(p + INDEX_HDR_SIZE + 8 * i + 4);
+		if (!frame_sizes_valid(frames[i].size, frames[i].data_size))
+			return -1;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_ZLIB
+
+struct dump_frame_ctx *dump_frame_ctx_new(void)
+{
+	return calloc(1, sizeof(struct dump_frame_ctx));
+}
+
+void dump_frame_ctx_free(struct dump_frame_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	if (ctx->deflate_init)
+		deflateEnd(&ctx->deflate);
+	if (ctx->inflate_init)
+		inflateEnd(&ctx->inflate);
+	free(ctx);
+}
+
+/*
+ * Compresses len bytes of in to a frame at out
+ *
+ * out_len must be at least dump_frame_bound(len). A dump is large and
+ * we may be saving it on a system in trouble, so speed is favoured over
+ * ratio.
+ *
+ * Returns the size of the frame, -1 on failure.
+ */
+ssize_t dump_frame_compress(struct dump_frame_ctx *ctx, const void *in,
+			    uint32_t len, void *out, size_t out_len)
+{
+	uint8_t *hdr = out;
+	uint8_t *trailer;
+	size_t frame_size;
+
+	if (len > DUMP_FRAME_MAX || out_len < dump_frame_bound(len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!ctx->deflate_init) {
+		/* Raw deflate, we write the gzip header and trailer */
+		if (deflateInit2(&ctx->deflate, Z_BEST_SPEED, Z_DEFLATED,
+				 -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ctx->deflate_init = 1;
+	} else {
+		deflateReset(&ctx->deflate);
+	}
+
+	ctx->deflate.next_in = (Bytef *)in;
+	ctx->deflate.avail_in = len;
+	ctx->deflate.next_out = hdr + DUMP_FRAME_HDR_SIZE;
+	ctx->deflate.avail_out = out_len - DUMP_FRAME_HDR_SIZE -
+				 DUMP_FRAME_TRAILER_SIZE;
+
+	if (deflate(&ctx->deflate, Z_FINISH) != Z_STREAM_END) {
+		errno = EIO;
+		return -1;
+	}
+
+	frame_size = DUMP_FRAME_HDR_SIZE + ctx->deflate.total_out +
+		     DUMP_FRAME_TRAILER_SIZE;
+
+	memset(hdr, 0, DUMP_FRAME_HDR_SIZE);
+	hdr[0] = GZIP_ID1;
+	hdr[1] = GZIP_ID2;
+	hdr[2] = GZIP_CM_DEFLATE;
+	hdr[3] = GZIP_FEXTRA;
+	hdr[9] = GZIP_OS_UNIX;
+	hdr[FRAME_XLEN] = 12;
+	hdr[FRAME_SI1] = 'O';
+	hdr[FRAME_SI2] = 'D';
+	hdr[FRAME_SUBLEN] = 8;
+	put_le32(hdr + FRAME_SIZE, frame_size);
+	put_le32(hdr + FRAME_DATA_SIZE, len);
+
+	trailer = hdr + frame_size - DUMP_FRAME_TRAILER_SIZE;
+	put_le32(trailer, crc32(0, in, len));
+	put_le32(trailer + 4, len);
+
+	return frame_size;
+}
+
+/*
+ * Decompresses a whole frame of frame_size bytes, holding data_size bytes
+ * of the dump, to out
+ *
+ * Returns 0 on success, -1 if the frame is corrupted.
+ */
+int dump_frame_decompress(struct dump_frame_ctx *ctx, const void *frame,
+			  uint32_t frame_size, void *out, uint32_t data_size)
+{
+	const uint8_t *trailer;
+	int rc;
+
+	if (!ctx->inflate_init) {
+		if (inflateInit2(&ctx->inflate, -MAX_WBITS) != Z_OK) {
+			errno = ENOMEM;
+			return -1;
+		}
+		ctx->inflate_init = 1;
+	} else {
+		inflateReset(&ctx->inflate);
+	}
+
+	ctx->inflate.next_in = (Bytef *)frame + DUMP_FRAME_HDR_SIZE;
+	ctx->inflate.avail_in = frame_size - DUMP_FRAME_HDR_SIZE -
+				DUMP_FRAME_TRAILER_SIZE;
+	ctx->inflate.next_out = out;
+	ctx->inflate.avail_out = data_size;
+
+	rc = inflate(&ctx->inflate, Z_FINISH);
+	trailer = (const uint8_t *)frame + frame_size - DUMP_FRAME_TRAILER_SIZE;
+	if (rc != Z_STREAM_END || ctx->inflate.total_out != data_size ||
+	    get_le32(trailer + 4) != data_size ||
+	    get_le32(trailer) != crc32(0, out, data_size)) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+#else /* !HAVE_ZLIB */
+
+/* Built without zlib, compressed dumps can neither be written nor read */
+struct dump_frame_ctx *dump_frame_ctx_new(void)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void dump_frame_ctx_free(struct dump_frame_ctx *ctx)
+{
+}
+
+ssize_t dump_frame_compress(struct dump_frame_ctx *ctx, const void *in,
+			    uint32_t len, void *out, size_t out_len)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int dump_frame_decompress(struct dump_frame_ctx *ctx, const void *frame,
+			  uint32_t frame_size, void *out, uint32_t data_size)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif /* HAVE_ZLIB */
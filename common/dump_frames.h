@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef DUMP_FRAMES_H
+#define DUMP_FRAMES_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Compressed platform dumps
+ *
+ * A compressed dump is a series of gzip members (frames), each holding
+ * up to DUMP_FRAME_MAX bytes of the dump, so gunzip or zcat give the
+ * dump back. The header of every frame carries an "OD" extra field with
+ * the size of the frame and of the data it holds.
+ *
+ * Every DUMP_FRAME_INDEX_MAX frames, and after the last one, comes an index
+ * frame: an empty gzip member whose "OI" extra field lists the sizes of the
+ * frames since the previous index frame, followed by the offset of that
+ * one.  A reader follows the index frames back from the end of the dump,
+ * and then decompresses just the frames it needs.
+ */
+#define DUMP_FRAME_SUFFIX	".gz"
+
+/* gzip header with FEXTRA, XLEN and a single 8 byte "OD" subfield */
+#define DUMP_FRAME_HDR_SIZE	24
+
+/* CRC32 and ISIZE */
+#define DUMP_FRAME_TRAILER_SIZE	8
+
+/* Largest amount of the dump a frame may hold */
+#define DUMP_FRAME_MAX		(1024 * 1024)
+
+/* Frames listed by an index frame */
+#define DUMP_FRAME_INDEX_MAX	4096
+
+/* Size of an index frame listing n frames */
+#define DUMP_FRAME_INDEX_SIZE(n)	(42 + 8 * (n))
+
+/* Bytes at the end of an index frame read by dump_frame_index_tail() */
+#define DUMP_FRAME_INDEX_TAIL_SIZE	26
+
+/* Offset of the previous index frame of the first one */
+#define DUMP_FRAME_NO_INDEX	UINT64_MAX
+
+/* Sizes of a frame, as listed by an index frame */
+struct dump_frame_sizes {
+	uint32_t	size;
+	uint32_t	data_size;
+};
+
+/* Index frame being filled in by the writer of a compressed dump */
+struct dump_frame_index {
+	uint64_t	prev;		/* Offset of the last index frame */
+	uint32_t	nr_frames;	/* Frames written since */
+	uint8_t		frame[DUMP_FRAME_INDEX_SIZE(DUMP_FRAME_INDEX_MAX)];
+};
+
+struct dump_frame_ctx;
+
+int dump_frame_is_compressed(const void *buf, size_t len);
+int dump_frame_header(const void *hdr, uint32_t *frame_size,
+		      uint32_t *data_size);
+size_t dump_frame_bound(uint32_t len);
+
+void dump_frame_index_init(struct dump_frame_index *index);
+int dump_frame_index_add(struct dump_frame_index *index, uint32_t frame_size,
+			 uint32_t data_size);
+size_t dump_frame_index_finish(struct dump_frame_index *index,
+			       uint64_t offset);
+int dump_frame_index_tail(const void *tail, uint32_t *index_size,
+			  uint64_t *prev);
+int dump_frame_index_read(const void *frame, uint32_t index_size,
+			  struct dump_frame_sizes *frames,
+			  uint32_t *nr_frames);
+
+struct dump_frame_ctx *dump_frame_ctx_new(void);
+void dump_frame_ctx_free(struct dump_frame_ctx *ctx);
+ssize_t dump_frame_compress(struct dump_frame_ctx *ctx, const void *in,
+			    uint32_t len, void *out, size_t out_len);
+int dump_frame_decompress(struct dump_frame_ctx *ctx, const void *frame,
+			  uint32_t frame_size, void *out, uint32_t data_size);
+
+#endif
@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE	/* copy_file_range() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -30,11 +32,15 @@
 #include <endian.h>
 #include <limits.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <getopt.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
 
 #include "opal-dump-parse.h"
+#include "dump_frames.h"
 
 char *dump_file;
 char *opt_output_file = "Skiboot-log";
@@ -43,6 +49,98 @@ int opt_output_flag = 0;
 int opt_mdst = 0;
 int opt_sec_id = 0;
 int opt_sec_file = 0;
+int opt_all = 0;
+int opt_scan = 0;
+char *opt_grep = NULL;
+unsigned long opt_tail = 0;
+int opt_since_flag = 0;
+double opt_since = 0;
+int opt_batch = 0;
+char *opt_batch_dir = NULL;
+long opt_jobs = 0;
+int opt_nr_sec_ids = 0;
+
+/* Sections that can be captured from each dump of a batch (-B) */
+#define BATCH_SEC_IDS_MAX	16
+int opt_sec_ids[BATCH_SEC_IDS_MAX];
+
+/* Per dump file of a batch where its output goes */
+#define BATCH_RESULT_FILE	"result"
+
+/* Amount of a log read at a time when scanning it (-g, -t, -T) */
+#define SCAN_CHUNK_SIZE	(1024 * 1024)
+
+/* Lines of a log kept by -t once the other filters have been applied */
+struct scan_line {
+	uint64_t	offset;
+	uint32_t	len;
+};
+
+struct log_scan {
+	struct scan_line	*tail;
+	unsigned long		tail_next;
+	unsigned long		tail_cnt;
+	int			started;	/* --since reached */
+};
+
+/* Number of threads used to extract all the sections (-a) */
+#define EXTRACT_WORKERS	4
+
+/* A log to be captured by the -a worker pool */
+struct extract_job {
+	char	path[PATH_MAX];
+	off_t	offset;
+	size_t	size;
+	int	rc;
+	int	err;
+};
+
+struct extract_pool {
+	struct extract_job	*jobs;
+	int			nr_jobs;
+	int			next;
+	struct opal_dump	*dump;
+	pthread_mutex_t		lock;
+};
+
+/* A frame of a compressed dump, see load_frames() */
+struct dump_frame {
+	uint64_t	offset;		/* In the dump file */
+	uint64_t	start;		/* In the uncompressed dump */
+	uint32_t	size;
+	uint32_t	data_size;
+};
+
+/* Decompresses frames of a dump, keeping the last one */
+struct frame_reader {
+	struct dump_frame_ctx	*ctx;
+	char			*frame;
+	char			*data;
+	long			cur;	/* Frame in data, -1 if none */
+};
+
+/*
+ * Bytes of a HWDATA TOC entry we look at, entries may be packed so
+ * this is less than sizeof(hw_toc_entry)
+ */
+#define HW_TOC_ENTRY_MIN_SIZE	(offsetof(hw_toc_entry, size) + sizeof(__be32))
+
+/* What we know about the dump being parsed */
+struct opal_dump {
+	int		fd;
+	uint64_t	size;		/* Size of the dump file */
+	char		suffix[DUMP_FILE_SUFFIX_SIZE + 1];
+	uint64_t	hwdata_start;
+	uint64_t	skiboot_start;
+	uint32_t	skiboot_size;
+	mdst_table	*mdst;		/* MDST table, read in by get_mdst_table() */
+	uint32_t	mdst_cnt;
+	struct dump_frame *frames;	/* Compressed dump frame index */
+	uint32_t	nr_frames;
+	uint32_t	frame_max;	/* Largest frame */
+	uint32_t	data_max;	/* Largest data size of a frame */
+	struct frame_reader reader;	/* Used by read_dump() */
+};
 
 /* OPAL dump section detail */
 struct mdst_section section_types[] = {
@@ -51,13 +149,221 @@ struct mdst_section section_types[] = {
 
 static void print_usage(char *command)
 {
-	printf("Usage: %s [-l | -h | -s id | -o file] <SYSDUMP>\n\n"
+	printf("Usage: %s [-l | -h | -s id | -a | -o file] <SYSDUMP>\n"
+		"       %s [-s id] [-g pattern] [-t lines] [-T seconds] <SYSDUMP>\n"
+		"       %s -B dir [-j jobs] [-l] [-s id]... [-a] <SYSDUMP | dir>...\n\n"
 		"\t-l      - List all the sections\n"
 		"\t-s id   - Capture log with specified section id\n"
+		"\t-a      - Capture the skiboot log and all the sections\n"
 		"\t-o file - Output file to capture the log with specified"
 		" section id\n"
+		"\t          (with -a, the directory to capture the logs to)\n"
+		"\t-g, --grep pattern\n"
+		"\t        - Print the lines of the log containing pattern\n"
+		"\t-t, --tail lines\n"
+		"\t        - Print the last lines of the log\n"
+		"\t-T, --since seconds\n"
+		"\t        - Print the log from the first line logged at or after"
+		" seconds\n"
+		"\t          (-g, -t and -T read the skiboot log, or the section"
+		" given\n"
+		"\t          with -s, in place and print it to stdout)\n"
+		"\t-B, --batch dir\n"
+		"\t        - Process several dumps, or the SYSDUMP.* files of"
+		" directories,\n"
+		"\t          in parallel, running all the actions given on"
+		" each of them\n"
+		"\t          (by default capturing the skiboot log). The"
+		" results of\n"
+		"\t          each dump go to dir/<dump name>/.\n"
+		"\t-j, --jobs jobs\n"
+		"\t        - Number of dumps processed at a time with -B"
+		" (default: CPUs)\n"
 		"\t-h      - Print this message and exit\n",
-		command);
+		command, command, command);
+}
+
+/*
+ * Checks that len bytes at offset lie within the dump
+ *
+ * Returns:
+ *   E_SUCCESS   - success
+ *   E_OPAL_DATA - failure
+ */
+static int check_dump_range(struct opal_dump *dump, uint64_t offset,
+			    uint64_t len)
+{
+	if (offset > dump->size || len > dump->size - offset) {
+		fprintf(stderr, "Dump is truncated, 0x%" PRIx64 " bytes at "
+			"offset 0x%" PRIx64 " are beyond its end\n",
+			len, offset);
+		return E_OPAL_DATA;
+	}
+
+	return E_SUCCESS;
+}
+
+/*
+ * Reads len bytes at offset of the dump file into buf
+ *
+ * Returns 0 on success, -1 on failure with errno set (to 0 at the end of
+ * the file).
+ */
+static int pread_all(int fd, void *buf, size_t len, uint64_t offset)
+{
+	ssize_t sz;
+	size_t done = 0;
+
+	while (done < len) {
+		sz = pread(fd, (char *)buf + done, len - done, offset + done);
+		if (sz == -1 && errno == EINTR)
+			continue;
+
+		if (sz <= 0) {
+			if (sz == 0)
+				errno = 0;
+			return -1;
+		}
+
+		done += sz;
+	}
+
+	return 0;
+}
+
+static int frame_reader_init(struct frame_reader *reader,
+			     struct opal_dump *dump)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->cur = -1;
+	reader->ctx = dump_frame_ctx_new();
+	if (!reader->ctx)
+		return -1;
+
+	reader->frame = malloc(dump->frame_max);
+	reader->data = malloc(dump->data_max ? dump->data_max : 1);
+	if (!reader->frame || !reader->data) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void frame_reader_free(struct frame_reader *reader)
+{
+	dump_frame_ctx_free(reader->ctx);
+	free(reader->frame);
+	free(reader->data);
+}
+
+/* Returns the frame holding offset of the uncompressed dump */
+static uint32_t find_frame(struct opal_dump *dump, uint64_t offset)
+{
+	uint32_t lo = 0, hi = dump->nr_frames - 1, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (dump->frames[mid].start <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/*
+ * Decompresses frame i of the dump to reader->data, unless it is there
+ * already
+ *
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+static int read_frame(struct opal_dump *dump, struct frame_reader *reader,
+		      uint32_t i)
+{
+	struct dump_frame *frame = &dump->frames[i];
+	uint32_t size, data_size;
+
+	if (reader->cur == i)
+		return 0;
+
+	reader->cur = -1;
+	if (pread_all(dump->fd, reader->frame, frame->size, frame->offset)) {
+		if (!errno)
+			errno = EIO;
+		return -1;
+	}
+
+	/* The frame must be the one the index lists */
+	if (dump_frame_header(reader->frame, &size, &data_size) ||
+	    size != frame->size || data_size != frame->data_size) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (dump_frame_decompress(reader->ctx, reader->frame, frame->size,
+				  reader->data, frame->data_size))
+		return -1;
+
+	reader->cur = i;
+	return 0;
+}
+
+/*
+ * Reads len bytes at offset of the dump into buf
+ *
+ * Only the headers and tables needed to locate the logs, and the logs
+ * being searched, are read this way, the logs themselves are copied by
+ * copy_dump_data(). Only the frames of a compressed dump holding the
+ * range are decompressed.
+ *
+ * Returns:
+ *   E_SUCCESS   - success
+ *   E_OPAL_DATA - the range is beyond the end of the dump
+ *   E_FILE      - read failure
+ */
+static int read_dump(struct opal_dump *dump, uint64_t offset,
+		     void *buf, size_t len)
+{
+	struct dump_frame *frame;
+	size_t n;
+	uint32_t i;
+
+	if (check_dump_range(dump, offset, len))
+		return E_OPAL_DATA;
+
+	if (!dump->frames) {
+		if (pread_all(dump->fd, buf, len, offset)) {
+			fprintf(stderr, "Could not read the dump file "
+				"\"%s\", %s.\n", dump_file,
+				errno ? strerror(errno) :
+				"unexpected end of file");
+			return E_FILE;
+		}
+		return E_SUCCESS;
+	}
+
+	while (len) {
+		i = find_frame(dump, offset);
+		frame = &dump->frames[i];
+		if (read_frame(dump, &dump->reader, i)) {
+			fprintf(stderr, "Could not read the dump file "
+				"\"%s\" at offset 0x%" PRIx64 ", %s.\n",
+				dump_file, frame->offset, strerror(errno));
+			return E_FILE;
+		}
+
+		n = frame->start + frame->data_size - offset;
+		if (n > len)
+			n = len;
+		memcpy(buf, dump->reader.data + (offset - frame->start), n);
+		buf = (char *)buf + n;
+		offset += n;
+		len -= n;
+	}
+
+	return E_SUCCESS;
 }
 
 /*
@@ -67,25 +373,36 @@ static void print_usage(char *command)
  *   E_SUCCESS - success
  *   E_INVALID - failure
  */
-static int validate_sections(char *data, int *dump_header)
+static int validate_sections(struct opal_dump *dump, uint64_t *dump_header)
 {
-	uint16_t offset;
-	sec_dir_entry *section;
+	uint64_t offset;
+	uint16_t dirsize;
+	sec_dir_entry section;
+	int rc;
 
 	offset = SECTION_START_OFFSET;
 
 	do {
-		section = (sec_dir_entry *)(data + offset);
+		rc = read_dump(dump, offset, &section, sizeof(section));
+		if (rc)
+			return rc;
 
-		if (strncmp(section->dirlabel, SECTION_SIGNATURE, SECTION_SIGNATURE_LENGTH)) {
+		if (strncmp(section.dirlabel, SECTION_SIGNATURE, SECTION_SIGNATURE_LENGTH)) {
 			fprintf(stderr, "%s signature mismatch\n",
 				SECTION_SIGNATURE);
 			return E_INVALID;
 		}
 
-		offset += be16toh(section->dirsize);
+		dirsize = be16toh(section.dirsize);
+		if (dirsize == 0) {
+			fprintf(stderr, "Invalid %s directory size\n",
+				SECTION_SIGNATURE);
+			return E_INVALID;
+		}
+
+		offset += dirsize;
 
-	} while (!(be32toh(section->flags) & SECTION_LAST));
+	} while (!(be32toh(section.flags) & SECTION_LAST));
 
 	*dump_header = offset;
 
@@ -99,18 +416,22 @@ static int validate_sections(char *data, int *dump_header)
  *   E_SUCCESS - success
  *   E_INVALID - failure
  */
-static int validate_dump_header(char *data, int dump_header, int *hwdata_start)
+static int validate_dump_header(struct opal_dump *dump, uint64_t dump_header)
 {
-	dump_hdr *hdr;
+	dump_hdr hdr;
+	int rc;
 
-	hdr = (dump_hdr *)(data + dump_header);
+	/* Nothing past the header size is needed */
+	rc = read_dump(dump, dump_header, &hdr, offsetof(dump_hdr, dumpsize));
+	if (rc)
+		return rc;
 
-	if (strncmp(hdr->type, DUMP_HDR_SIGNATURE,  DUMP_HDR_SIGNATURE_LENGTH)) {
+	if (strncmp(hdr.type, DUMP_HDR_SIGNATURE,  DUMP_HDR_SIGNATURE_LENGTH)) {
 		fprintf(stderr, "%s signature mismatch\n", DUMP_HDR_SIGNATURE);
 		return E_INVALID;
 	}
 
-	*hwdata_start = dump_header + be16toh(hdr->dumphdrsize);
+	dump->hwdata_start = dump_header + be16toh(hdr.dumphdrsize);
 	return E_SUCCESS;
 }
 
@@ -121,46 +442,56 @@ static int validate_dump_header(char *data, int dump_header, int *hwdata_start)
  *   E_SUCCESS - success
  *   E_INVALID - failure
  */
-static int get_skiboot(char *data, int hwdata_start,
-		       int *skiboot_start, uint32_t *skiboot_size)
+static int get_skiboot(struct opal_dump *dump)
 {
-	int toc_start, next_toc;
-	int i;
+	uint64_t toc_start, next_toc;
+	uint32_t i;
 	uint16_t toc_size;
-	uint32_t toc_cnt, offset = 0, facility;
-	dump_node_header *hdr;
-	hw_toc_entry *toc;
+	uint32_t toc_cnt, offset = 0, facility, size = 0;
+	dump_node_header hdr;
+	hw_toc_entry toc;
+	int rc;
 
-	hdr = (dump_node_header *)(data + hwdata_start);
+	rc = read_dump(dump, dump->hwdata_start, &hdr, sizeof(hdr));
+	if (rc)
+		return rc;
 
-	if (be16toh(hdr->headerversion) != SUPPORTED_DUMP_HDR_VERSION) {
+	if (be16toh(hdr.headerversion) != SUPPORTED_DUMP_HDR_VERSION) {
 		fprintf(stderr, "Unsupported dump version: %d\n",
-							be16toh(hdr->headerversion));
+							be16toh(hdr.headerversion));
 		return E_INVALID;
 	}
 
-	if (strncmp(hdr->dumplabel, HWDATA_SIGNATURE, HWDATA_SIGNATURE_LENGTH)) {
+	if (strncmp(hdr.dumplabel, HWDATA_SIGNATURE, HWDATA_SIGNATURE_LENGTH)) {
 		fprintf(stderr, "%s signature mismatch\n", HWDATA_SIGNATURE);
 		return E_INVALID;
 	}
 
-	toc_start = hwdata_start + be16toh(hdr->headersize);
-	toc_cnt = be32toh(hdr->toccnt);
-	toc_size = be16toh(hdr->tocsize);
+	toc_start = dump->hwdata_start + be16toh(hdr.headersize);
+	toc_cnt = be32toh(hdr.toccnt);
+	toc_size = be16toh(hdr.tocsize);
+
+	if (toc_size < HW_TOC_ENTRY_MIN_SIZE) {
+		fprintf(stderr, "Invalid %s TOC entry size: %d\n",
+			HWDATA_SIGNATURE, toc_size);
+		return E_INVALID;
+	}
 
 	next_toc = toc_start;
 
 	for (i = 0; i < toc_cnt; i++) {
-		toc = (hw_toc_entry *)(data + next_toc);
+		rc = read_dump(dump, next_toc, &toc, HW_TOC_ENTRY_MIN_SIZE);
+		if (rc)
+			return rc;
 
-		*skiboot_size = be32toh(toc->size);
+		size = be32toh(toc.size);
 
 		/* first 5 bits of flags is used for facility */
-		facility = (be32toh(toc->flags) >> 27) & BLOCK_DATA_FACILITY;
+		facility = (be32toh(toc.flags) >> 27) & BLOCK_DATA_FACILITY;
 
-		if (facility && (*skiboot_size > SKIBOOT_SIZE_LIMIT)) {
-			*skiboot_size -= SKIBOOT_HEADER_SIZE;
-			offset = be32toh(toc->offset);
+		if (facility && (size > SKIBOOT_SIZE_LIMIT)) {
+			size -= SKIBOOT_HEADER_SIZE;
+			offset = be32toh(toc.offset);
 			break;
 		}
 		next_toc += toc_size;
@@ -171,41 +502,187 @@ static int get_skiboot(char *data, int hwdata_start,
 		return E_OPAL_DATA;
 	}
 
-	*skiboot_start = toc_start + (toc_size * toc_cnt) + offset + SKIBOOT_HEADER_SIZE;
+	dump->skiboot_start = toc_start + (uint64_t)toc_size * toc_cnt +
+			      offset + SKIBOOT_HEADER_SIZE;
+	dump->skiboot_size = size;
 
 	return E_SUCCESS;
 }
 
 /*
- * Writes log to the file
- * Captures the contents from the specified offset to a file
+ * Copies size bytes from offset in a compressed dump to out_fd,
+ * decompressing the frames holding them only
+ *
+ * Has its own frame reader, so it can be called from several threads.
+ *
+ * Returns:
+ *   E_SUCCESS - success
+ *   E_FILE    - failure, errno is set
  */
-static int write_log(char path[], int flag,
-		     char *data, int skiboot_start, int size)
+static int copy_frames(struct opal_dump *dump, uint64_t offset, int out_fd,
+		       size_t size)
 {
-	int fd;
-	int rc = E_FILE, sz, ret;
-	char dump_path[PATH_MAX];
-	char dump_suffix[DUMP_FILE_SUFFIX_SIZE + 1];
+	struct frame_reader reader;
+	struct dump_frame *frame;
+	const char *p;
+	size_t n;
+	ssize_t sz;
+	int rc = E_FILE;
+
+	if (frame_reader_init(&reader, dump))
+		goto out;
+
+	while (size) {
+		frame = &dump->frames[find_frame(dump, offset)];
+		if (read_frame(dump, &reader, frame - dump->frames))
+			goto out;
+
+		n = frame->start + frame->data_size - offset;
+		if (n > size)
+			n = size;
+		p = reader.data + (offset - frame->start);
+		offset += n;
+		size -= n;
+
+		while (n) {
+			sz = write(out_fd, p, n);
+			if (sz == -1) {
+				if (errno == EINTR)
+					continue;
+				goto out;
+			}
+			p += sz;
+			n -= sz;
+		}
+	}
+
+	rc = E_SUCCESS;
+out:
+	frame_reader_free(&reader);
+	return rc;
+}
+
+/*
+ * Copies size bytes from offset in the dump to out_fd
+ *
+ * The data is moved by the kernel with copy_file_range(), which lets the
+ * filesystem share or copy the extents, falling back to sendfile() when
+ * the two files do not support it. It never passes through a user space
+ * buffer. A compressed dump goes through copy_frames().
+ *
+ * Returns:
+ *   E_SUCCESS - success
+ *   E_FILE    - failure, errno is set
+ */
+static int copy_dump_data(struct opal_dump *dump, off_t offset, int out_fd,
+			  size_t size)
+{
+	ssize_t sz;
+	int use_sendfile = 0;
+	int dump_fd = dump->fd;
+
+	if (dump->frames)
+		return copy_frames(dump, offset, out_fd, size);
+
+	while (size) {
+		if (!use_sendfile) {
+			sz = copy_file_range(dump_fd, &offset, out_fd, NULL,
+					     size, 0);
+			/* Not supported between these files, use sendfile */
+			if (sz == -1 && (errno == EXDEV || errno == ENOSYS ||
+					 errno == EINVAL || errno == EOPNOTSUPP)) {
+				use_sendfile = 1;
+				continue;
+			}
+		} else {
+			sz = sendfile(out_fd, dump_fd, &offset, size);
+		}
+
+		if (sz == -1) {
+			if (errno == EINTR)
+				continue;
+			return E_FILE;
+		}
+
+		/* Dump is shorter than its table of contents says */
+		if (sz == 0) {
+			errno = EIO;
+			return E_FILE;
+		}
+
+		size -= sz;
+	}
+
+	return E_SUCCESS;
+}
+
+/*
+ * Builds the output file name of a log
+ * Unless flag is set the dump name suffix is appended to path
+ *
+ * Returns:
+ *   E_SUCCESS - success
+ *   E_FILE    - name too long
+ */
+static int get_log_path(char dump_path[], const char *path, int flag,
+			struct opal_dump *dump)
+{
+	int sz;
 
 	sz = strlen(path);
 	if (sz >= PATH_MAX)
-		return rc;
+		return E_FILE;
 
 	dump_path[PATH_MAX - 1] = '\0';
 	strncpy(dump_path, path, PATH_MAX - 1);
 
 	if (!flag) {
-		strncpy(dump_suffix,
-			&data[offsetof(dump_file_hdr, fname) + DUMP_FILE_PREFIX_SIZE],
-			DUMP_FILE_SUFFIX_SIZE);
-		dump_suffix[DUMP_FILE_SUFFIX_SIZE] = '\0';
-		if ((sz + strlen(dump_suffix)) >= PATH_MAX)
-			return rc;
-		strncat(dump_path, dump_suffix, strlen(dump_suffix));
+		if ((sz + strlen(dump->suffix)) >= PATH_MAX)
+			return E_FILE;
+		strncat(dump_path, dump->suffix, strlen(dump->suffix));
+	}
+
+	return E_SUCCESS;
+}
+
+/*
+ * Validates that a log lies within the dump
+ *
+ * Returns:
+ *   E_SUCCESS   - success
+ *   E_OPAL_DATA - failure
+ */
+static int check_log_bounds(struct opal_dump *dump, uint64_t start,
+			    uint32_t size)
+{
+	if (start > dump->size || size > dump->size - start) {
+		fprintf(stderr, "Log at offset 0x%" PRIx64 ", size 0x%x is "
+			"beyond the end of the dump\n", start, size);
+		return E_OPAL_DATA;
 	}
 
-	fd = open(dump_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+	return E_SUCCESS;
+}
+
+/*
+ * Writes log to the file
+ * Captures the contents from the specified offset of the dump to a file
+ */
+static int write_log(char path[], int flag, struct opal_dump *dump,
+		     uint64_t skiboot_start, uint32_t size)
+{
+	int fd = -1;
+	int rc = E_FILE, ret;
+	char dump_path[PATH_MAX];
+
+	if (get_log_path(dump_path, path, flag, dump))
+		return rc;
+
+	if (check_log_bounds(dump, skiboot_start, size))
+		return E_OPAL_DATA;
+
+	fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC,
+		  S_IRUSR | S_IWUSR | S_IRGRP);
 
 	if (fd == -1) {
 		fprintf(stderr, "Could not write to output file "
@@ -213,9 +690,7 @@ static int write_log(char path[], int flag,
 		goto err;
 	}
 
-	sz = write(fd, data + skiboot_start, size);
-
-	if (sz != size) {
+	if (copy_dump_data(dump, skiboot_start, fd, size)) {
 		fprintf(stderr, "Could not write to output file "
 			"\"%s\", %s.\n", dump_path, strerror(errno));
 		goto err;
@@ -238,41 +713,60 @@ err:
 }
 
 /*
- * Validates mdst table Computes offset of mdst table
+ * Validates mdst table and reads it in
  *
  * Returns:
  *   E_SUCCESS    - success
  *   E_OPAL_TABLE - failure
  */
-static int get_mdst_table_offset(char *data, int hwdata_start,
-				 int *mdst_start, int *mdst_cnt)
+static int get_mdst_table(struct opal_dump *dump)
 {
-	uint32_t toc_size;
-	int sec_start, toc_start;
-	uint32_t toc_cnt;
-	int i, next_toc, found = 0;
-	dump_node_header *hdr;
-	sys_toc_entry *toc;
+	uint16_t toc_size;
+	uint64_t sec_start, toc_start, mdst_start;
+	uint32_t toc_cnt, sec_size, mdst_size;
+	uint32_t i;
+	uint64_t next_toc;
+	int rc, found = 0;
+	dump_node_header hdr;
+	sys_toc_entry toc;
 
-	sec_start = hwdata_start;
-	hdr = (dump_node_header *) (data + sec_start);
+	sec_start = dump->hwdata_start;
 
 	/* Look for SYSDATA section */
-	while (strncmp(&data[sec_start], DATA_SECTION, DATA_SECTION_LENGTH)) {
-		sec_start += be32toh(hdr->dumpsize);
-		hdr = (dump_node_header *) (data + sec_start);
+	for (;;) {
+		rc = read_dump(dump, sec_start, &hdr, sizeof(hdr));
+		if (rc)
+			return rc;
+
+		if (!strncmp(hdr.dumplabel, DATA_SECTION, DATA_SECTION_LENGTH))
+			break;
+
+		sec_size = be32toh(hdr.dumpsize);
+		if (sec_size == 0) {
+			fprintf(stderr, "%s section not found\n", DATA_SECTION);
+			return E_OPAL_TABLE;
+		}
+		sec_start += sec_size;
 	}
 
-	toc_start = sec_start + be16toh(hdr->headersize);
-	toc_cnt = be32toh(hdr->toccnt);
-	toc_size = be16toh(hdr-> tocsize);
+	toc_start = sec_start + be16toh(hdr.headersize);
+	toc_cnt = be32toh(hdr.toccnt);
+	toc_size = be16toh(hdr.tocsize);
+
+	if (toc_size < sizeof(sys_toc_entry)) {
+		fprintf(stderr, "Invalid %s TOC entry size: %d\n",
+			DATA_SECTION, toc_size);
+		return E_OPAL_TABLE;
+	}
 
 	next_toc = toc_start;
 
 	for (i = 0; i < toc_cnt; i++) {
-		toc = (sys_toc_entry *)(data + next_toc);
+		rc = read_dump(dump, next_toc, &toc, sizeof(toc));
+		if (rc)
+			return rc;
 
-		if (be32toh(toc->id) == MDST_TABLE_ID) {
+		if (be32toh(toc.id) == MDST_TABLE_ID) {
 			found = 1;
 			break;
 		}
@@ -285,8 +779,24 @@ static int get_mdst_table_offset(char *data, int hwdata_start,
 		return E_OPAL_TABLE;
 	}
 
-	*mdst_start = toc_start + (toc_size * toc_cnt) + be32toh(toc->offset);
-	*mdst_cnt = be32toh(toc->size) / sizeof(mdst_table);
+	mdst_start = toc_start + (uint64_t)toc_size * toc_cnt +
+		     be32toh(toc.offset);
+	dump->mdst_cnt = be32toh(toc.size) / sizeof(mdst_table);
+	mdst_size = dump->mdst_cnt * sizeof(mdst_table);
+
+	/* Validate before allocating, the size comes from the dump */
+	if (check_dump_range(dump, mdst_start, mdst_size))
+		return E_OPAL_TABLE;
+
+	dump->mdst = malloc(mdst_size ? mdst_size : 1);
+	if (!dump->mdst) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return E_OPAL_TABLE;
+	}
+
+	rc = read_dump(dump, mdst_start, dump->mdst, mdst_size);
+	if (rc)
+		return rc;
 
 	return E_SUCCESS;
 }
@@ -304,42 +814,54 @@ static inline char *parse_section(int type)
 }
 
 /*
- * Captures the content of the specified section to a file.
+ * Computes the offset and size of the section with the given id
+ * Sections are stored back to back from the start of the skiboot log.
  *
  * Returns:
+ *   E_SUCCESS - success
+ *   E_SECTION - no such section
  */
-static int print_section(char *data, int mdst_start,
-			 int mdst_count, int skiboot_start)
+static int find_section(struct opal_dump *dump, int id,
+			uint64_t *offset, uint32_t *size)
 {
-	int i, rc, next, skiboot_offset, found = 0;
-	uint32_t type, size, total_size = 0;
-	mdst_table *mdst_t;
+	uint32_t i;
+	uint64_t next = dump->skiboot_start;
 
-	for (i = 0, next = mdst_start; i < mdst_count; i++, next += sizeof(mdst_table)) {
-		mdst_t = (mdst_table *)(data + next);
+	for (i = 0; i < dump->mdst_cnt; i++) {
+		*size = be32toh(dump->mdst[i].size);
 
-		type = be32toh(mdst_t->type);
-		size = be32toh(mdst_t->size);
-
-		if (type == opt_sec_id) {
-			found = 1;
-			break;
+		if (be32toh(dump->mdst[i].type) == id) {
+			*offset = next;
+			return E_SUCCESS;
 		}
 
-		total_size += size;
+		next += *size;
 	}
 
-	if (!found) {
-		fprintf(stderr, "Section id %d is invalid\n", opt_sec_id);
-		return E_SECTION;
-	}
+	fprintf(stderr, "Section id %d is invalid\n", id);
+	return E_SECTION;
+}
+
+/*
+ * Captures the content of the specified section to a file.
+ *
+ * Returns:
+ */
+static int print_section(struct opal_dump *dump)
+{
+	int rc;
+	uint32_t size;
+	uint64_t skiboot_offset;
+
+	rc = find_section(dump, opt_sec_id, &skiboot_offset, &size);
+	if (rc)
+		return rc;
 
-	skiboot_offset = skiboot_start + total_size;
 	if (!opt_output_flag)
-		opt_output_file = parse_section(type);
+		opt_output_file = parse_section(opt_sec_id);
 
-	rc = write_log(opt_output_file,
-		       opt_output_flag, data, skiboot_offset, size);
+	rc = write_log(opt_output_file, opt_output_flag, dump,
+		       skiboot_offset, size);
 	return rc;
 }
 
@@ -347,128 +869,1076 @@ static int print_section(char *data, int mdst_start,
  *
  * In case of a invalid section type returns E_SECTION.
  */
-static void list_section(char *data, int mdst_start, int mdst_count)
+static void list_section(struct opal_dump *dump)
 {
-	int i, next;
-	uint32_t size, type;
-	mdst_table *mdst_t;
+	uint32_t i, size, type;
 
 	printf("|---------------------------------------------------------|\n");
 	printf("|ID              SECTION                              SIZE|\n");
 	printf("|---------------------------------------------------------|\n");
 
 
-	for (i = 0, next = mdst_start; i < mdst_count; i++, next += sizeof(mdst_table)) {
-		mdst_t = (mdst_table *)(data + next);
-
-		type = be32toh(mdst_t->type);
-		size = be32toh(mdst_t->size);
+	for (i = 0; i < dump->mdst_cnt; i++) {
+		type = be32toh(dump->mdst[i].type);
+		size = be32toh(dump->mdst[i].size);
 
-		printf("|%-d\t\t%-18s\t\t%10d|\n", type, parse_section(type), size);
+		printf("|%-d\t\t%-18s\t\t%10u|\n", type, parse_section(type), size);
 	}
 	printf("|---------------------------------------------------------|\n");
 	printf("List completed\n");
 }
 
-/*
- * parses the SYSDUMP file, captures the opal log to a file.
- */
-static int parse_dump(void)
+static void *extract_worker(void *arg)
 {
-	int dump_fd;
-	int dump_header;
-	int mdst_cnt, mdst_start;
-	int rc = E_SUCCESS;
-	int hwdata_start, skiboot_start;
-	uint32_t skiboot_size;
-	struct stat dump_sbuf;
-	char *dump_map = NULL, *data = NULL;
-	dump_file_hdr *hdr;
+	struct extract_pool *pool = arg;
+	struct extract_job *job;
+	int i, fd;
 
-	if ((stat(dump_file, &dump_sbuf)) < 0) {
-		fprintf(stderr, "Could not get status of dump configuration"
-			" file \"%s\", %s.\n", dump_file, strerror(errno));
-		return E_FILE;
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->nr_jobs)
+			break;
+		job = &pool->jobs[i];
+
+		fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC,
+			  S_IRUSR | S_IWUSR | S_IRGRP);
+		if (fd == -1) {
+			job->rc = E_FILE;
+			job->err = errno;
+			continue;
+		}
+
+		if (copy_dump_data(pool->dump, job->offset, fd, job->size)) {
+			job->rc = E_FILE;
+			job->err = errno;
+		}
+
+		/* The data is synced by extract_all(), the fd is not needed */
+		if (close(fd) == -1 && !job->rc) {
+			job->rc = E_FILE;
+			job->err = errno;
+		}
 	}
 
-	if (dump_sbuf.st_size == 0)
-		return E_FILE;
+	return NULL;
+}
 
-	if ((dump_fd = open(dump_file, O_RDONLY)) < 0) {
-		fprintf(stderr, "Could not open the dump file "
-			"\"%s\", %s.\n", dump_file, strerror(errno));
+/*
+ * Adds a log to the extraction jobs, named after its description
+ * Sections appearing more than once get their MDST index appended.
+ */
+static int add_extract_job(struct extract_pool *pool, struct opal_dump *dump,
+			   const char *desc, int index,
+			   uint64_t start, uint32_t size)
+{
+	struct extract_job *job = &pool->jobs[pool->nr_jobs];
+	char path[PATH_MAX];
+	int i, rc;
+
+	if (check_log_bounds(dump, start, size))
+		return E_OPAL_DATA;
+
+	rc = snprintf(path, sizeof(path), "%s/%s", opt_output_file, desc);
+	if (rc >= sizeof(path) || get_log_path(job->path, path, 0, dump)) {
+		fprintf(stderr, "Output file name for %s is too long\n", desc);
 		return E_FILE;
 	}
 
-	if ((dump_map = mmap(0, dump_sbuf.st_size, PROT_READ, MAP_PRIVATE,
-				dump_fd, 0)) == (char *)-1) {
-		fprintf(stderr, "Could not map dump file "
-				  "\"%s\", %s.\n", dump_file, strerror(errno));
-		close(dump_fd);
-		return E_FILE;
+	for (i = 0; i < pool->nr_jobs; i++) {
+		if (strcmp(pool->jobs[i].path, job->path))
+			continue;
+		rc = snprintf(path, sizeof(path), "%s.%d", job->path, index);
+		if (rc >= sizeof(path)) {
+			fprintf(stderr, "Output file name for %s is too long\n",
+				desc);
+			return E_FILE;
+		}
+		strcpy(job->path, path);
+		break;
 	}
 
-	data = dump_map;
-	hdr = (dump_file_hdr *) (data);
+	job->offset = start;
+	job->size = size;
+	job->rc = E_SUCCESS;
+	pool->nr_jobs++;
 
-	/* Validate file signature */
-	if (strncmp(hdr->label, DUMP_FILE_SIGNATURE, DUMP_FILE_SIGNATURE_LENGTH)) {
-		fprintf(stderr, "Not a valid system dump\n");
-		rc = E_INVALID;
-		goto out;
+	return E_SUCCESS;
+}
+
+/*
+ * Captures the skiboot log and every section of the MDST table to the
+ * output directory.
+ *
+ * The TOC has already been walked once by the caller. The logs are copied
+ * by a small pool of threads and synced with a single syncfs() once they
+ * have all been written, rather than with one fsync() per file.
+ */
+static int extract_all(struct opal_dump *dump)
+{
+	struct extract_pool pool;
+	pthread_t threads[EXTRACT_WORKERS];
+	int nr_threads = 0;
+	int i, dir_fd, rc = E_SUCCESS;
+	uint32_t type, size;
+	uint64_t offset = dump->skiboot_start;
+
+	if (!opt_output_flag)
+		opt_output_file = ".";
+
+	if (mkdir(opt_output_file, S_IRUSR | S_IWUSR | S_IXUSR |
+		  S_IRGRP | S_IXGRP) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Could not create output directory "
+			"\"%s\", %s.\n", opt_output_file, strerror(errno));
+		return E_FILE;
 	}
 
-	/* Validate file name */
-	if (strncmp(hdr->fname,  DUMP_FILE_PREFIX, DUMP_FILE_PREFIX_SIZE)) {
-		fprintf(stderr, "Not a valid system dump\n");
-		rc = E_INVALID;
-		goto out;
+	dir_fd = open(opt_output_file, O_RDONLY | O_DIRECTORY);
+	if (dir_fd == -1) {
+		fprintf(stderr, "Could not open output directory "
+			"\"%s\", %s.\n", opt_output_file, strerror(errno));
+		return E_FILE;
 	}
 
-	/* Validate sections */
-	if ((rc = validate_sections(data, &dump_header)) < 0)
+	memset(&pool, 0, sizeof(pool));
+	pool.dump = dump;
+	pthread_mutex_init(&pool.lock, NULL);
+	pool.jobs = calloc((size_t)dump->mdst_cnt + 1,
+			   sizeof(struct extract_job));
+	if (!pool.jobs) {
+		fprintf(stderr, "Could not allocate memory\n");
+		rc = E_FILE;
 		goto out;
+	}
 
-	/* Validate Dump header */
-	if ((rc = validate_dump_header(data, dump_header, &hwdata_start)) < 0)
+	rc = add_extract_job(&pool, dump, "Skiboot-log", 0,
+			     dump->skiboot_start, dump->skiboot_size);
+	if (rc)
 		goto out;
 
-	/* Get skiboot offset */
-	if ((rc = get_skiboot(data, hwdata_start, &skiboot_start, &skiboot_size)) < 0)
-		goto out;
+	for (i = 0; i < dump->mdst_cnt; i++) {
+		type = be32toh(dump->mdst[i].type);
+		size = be32toh(dump->mdst[i].size);
 
-	if (opt_mdst || opt_sec_file) {
-		/* Retrieve MDST structure */
-		rc = get_mdst_table_offset(data, hwdata_start, &mdst_start, &mdst_cnt);
-		if (rc < 0)
+		rc = add_extract_job(&pool, dump, parse_section(type), i,
+				     offset, size);
+		if (rc)
 			goto out;
 
-		if (opt_sec_file)
-			rc = print_section(data, mdst_start, mdst_cnt, skiboot_start);
-		else
-			list_section(data, mdst_start, mdst_cnt);
-	} else
-		/* copy skiboot log contents to the file */
-		write_log(opt_output_file, opt_output_flag, data, skiboot_start, skiboot_size);
+		offset += size;
+	}
+
+	for (i = 0; i < EXTRACT_WORKERS && i < pool.nr_jobs; i++) {
+		if (pthread_create(&threads[i], NULL, extract_worker, &pool))
+			break;
+		nr_threads++;
+	}
+
+	/* Could not start any thread, do the work ourselves */
+	if (!nr_threads)
+		extract_worker(&pool);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (syncfs(dir_fd) == -1) {
+		fprintf(stderr, "Failed to sync output directory: "
+			"\"%s\", %s.\n", opt_output_file, strerror(errno));
+		rc = E_FILE;
+	}
+
+	for (i = 0; i < pool.nr_jobs; i++) {
+		if (pool.jobs[i].rc) {
+			fprintf(stderr, "Could not write to output file "
+				"\"%s\", %s.\n", pool.jobs[i].path,
+				strerror(pool.jobs[i].err));
+			rc = pool.jobs[i].rc;
+		} else {
+			printf("Captured log to file %s\n", pool.jobs[i].path);
+		}
+	}
+
+out:
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.jobs);
+	close(dir_fd);
+	return rc;
+}
+
+/*
+ * Returns 1 if the line was logged at or after opt_since, 0 if it was
+ * logged before and -1 if it has no "[seconds.nanoseconds,level]"
+ * timestamp.
+ */
+static int line_since(const char *line, size_t len)
+{
+	char stamp[32];
+	char *end;
+	double secs;
+
+	if (len >= sizeof(stamp))
+		len = sizeof(stamp) - 1;
+	memcpy(stamp, line, len);
+	stamp[len] = '\0';
+
+	if (stamp[0] != '[')
+		return -1;
+
+	secs = strtod(stamp + 1, &end);
+	if (end == stamp + 1 || *end != ',')
+		return -1;
+
+	return secs >= opt_since;
+}
+
+/* Prints log data, leaving out the NULs of unused parts of the buffer */
+static void print_log_data(const char *buf, size_t len)
+{
+	const char *nul;
+
+	while (len) {
+		nul = memchr(buf, '\0', len);
+		if (!nul) {
+			fwrite(buf, 1, len, stdout);
+			return;
+		}
+
+		fwrite(buf, 1, nul - buf, stdout);
+		len -= nul - buf + 1;
+		buf = nul + 1;
+	}
+}
+
+static void scan_emit(struct log_scan *scan, const char *line,
+		      uint64_t offset, size_t len)
+{
+	/* Zero filled space in front of the line */
+	while (len && *line == '\0') {
+		line++;
+		offset++;
+		len--;
+	}
+
+	if (!len)
+		return;
+
+	if (!opt_tail) {
+		print_log_data(line, len);
+		return;
+	}
+
+	scan->tail[scan->tail_next].offset = offset;
+	scan->tail[scan->tail_next].len = len;
+	scan->tail_next = (scan->tail_next + 1) % opt_tail;
+	if (scan->tail_cnt < opt_tail)
+		scan->tail_cnt++;
+}
+
+/*
+ * Filters the lines in buf, which starts at offset in the dump
+ *
+ * The log is in time order so --since only has to find the first line
+ * to print, the lines after it are not parsed. The unused, zero filled
+ * parts of the log buffer are skipped.
+ */
+static void scan_lines(struct log_scan *scan, const char *buf, size_t len,
+		       uint64_t offset)
+{
+	size_t pos = 0, line_len, grep_len = opt_grep ? strlen(opt_grep) : 0;
+	const char *match, *eol;
+
+	while (pos < len) {
+		if (!scan->started) {
+			eol = memchr(buf + pos, '\n', len - pos);
+			line_len = eol ? eol - (buf + pos) + 1 : len - pos;
+			if (line_since(buf + pos, line_len) != 1) {
+				pos += line_len;
+				continue;
+			}
+			scan->started = 1;
+		}
+
+		if (opt_grep) {
+			match = memmem(buf + pos, len - pos, opt_grep, grep_len);
+			if (!match)
+				break;
+
+			eol = memrchr(buf + pos, '\n', match - (buf + pos));
+			if (eol)
+				pos = eol - buf + 1;
+		}
+
+		eol = memchr(buf + pos, '\n', len - pos);
+		line_len = eol ? eol - (buf + pos) + 1 : len - pos;
+
+		scan_emit(scan, buf + pos, offset + pos, line_len);
+
+		pos += line_len;
+	}
+}
+
+/*
+ * Prints the last opt_tail lines of a log
+ *
+ * The log is read backwards from its end, past the zero filled part of
+ * the buffer, until enough lines have been seen. Only that much of it is
+ * read.
+ */
+static int tail_log(struct opal_dump *dump, uint64_t start, uint32_t size)
+{
+	uint64_t end = start + size, pos = end, from = start;
+	unsigned long lines = 0;
+	int trimmed = 0, rc = E_SUCCESS;
+	size_t n;
+	char *buf, *p;
+
+	buf = malloc(SCAN_CHUNK_SIZE);
+	if (!buf) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return E_FILE;
+	}
+
+	while (pos > start) {
+		n = pos - start < SCAN_CHUNK_SIZE ? pos - start : SCAN_CHUNK_SIZE;
+		rc = read_dump(dump, pos - n, buf, n);
+		if (rc)
+			goto out;
+
+		p = buf + n;
+		if (!trimmed) {
+			while (p > buf && p[-1] == '\0')
+				p--;
+			end = pos - n + (p - buf);
+			if (p == buf) {
+				pos -= n;
+				continue;
+			}
+			trimmed = 1;
+
+			/* Newline ending the last line */
+			if (p[-1] == '\n')
+				p--;
+		}
+
+		while ((p = memrchr(buf, '\n', p - buf))) {
+			if (++lines == opt_tail) {
+				from = pos - n + (p - buf) + 1;
+				goto print;
+			}
+		}
+
+		pos -= n;
+	}
+
+print:
+	for (pos = from; pos < end; pos += n) {
+		n = end - pos < SCAN_CHUNK_SIZE ? end - pos : SCAN_CHUNK_SIZE;
+		rc = read_dump(dump, pos, buf, n);
+		if (rc)
+			goto out;
+		print_log_data(buf, n);
+	}
+
+out:
+	free(buf);
+	return rc;
+}
+
+/*
+ * Searches and/or tails a log in place, printing it to stdout
+ *
+ * The log is streamed through a fixed size buffer with pread() rather
+ * than being captured to a file first, so memory use does not depend on
+ * its size. Lines longer than SCAN_CHUNK_SIZE are split.
+ */
+static int scan_log(struct opal_dump *dump, uint64_t start, uint32_t size)
+{
+	struct log_scan scan;
+	struct scan_line *line;
+	uint64_t offset = start, remaining = size;
+	size_t carry = 0, len, done, n;
+	char *buf, *eol;
+	unsigned long i, first;
+	int rc = E_SUCCESS;
+
+	if (check_log_bounds(dump, start, size))
+		return E_OPAL_DATA;
+
+	if (!opt_grep && !opt_since_flag)
+		return tail_log(dump, start, size);
+
+	memset(&scan, 0, sizeof(scan));
+	scan.started = !opt_since_flag;
+
+	buf = malloc(2 * SCAN_CHUNK_SIZE);
+	if (opt_tail)
+		scan.tail = calloc(opt_tail, sizeof(struct scan_line));
+	if (!buf || (opt_tail && !scan.tail)) {
+		fprintf(stderr, "Could not allocate memory\n");
+		rc = E_FILE;
+		goto out;
+	}
+
+	if (!dump->frames)
+		posix_fadvise(dump->fd, start, size, POSIX_FADV_SEQUENTIAL);
+
+	while (remaining) {
+		n = remaining < SCAN_CHUNK_SIZE ? remaining : SCAN_CHUNK_SIZE;
+		rc = read_dump(dump, offset + carry, buf + carry, n);
+		if (rc)
+			goto out;
+		remaining -= n;
+		len = carry + n;
+
+		/* Keep a partial last line for the next chunk */
+		done = len;
+		if (remaining) {
+			eol = memrchr(buf, '\n', len);
+			if (eol && len - (eol - buf + 1) < SCAN_CHUNK_SIZE)
+				done = eol - buf + 1;
+		}
+
+		scan_lines(&scan, buf, done, offset);
+
+		carry = len - done;
+		memmove(buf, buf + done, carry);
+		offset += done;
+	}
+
+	/* Oldest line first */
+	first = scan.tail_cnt < opt_tail ? 0 : scan.tail_next;
+	for (i = 0; i < scan.tail_cnt; i++) {
+		line = &scan.tail[(first + i) % opt_tail];
+		rc = read_dump(dump, line->offset, buf, line->len);
+		if (rc)
+			goto out;
+		print_log_data(buf, line->len);
+	}
+
+out:
+	free(scan.tail);
+	free(buf);
+	return rc;
+}
+
+/*
+ * Indexes the frames of a compressed dump
+ *
+ * The index frames are followed back from the end of the dump, a frame is
+ * only read when some of its data is needed. The frames listed must tile
+ * the dump file exactly, and have sizes we may have written, which bounds
+ * frame_max. The size of the dump becomes that of the uncompressed dump,
+ * so that everything else reads a compressed dump exactly like a plain
+ * one.
+ *
+ * Returns:
+ *   E_SUCCESS - success
+ *   E_FILE    - read failure
+ *   E_INVALID - not a compressed dump we can read
+ */
+static int load_frames(struct opal_dump *dump)
+{
+	struct dump_frame_sizes *sizes;
+	struct dump_frame *frames, tmp;
+	uint8_t tail[DUMP_FRAME_INDEX_TAIL_SIZE];
+	uint8_t hdr[DUMP_FRAME_HDR_SIZE];
+	uint8_t *index;
+	uint64_t end = dump->size, start = 0;
+	uint64_t prev, next = DUMP_FRAME_NO_INDEX;
+	uint32_t index_size, size, data_size, nr, nr_alloc = 0, i;
+	int rc = E_INVALID;
+
+	index = malloc(DUMP_FRAME_INDEX_SIZE(DUMP_FRAME_INDEX_MAX));
+	sizes = malloc(DUMP_FRAME_INDEX_MAX * sizeof(*sizes));
+	if (!index || !sizes) {
+		fprintf(stderr, "Could not allocate memory\n");
+		rc = E_FILE;
+		goto out;
+	}
+
+	/* The frames are gathered last first, then put back in order */
+	do {
+		if (end < sizeof(tail))
+			goto bad;
+		if (pread_all(dump->fd, tail, sizeof(tail), end - sizeof(tail)))
+			goto read_error;
+		if (dump_frame_index_tail(tail, &index_size, &prev) ||
+		    index_size > end)
+			goto bad;
+
+		/* Where the index frame after this one said it was */
+		end -= index_size;
+		if (next != DUMP_FRAME_NO_INDEX && end != next)
+			goto bad;
+
+		if (pread_all(dump->fd, index, index_size, end))
+			goto read_error;
+		if (dump_frame_index_read(index, index_size, sizes, &nr))
+			goto bad;
+
+		if (dump->nr_frames + nr > nr_alloc) {
+			nr_alloc = nr_alloc ? nr_alloc * 2 : 64;
+			if (nr_alloc < dump->nr_frames + nr)
+				nr_alloc = dump->nr_frames + nr;
+			frames = realloc(dump->frames,
+					 nr_alloc * sizeof(struct dump_frame));
+			if (!frames) {
+				fprintf(stderr, "Could not allocate memory\n");
+				rc = E_FILE;
+				goto out;
+			}
+			dump->frames = frames;
+		}
+
+		for (i = nr; i-- > 0; ) {
+			if (sizes[i].size > end)
+				goto bad;
+			end -= sizes[i].size;
+
+			frames = &dump->frames[dump->nr_frames++];
+			frames->offset = end;
+			frames->size = sizes[i].size;
+			frames->data_size = sizes[i].data_size;
+		}
+
+		next = prev;
+	} while (prev != DUMP_FRAME_NO_INDEX);
+
+	/* The first index frame lists the frames from the start */
+	if (end != 0 || !dump->nr_frames)
+		goto bad;
+
+	for (i = 0; i < dump->nr_frames / 2; i++) {
+		tmp = dump->frames[i];
+		dump->frames[i] = dump->frames[dump->nr_frames - 1 - i];
+		dump->frames[dump->nr_frames - 1 - i] = tmp;
+	}
+
+	for (i = 0; i < dump->nr_frames; i++) {
+		frames = &dump->frames[i];
+		frames->start = start;
+		start += frames->data_size;
 
+		if (frames->size > dump->frame_max)
+			dump->frame_max = frames->size;
+		if (frames->data_size > dump->data_max)
+			dump->data_max = frames->data_size;
+	}
+
+	if (frame_reader_init(&dump->reader, dump)) {
+		if (errno == ENOTSUP)
+			fprintf(stderr, "Compressed dumps are not supported by"
+				" this build, uncompress \"%s\" first\n",
+				dump_file);
+		else
+			fprintf(stderr, "Could not allocate memory\n");
+		rc = E_FILE;
+		goto out;
+	}
+
+	dump->size = start;
+	rc = E_SUCCESS;
+	goto out;
+
+read_error:
+	if (errno) {
+		fprintf(stderr, "Could not read the dump file \"%s\", %s.\n",
+			dump_file, strerror(errno));
+		rc = E_FILE;
+		goto out;
+	}
+bad:
+	/* A dump we wrote but that lost its end still starts with a frame */
+	if (!pread_all(dump->fd, hdr, sizeof(hdr), 0) &&
+	    !dump_frame_header(hdr, &size, &data_size))
+		fprintf(stderr, "Compressed dump \"%s\" is truncated\n",
+			dump_file);
+	else
+		fprintf(stderr, "Compressed dump \"%s\" has no frame index, "
+			"uncompress it first\n", dump_file);
 out:
-	close(dump_fd);
-	munmap(dump_map, dump_sbuf.st_size);
+	free(sizes);
+	free(index);
 	return rc;
 }
 
+/*
+ * Opens and validates dump_file, locating the skiboot log and, if
+ * need_mdst is set, reading in the MDST table
+ *
+ * The dump is never mapped: the headers and tables are read with pread()
+ * and every offset they give is checked against the size of the dump.
+ * Section payloads are only touched when a log is captured, so listing
+ * the sections of a dump costs a few KiB of I/O whatever its size.
+ *
+ * The dump must be closed with close_dump(), whatever is returned.
+ */
+static int open_dump(struct opal_dump *dump, int need_mdst)
+{
+	uint64_t dump_header = 0;
+	int rc = E_SUCCESS;
+	struct stat dump_sbuf;
+	dump_file_hdr hdr;
+
+	memset(dump, 0, sizeof(*dump));
+	dump->reader.cur = -1;
+
+	if ((dump->fd = open(dump_file, O_RDONLY)) < 0) {
+		fprintf(stderr, "Could not open the dump file "
+			"\"%s\", %s.\n", dump_file, strerror(errno));
+		return E_FILE;
+	}
+
+	if (fstat(dump->fd, &dump_sbuf) < 0) {
+		fprintf(stderr, "Could not get status of dump configuration"
+			" file \"%s\", %s.\n", dump_file, strerror(errno));
+		return E_FILE;
+	}
+
+	if (dump_sbuf.st_size == 0)
+		return E_FILE;
+
+	dump->size = dump_sbuf.st_size;
+
+	if ((rc = read_dump(dump, 0, &hdr, sizeof(hdr))) < 0)
+		return rc;
+
+	/* Dump saved by extract_opal_dump -z */
+	if (dump_frame_is_compressed(&hdr, sizeof(hdr))) {
+		if ((rc = load_frames(dump)) < 0)
+			return rc;
+		if ((rc = read_dump(dump, 0, &hdr, sizeof(hdr))) < 0)
+			return rc;
+	}
+
+	/* Validate file signature */
+	if (strncmp(hdr.label, DUMP_FILE_SIGNATURE, DUMP_FILE_SIGNATURE_LENGTH)) {
+		fprintf(stderr, "Not a valid system dump\n");
+		return E_INVALID;
+	}
+
+	/* Validate file name */
+	if (strncmp(hdr.fname,  DUMP_FILE_PREFIX, DUMP_FILE_PREFIX_SIZE)) {
+		fprintf(stderr, "Not a valid system dump\n");
+		return E_INVALID;
+	}
+
+	strncpy(dump->suffix, &hdr.fname[DUMP_FILE_PREFIX_SIZE],
+		DUMP_FILE_SUFFIX_SIZE);
+	dump->suffix[DUMP_FILE_SUFFIX_SIZE] = '\0';
+
+	/* Validate sections */
+	if ((rc = validate_sections(dump, &dump_header)) < 0)
+		return rc;
+
+	/* Validate Dump header */
+	if ((rc = validate_dump_header(dump, dump_header)) < 0)
+		return rc;
+
+	/* Get skiboot offset */
+	if ((rc = get_skiboot(dump)) < 0)
+		return rc;
+
+	/* Retrieve MDST structure */
+	if (need_mdst)
+		return get_mdst_table(dump);
+
+	return E_SUCCESS;
+}
+
+static void close_dump(struct opal_dump *dump)
+{
+	frame_reader_free(&dump->reader);
+	free(dump->frames);
+	free(dump->mdst);
+	if (dump->fd >= 0)
+		close(dump->fd);
+}
+
+/*
+ * parses the SYSDUMP file, captures the opal log to a file.
+ */
+static int parse_dump(void)
+{
+	int rc;
+	struct opal_dump dump;
+
+	rc = open_dump(&dump, opt_mdst || opt_sec_file || opt_all);
+	if (rc < 0)
+		goto out;
+
+	if (opt_scan) {
+		uint64_t offset = dump.skiboot_start;
+		uint32_t size = dump.skiboot_size;
+
+		if (opt_sec_file) {
+			rc = find_section(&dump, opt_sec_id, &offset, &size);
+			if (rc < 0)
+				goto out;
+		}
+
+		rc = scan_log(&dump, offset, size);
+	} else if (opt_all)
+		rc = extract_all(&dump);
+	else if (opt_sec_file)
+		rc = print_section(&dump);
+	else if (opt_mdst)
+		list_section(&dump);
+	else
+		/* copy skiboot log contents to the file */
+		write_log(opt_output_file, opt_output_flag, &dump,
+			  dump.skiboot_start, dump.skiboot_size);
+
+out:
+	close_dump(&dump);
+	return rc;
+}
+
+/* Name of the directory holding the results of a dump of a batch */
+static const char *batch_name(const char *path)
+{
+	const char *name = strrchr(path, '/');
+
+	return name ? name + 1 : path;
+}
+
+/*
+ * Processes one dump of a batch, in a child process
+ *
+ * The dump is opened and its TOC walked once, then every requested action
+ * is run against it. The logs are captured to <batch dir>/<dump name>/,
+ * and everything that would have been printed goes to the "result" file
+ * there.
+ *
+ * Returns:
+ *   E_SUCCESS - every action succeeded
+ *   otherwise the error of the last action that failed
+ */
+static int batch_dump(const char *path)
+{
+	char result_dir[PATH_MAX];
+	char result_file[PATH_MAX];
+	struct opal_dump dump;
+	int i, fd, ret, rc = E_SUCCESS;
+
+	if (snprintf(result_dir, sizeof(result_dir), "%s/%s",
+		     opt_batch_dir, batch_name(path)) >= sizeof(result_dir) ||
+	    snprintf(result_file, sizeof(result_file), "%s/%s",
+		     result_dir, BATCH_RESULT_FILE) >= sizeof(result_file)) {
+		fprintf(stderr, "Result directory name for %s is too long\n",
+			path);
+		return E_FILE;
+	}
+
+	if (mkdir(result_dir, S_IRUSR | S_IWUSR | S_IXUSR |
+		  S_IRGRP | S_IXGRP) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Could not create result directory "
+			"\"%s\", %s.\n", result_dir, strerror(errno));
+		return E_FILE;
+	}
+
+	fd = open(result_file, O_WRONLY | O_CREAT | O_TRUNC,
+		  S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd == -1) {
+		fprintf(stderr, "Could not write to result file "
+			"\"%s\", %s.\n", result_file, strerror(errno));
+		return E_FILE;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+
+	dump_file = (char *)path;
+	rc = open_dump(&dump, opt_mdst || opt_nr_sec_ids || opt_all);
+	if (rc < 0)
+		goto out;
+
+	/* The dump is open, the logs are captured relative to here */
+	if (chdir(result_dir) == -1) {
+		fprintf(stderr, "Could not change to result directory "
+			"\"%s\", %s.\n", result_dir, strerror(errno));
+		rc = E_FILE;
+		goto out;
+	}
+
+	if (opt_mdst)
+		list_section(&dump);
+
+	for (i = 0; i < opt_nr_sec_ids; i++) {
+		opt_sec_id = opt_sec_ids[i];
+		ret = print_section(&dump);
+		if (ret)
+			rc = ret;
+	}
+
+	if (opt_all) {
+		ret = extract_all(&dump);
+		if (ret)
+			rc = ret;
+	}
+
+	if (!opt_mdst && !opt_nr_sec_ids && !opt_all)
+		rc = write_log(opt_output_file, 0, &dump,
+			       dump.skiboot_start, dump.skiboot_size);
+
+out:
+	close_dump(&dump);
+	fflush(stdout);
+	return rc;
+}
+
+static int add_batch_path(char ***paths, int *nr_paths, const char *path)
+{
+	char **p;
+
+	p = realloc(*paths, (*nr_paths + 1) * sizeof(char *));
+	if (!p)
+		return E_FILE;
+	*paths = p;
+
+	p[*nr_paths] = strdup(path);
+	if (!p[*nr_paths])
+		return E_FILE;
+	(*nr_paths)++;
+
+	return E_SUCCESS;
+}
+
+static int filter_dump(const struct dirent *entry)
+{
+	return !strncmp(entry->d_name, DUMP_FILE_PREFIX, DUMP_FILE_PREFIX_SIZE);
+}
+
+/*
+ * Adds a dump, or the dumps in a directory, to the batch
+ */
+static int add_batch_arg(char ***paths, int *nr_paths, const char *arg)
+{
+	struct dirent **namelist;
+	struct stat sbuf;
+	char path[PATH_MAX];
+	int i, n, rc = E_SUCCESS;
+
+	if (stat(arg, &sbuf) < 0 || !S_ISDIR(sbuf.st_mode))
+		return add_batch_path(paths, nr_paths, arg);
+
+	n = scandir(arg, &namelist, filter_dump, alphasort);
+	if (n < 0) {
+		fprintf(stderr, "Could not read directory \"%s\", %s.\n",
+			arg, strerror(errno));
+		return E_FILE;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (rc == E_SUCCESS) {
+			snprintf(path, sizeof(path), "%s/%s", arg,
+				 namelist[i]->d_name);
+			if (stat(path, &sbuf) == 0 && S_ISREG(sbuf.st_mode))
+				rc = add_batch_path(paths, nr_paths, path);
+		}
+		free(namelist[i]);
+	}
+	free(namelist);
+
+	return rc;
+}
+
+/*
+ * Processes a batch of dumps, opt_jobs at a time
+ *
+ * Each dump is handled by its own child process, so a dump that fails
+ * to parse does not affect the others. One line is printed per dump as
+ * it completes.
+ *
+ * Returns:
+ *   E_SUCCESS - every dump was processed
+ *   E_FILE    - at least one dump failed
+ */
+static int parse_batch(char *args[], int nr_args)
+{
+	char **paths = NULL;
+	pid_t *pids = NULL;
+	int nr_paths = 0, running = 0, next = 0;
+	int i, j, status, rc = E_SUCCESS;
+	pid_t pid;
+
+	for (i = 0; i < nr_args; i++) {
+		if (add_batch_arg(&paths, &nr_paths, args[i])) {
+			rc = E_FILE;
+			goto out;
+		}
+	}
+
+	if (!nr_paths) {
+		fprintf(stderr, "No dump to process\n");
+		return E_FILE;
+	}
+
+	if (mkdir(opt_batch_dir, S_IRUSR | S_IWUSR | S_IXUSR |
+		  S_IRGRP | S_IXGRP) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Could not create output directory "
+			"\"%s\", %s.\n", opt_batch_dir, strerror(errno));
+		rc = E_FILE;
+		goto out;
+	}
+
+	pids = calloc(nr_paths, sizeof(pid_t));
+	if (!pids) {
+		fprintf(stderr, "Could not allocate memory\n");
+		rc = E_FILE;
+		goto out;
+	}
+
+	/* Results are kept per dump name, which must be unique */
+	for (i = 0; i < nr_paths; i++) {
+		for (j = 0; j < i; j++) {
+			if (!strcmp(batch_name(paths[i]), batch_name(paths[j])) &&
+			    pids[j] != -1) {
+				fprintf(stderr, "%s: skipped, same name as "
+					"%s\n", paths[i], paths[j]);
+				pids[i] = -1;
+				rc = E_FILE;
+				break;
+			}
+		}
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	while (next < nr_paths || running) {
+		if (next < nr_paths && running < opt_jobs) {
+			if (pids[next] == -1) {
+				next++;
+				continue;
+			}
+
+			pid = fork();
+			if (pid == 0)
+				exit(batch_dump(paths[next]) ?
+				     EXIT_FAILURE : EXIT_SUCCESS);
+
+			if (pid == -1) {
+				fprintf(stderr, "%s: could not fork, %s.\n",
+					paths[next], strerror(errno));
+				pids[next++] = -1;
+				rc = E_FILE;
+				continue;
+			}
+
+			pids[next++] = pid;
+			running++;
+			continue;
+		}
+
+		pid = waitpid(-1, &status, 0);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < next; i++)
+			if (pids[i] == pid)
+				break;
+		if (i == next)
+			continue;
+		running--;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+			printf("%s: done, results in %s/%s\n", paths[i],
+			       opt_batch_dir, batch_name(paths[i]));
+		} else {
+			printf("%s: failed, see %s/%s/%s\n", paths[i],
+			       opt_batch_dir, batch_name(paths[i]),
+			       BATCH_RESULT_FILE);
+			rc = E_FILE;
+		}
+		fflush(stdout);
+	}
+
+out:
+	for (i = 0; i < nr_paths; i++)
+		free(paths[i]);
+	free(paths);
+	free(pids);
+	return rc;
+}
+
+static struct option long_options[] = {
+	{"grep",	required_argument,	NULL, 'g'},
+	{"tail",	required_argument,	NULL, 't'},
+	{"since",	required_argument,	NULL, 'T'},
+	{"batch",	required_argument,	NULL, 'B'},
+	{"jobs",	required_argument,	NULL, 'j'},
+	{"help",	no_argument,		NULL, 'h'},
+	{0, 0, 0, 0}
+};
+
 int main(int argc, char *argv[])
 {
 	int opt = 0;
+	char *end;
 
-	while ((opt = getopt(argc, argv, "lh:s:o:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "lh:s:o:ag:t:T:B:j:",
+				  long_options, NULL)) != -1) {
 		switch (opt) {
+		case 'g':
+			opt_grep = optarg;
+			opt_scan = 1;
+			break;
+		case 't':
+			errno = 0;
+			opt_tail = strtoul(optarg, &end, 10);
+			if (errno || *end || !opt_tail || optarg[0] == '-') {
+				fprintf(stderr, "Invalid number of lines: %s\n\n",
+					optarg);
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			opt_scan = 1;
+			break;
+		case 'T':
+			opt_since = strtod(optarg, &end);
+			if (end == optarg || *end) {
+				fprintf(stderr, "Invalid time: %s\n\n", optarg);
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			opt_since_flag = 1;
+			opt_scan = 1;
+			break;
+		case 'a':
+			opt_all = 1;
+			break;
 		case 'l':
 			opt_mdst = 1;
 			break;
 		case 's':
 			opt_sec_id = atoi(optarg);
 			opt_sec_file = 1;
+			if (opt_nr_sec_ids < BATCH_SEC_IDS_MAX)
+				opt_sec_ids[opt_nr_sec_ids] = opt_sec_id;
+			opt_nr_sec_ids++;
+			break;
+		case 'B':
+			opt_batch = 1;
+			opt_batch_dir = optarg;
+			break;
+		case 'j':
+			errno = 0;
+			opt_jobs = strtol(optarg, &end, 10);
+			if (errno || *end || opt_jobs < 1) {
+				fprintf(stderr, "Invalid number of jobs: %s\n\n",
+					optarg);
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
 			break;
 		case 'o':
 			opt_output_flag = 1;
@@ -489,10 +1959,50 @@ int main(int argc, char *argv[])
 		return E_USAGE;
 	}
 
-	/* Options l & s are mutually exclusive */
-	if (opt_mdst && opt_sec_file) {
+	if (opt_batch) {
+		if (opt_scan || opt_output_flag) {
+			fprintf(stderr, "The -g, -t, -T and -o options cannot "
+				"be used with -B\n\n");
+			print_usage(argv[0]);
+			return E_USAGE;
+		}
+
+		if (opt_nr_sec_ids > BATCH_SEC_IDS_MAX) {
+			fprintf(stderr, "At most %d sections can be captured "
+				"with -B\n\n", BATCH_SEC_IDS_MAX);
+			print_usage(argv[0]);
+			return E_USAGE;
+		}
+
+		if (optind >= argc) {
+			fprintf(stderr, "Expected SYSDUMP file\n\n");
+			print_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+
+		if (!opt_jobs)
+			opt_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (opt_jobs < 1)
+			opt_jobs = 1;
+
+		return parse_batch(&argv[optind], argc - optind);
+	} else if (opt_jobs) {
+		fprintf(stderr, "The -j option can only be used with -B\n\n");
+		print_usage(argv[0]);
+		return E_USAGE;
+	}
+
+	/* Options l, s & a are mutually exclusive */
+	if (opt_mdst + opt_sec_file + opt_all > 1) {
 		fprintf(stderr, "Only one operation can be performed at a time "
-				"(-l | -s)\n\n");
+				"(-l | -s | -a)\n\n");
+		print_usage(argv[0]);
+		return E_USAGE;
+	}
+
+	if (opt_scan && (opt_mdst || opt_all || opt_output_flag)) {
+		fprintf(stderr, "The -g, -t and -T options can only be used "
+			"with -s\n\n");
 		print_usage(argv[0]);
 		return E_USAGE;
 	}
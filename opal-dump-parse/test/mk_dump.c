@@ -0,0 +1,394 @@
+/*
+ * Builds a synthetic OPAL system dump
+ *
+ * The dump has the file header, section directory, dump header, HWDATA
+ * and SYSDATA nodes and the MDST table opal-dump-parse expects, followed
+ * by sections of the given sizes holding skiboot style log lines. The
+ * first section is the skiboot log.
+ *
+ * By default only the first and last lines of each section are written
+ * and the rest is left as a hole, -d fills the sections completely.
+ * -z compresses the dump the way extract_opal_dump -z does.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <endian.h>
+#include <sys/types.h>
+
+#include "opal-dump-parse.h"
+#include "dump_frames.h"
+
+#define MAX_SECTIONS		6
+#define HW_TOC_SIZE		28	/* HWDATA TOC entries are packed */
+#define SYS_TOC_SIZE		sizeof(sys_toc_entry)
+#define DUMP_HDR_SIZE		0x1c0
+#define SKIBOOT_TOC_OFFSET	0x2000
+#define SPARSE_LINES		2000	/* written at each end of a section */
+#define NEEDLE_PERIOD		1000003	/* every so many lines */
+#define BUF_SIZE		(1024 * 1024)
+
+static const char dump_name[] = "SYSDUMP.10665FT.00000003.20140513071107";
+static const int section_ids[MAX_SECTIONS] = {1, 2, 128, 3, 4, 5};
+
+static const char *messages[] = {
+	"CPU: All 80 processors called in...",
+	"HBRT: Mem region 'ibm,homer-image' installed",
+	"PHB#0000: Initializing PHB...",
+	"OCC: All Chip Rdy after 0 ms",
+	"PCI: Resetting PHBs...",
+	"SLW: Configuring self-restore for HRMOR",
+	"XSCOM: chip 0x0 at 0x3fc0000000000",
+	"FSP: Got HMC connected",
+};
+
+static int fd;
+
+static void write_all(int out_fd, const void *buf, size_t len)
+{
+	ssize_t sz;
+
+	while (len) {
+		sz = write(out_fd, buf, len);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			exit(2);
+		}
+		buf = (const char *)buf + sz;
+		len -= sz;
+	}
+}
+
+static void pwrite_all(const void *buf, size_t len, uint64_t offset)
+{
+	ssize_t sz;
+
+	while (len) {
+		sz = pwrite(fd, buf, len, offset);
+		if (sz < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("pwrite");
+			exit(2);
+		}
+		buf = (const char *)buf + sz;
+		len -= sz;
+		offset += sz;
+	}
+}
+
+static int format_line(char *buf, size_t len, uint64_t n, int id)
+{
+	const char *msg;
+
+	if (n % NEEDLE_PERIOD == NEEDLE_PERIOD / 2)
+		msg = "PLAT: Checkstop detected, needle in the log";
+	else
+		msg = messages[n % (sizeof(messages) / sizeof(messages[0]))];
+
+	return snprintf(buf, len, "[%10" PRIu64 ".%09" PRIu64 ",%d] %s\n",
+			n / 1000, (n % 1000) * 1000000, id, msg);
+}
+
+/* Fills len bytes at offset with lines, starting with line number first */
+static void write_lines(uint64_t offset, uint64_t len, uint64_t first, int id)
+{
+	static char buf[BUF_SIZE];
+	char line[128];
+	size_t used = 0;
+	uint64_t n = first;
+	int sz;
+
+	while (len) {
+		sz = format_line(line, sizeof(line), n++, id);
+		if (sz > len) {
+			/* No room for the line, leave the rest unused */
+			memset(line, 0, len);
+			sz = len;
+		}
+		if (used + sz > sizeof(buf)) {
+			pwrite_all(buf, used, offset);
+			offset += used;
+			used = 0;
+		}
+		memcpy(buf + used, line, sz);
+		used += sz;
+		len -= sz;
+	}
+	pwrite_all(buf, used, offset);
+}
+
+static void write_section(uint64_t offset, uint32_t size, int id, int dense)
+{
+	char line[128];
+	uint64_t head;
+	int sz;
+
+	if (dense) {
+		write_lines(offset, size, 0, id);
+		return;
+	}
+
+	sz = format_line(line, sizeof(line), 0, id);
+	head = (uint64_t)sz * SPARSE_LINES;
+	if (head * 2 >= size) {
+		write_lines(offset, size, 0, id);
+		return;
+	}
+
+	write_lines(offset, head, 0, id);
+	write_lines(offset + size - head, head, 1000000, id);
+}
+
+/* Replaces the dump at path with its compressed form */
+static void compress_dump(const char *path)
+{
+	static char buf[BUF_SIZE];
+	static struct dump_frame_index index;
+	struct dump_frame_ctx *ctx;
+	char tmp_path[PATH_MAX];
+	uint64_t offset = 0;
+	size_t index_size;
+	size_t zlen = dump_frame_bound(BUF_SIZE);
+	ssize_t sz, frame_size;
+	char *zbuf;
+	int out_fd;
+
+	ctx = dump_frame_ctx_new();
+	if (!ctx) {
+		fprintf(stderr, "Compression is not supported\n");
+		exit(3);
+	}
+
+	zbuf = malloc(zlen);
+	if (!zbuf) {
+		perror("malloc");
+		exit(2);
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		perror(tmp_path);
+		exit(2);
+	}
+
+	dump_frame_index_init(&index);
+	lseek(fd, 0, SEEK_SET);
+	while ((sz = read(fd, buf, sizeof(buf))) > 0) {
+		frame_size = dump_frame_compress(ctx, buf, sz, zbuf, zlen);
+		if (frame_size < 0) {
+			perror("compress");
+			exit(2);
+		}
+		write_all(out_fd, zbuf, frame_size);
+		offset += frame_size;
+
+		if (dump_frame_index_add(&index, frame_size, sz)) {
+			index_size = dump_frame_index_finish(&index, offset);
+			write_all(out_fd, index.frame, index_size);
+			offset += index_size;
+		}
+	}
+	if (sz < 0) {
+		perror(path);
+		exit(2);
+	}
+
+	index_size = dump_frame_index_finish(&index, offset);
+	write_all(out_fd, index.frame, index_size);
+
+	if (close(out_fd) || rename(tmp_path, path)) {
+		perror(tmp_path);
+		exit(2);
+	}
+
+	free(zbuf);
+	dump_frame_ctx_free(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t sizes[MAX_SECTIONS] = {0x180000, 0x2000, 0x8000};
+	int nr_sections = 3, dense = 0, compress = 0, i, opt;
+	uint64_t hwdata, toc_end, skiboot_start, sysdata, offset, total = 0;
+	uint8_t hw_toc[2 * HW_TOC_SIZE];
+	dump_file_hdr fhdr;
+	sec_dir_entry sec;
+	dump_hdr dhdr;
+	dump_node_header node;
+	sys_toc_entry sys_toc[2];
+	mdst_table mdst[MAX_SECTIONS];
+	char zero[16];
+	char *end;
+
+	while ((opt = getopt(argc, argv, "dz")) != -1) {
+		switch (opt) {
+		case 'd':
+			dense = 1;
+			break;
+		case 'z':
+			compress = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind >= argc)
+		goto usage;
+
+	if (argc - optind > 1) {
+		nr_sections = argc - optind - 1;
+		if (nr_sections > MAX_SECTIONS)
+			goto usage;
+		for (i = 0; i < nr_sections; i++) {
+			sizes[i] = strtoul(argv[optind + 1 + i], &end, 0);
+			if (*end)
+				goto usage;
+		}
+	}
+
+	if (sizes[0] + SKIBOOT_HEADER_SIZE <= SKIBOOT_SIZE_LIMIT) {
+		fprintf(stderr, "The skiboot log must be over 0x%x bytes\n",
+			SKIBOOT_SIZE_LIMIT - SKIBOOT_HEADER_SIZE);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_sections; i++)
+		total += sizes[i];
+
+	fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(argv[optind]);
+		exit(2);
+	}
+
+	/* File header */
+	memset(&fhdr, 0, sizeof(fhdr));
+	memcpy(fhdr.label, DUMP_FILE_SIGNATURE, DUMP_FILE_SIGNATURE_LENGTH);
+	fhdr.dirsize = htobe16(sizeof(fhdr));
+	fhdr.type = htobe16(1);
+	fhdr.prefixsize = htobe16(DUMP_FILE_PREFIX_SIZE);
+	memcpy(fhdr.fname, dump_name, sizeof(dump_name) - 1);
+	pwrite_all(&fhdr, sizeof(fhdr), 0);
+
+	/* Section directory */
+	offset = SECTION_START_OFFSET;
+	for (i = 0; i < 2; i++) {
+		memset(&sec, 0, sizeof(sec));
+		memcpy(sec.dirlabel, SECTION_SIGNATURE, SECTION_SIGNATURE_LENGTH);
+		sec.dirsize = htobe16(sizeof(sec));
+		sec.flags = htobe32(i ? SECTION_LAST : 0);
+		snprintf(sec.secname, sizeof(sec.secname), "SEC%d", i);
+		pwrite_all(&sec, sizeof(sec), offset);
+		offset += sizeof(sec);
+	}
+
+	/* Dump header */
+	memset(&dhdr, 0, sizeof(dhdr));
+	memcpy(dhdr.type, DUMP_HDR_SIGNATURE, DUMP_HDR_SIGNATURE_LENGTH);
+	dhdr.id = htobe32(3);
+	dhdr.version = htobe16(1);
+	dhdr.dumphdrsize = htobe16(DUMP_HDR_SIZE);
+	pwrite_all(&dhdr, sizeof(dhdr), offset);
+	hwdata = offset + DUMP_HDR_SIZE;
+
+	/* HWDATA node, the second TOC entry is the skiboot log */
+	memset(hw_toc, 0, sizeof(hw_toc));
+	*(uint32_t *)&hw_toc[offsetof(hw_toc_entry, id)] = htobe32(1);
+	*(uint32_t *)&hw_toc[offsetof(hw_toc_entry, offset)] = htobe32(0x100);
+	*(uint32_t *)&hw_toc[offsetof(hw_toc_entry, size)] = htobe32(0x1000);
+	*(uint32_t *)&hw_toc[HW_TOC_SIZE + offsetof(hw_toc_entry, id)] = htobe32(2);
+	*(uint32_t *)&hw_toc[HW_TOC_SIZE + offsetof(hw_toc_entry, offset)] =
+		htobe32(SKIBOOT_TOC_OFFSET);
+	*(uint32_t *)&hw_toc[HW_TOC_SIZE + offsetof(hw_toc_entry, flags)] =
+		htobe32(BLOCK_DATA_FACILITY << 27);
+	*(uint32_t *)&hw_toc[HW_TOC_SIZE + offsetof(hw_toc_entry, size)] =
+		htobe32(sizes[0] + SKIBOOT_HEADER_SIZE);
+
+	toc_end = hwdata + sizeof(node) + sizeof(hw_toc);
+	skiboot_start = toc_end + SKIBOOT_TOC_OFFSET + SKIBOOT_HEADER_SIZE;
+	sysdata = skiboot_start + total;
+	if (sysdata - hwdata > UINT32_MAX) {
+		fprintf(stderr, "The sections must fit in 4 GiB\n");
+		exit(1);
+	}
+
+	memset(&node, 0, sizeof(node));
+	memcpy(node.dumplabel, HWDATA_SIGNATURE, HWDATA_SIGNATURE_LENGTH);
+	node.headersize = htobe16(sizeof(node));
+	node.headerversion = htobe16(SUPPORTED_DUMP_HDR_VERSION);
+	node.dumpsize = htobe32(sysdata - hwdata);
+	node.dumpversion = htobe16(0x10);
+	node.datasize = htobe32(sysdata - toc_end);
+	node.toccnt = htobe32(2);
+	node.tocsize = htobe16(HW_TOC_SIZE);
+	pwrite_all(&node, sizeof(node), hwdata);
+	pwrite_all(hw_toc, sizeof(hw_toc), hwdata + sizeof(node));
+
+	/* Sections, back to back from the start of the skiboot log */
+	offset = skiboot_start;
+	for (i = 0; i < nr_sections; i++) {
+		write_section(offset, sizes[i], section_ids[i], dense);
+		mdst[i].addr = htobe64(0x30000000 + i);
+		mdst[i].type = htobe32(section_ids[i]);
+		mdst[i].size = htobe32(sizes[i]);
+		offset += sizes[i];
+	}
+
+	/* SYSDATA node holding the MDST table */
+	sys_toc[0].id = htobe32(0x1234);
+	sys_toc[0].offset = htobe32(0);
+	sys_toc[0].size = htobe32(sizeof(zero));
+	sys_toc[1].id = htobe32(MDST_TABLE_ID);
+	sys_toc[1].offset = htobe32(sizeof(zero));
+	sys_toc[1].size = htobe32(nr_sections * sizeof(mdst_table));
+
+	memset(&node, 0, sizeof(node));
+	memcpy(node.dumplabel, DATA_SECTION, DATA_SECTION_LENGTH);
+	node.headersize = htobe16(sizeof(node));
+	node.headerversion = htobe16(SUPPORTED_DUMP_HDR_VERSION);
+	node.headerflags = htobe32(1);
+	node.dumpsize = htobe32(sizeof(node) + sizeof(sys_toc) + sizeof(zero) +
+				nr_sections * sizeof(mdst_table));
+	node.dumpversion = htobe16(0x10);
+	node.datasize = htobe32(sizeof(zero) + nr_sections * sizeof(mdst_table));
+	node.toccnt = htobe32(2);
+	node.tocsize = htobe16(SYS_TOC_SIZE);
+
+	memset(zero, 0, sizeof(zero));
+	offset = sysdata;
+	pwrite_all(&node, sizeof(node), offset);
+	offset += sizeof(node);
+	pwrite_all(sys_toc, sizeof(sys_toc), offset);
+	offset += sizeof(sys_toc);
+	pwrite_all(zero, sizeof(zero), offset);
+	offset += sizeof(zero);
+	pwrite_all(mdst, nr_sections * sizeof(mdst_table), offset);
+
+	if (compress)
+		compress_dump(argv[optind]);
+
+	if (close(fd)) {
+		perror(argv[optind]);
+		exit(2);
+	}
+	exit(0);
+
+usage:
+	fprintf(stderr, "usage: %s [-d] [-z] pathname [section size ...]\n"
+		"  -d  fill the sections completely (default: sparse)\n"
+		"  -z  compress the dump\n"
+		"  up to %d section sizes, the first one is the skiboot log\n",
+		argv[0], MAX_SECTIONS);
+	exit(1);
+}
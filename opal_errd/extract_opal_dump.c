@@ -34,6 +34,10 @@
 #include <dirent.h>
 #include <endian.h>
 #include <syslog.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "dump_frames.h"
 
 #define DEFAULT_SYSFS_PATH	"/sys"
 #define DEFAULT_DUMP_PATH	"firmware/opal/dump"
@@ -46,6 +50,8 @@
 int opt_ack_dump = 1;
 int opt_wait = 0;
 int opt_max_dump = DEFAULT_MAX_DUMP;
+uint64_t opt_max_bytes = 0;	/* 0: no byte budget */
+int opt_compress = 0;
 
 char *opt_sysfs = DEFAULT_SYSFS_PATH;
 char *opt_output_dir = DEFAULT_OUTPUT_DIR;
@@ -61,6 +67,11 @@ static void help(const char* argv0)
 		DEFAULT_OUTPUT_DIR);
 	fprintf(stderr, "-m max - maximum number of dumps of a specific type"
 		" to be saved\n");
+	fprintf(stderr, "-b size - maximum total size of the saved dumps, with"
+		" an optional\n"
+		"         K, M or G suffix (default no limit)\n");
+	fprintf(stderr, "-z     - compress the saved dumps (%s suffix)\n",
+		DUMP_FRAME_SUFFIX);
 	fprintf(stderr, "-w     - wait for a dump\n");
 	fprintf(stderr, "-h     - help (this message)\n");
 }
@@ -135,28 +146,120 @@ static void check_dup_dump_file(char *dumpname)
 		       dump_path, strerror(errno));
 }
 
-static int timesort(const struct dirent **file1, const struct dirent **file2)
+/* A file of the output directory, as seen by the retention policy */
+struct dump_file {
+	char	name[NAME_MAX + 1];
+	time_t	mtime;
+	off_t	size;
+	int	removed;
+};
+
+/* Newest first */
+static int dump_file_cmp(const void *p1, const void *p2)
 {
-	struct stat sbuf1, sbuf2;
-	char dump_path1[PATH_MAX];
-	char dump_path2[PATH_MAX];
-	int rc;
+	const struct dump_file *file1 = p1;
+	const struct dump_file *file2 = p2;
 
-	snprintf(dump_path1, PATH_MAX, "%s/%s",
-		 opt_output_dir, (*file1)->d_name);
+	if (file1->mtime != file2->mtime)
+		return file1->mtime < file2->mtime ? 1 : -1;
 
-	snprintf(dump_path2, PATH_MAX, "%s/%s",
-		 opt_output_dir, (*file2)->d_name);
+	return strcmp(file1->name, file2->name);
+}
 
-	rc = stat(dump_path1, &sbuf1);
-	if (rc < 0)
-		return rc;
+/*
+ * Lists the dump files of the output directory with their time and size
+ *
+ * Each file is stat()ed once here rather than on every comparison of
+ * the sort.
+ */
+static int get_dump_files(struct dump_file **files)
+{
+	struct dump_file *list = NULL, *tmp;
+	struct dirent *dirent;
+	struct stat sbuf;
+	int n = 0, size = 0;
+	DIR *dir;
 
-	rc = stat(dump_path2, &sbuf2);
-	if (rc < 0)
-		return rc;
+	dir = opendir(opt_output_dir);
+	if (!dir)
+		return -1;
 
-	return (sbuf2.st_mtime - sbuf1.st_mtime);
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		if (fstatat(dirfd(dir), dirent->d_name, &sbuf,
+			    AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(sbuf.st_mode))
+			continue;
+
+		if (n == size) {
+			size = size ? size * 2 : 16;
+			tmp = realloc(list, size * sizeof(struct dump_file));
+			if (!tmp) {
+				syslog(LOG_ERR, "Failed to allocate memory "
+				       "for dump retention\n");
+				free(list);
+				closedir(dir);
+				return -1;
+			}
+			list = tmp;
+		}
+
+		strncpy(list[n].name, dirent->d_name, NAME_MAX);
+		list[n].name[NAME_MAX] = '\0';
+		list[n].mtime = sbuf.st_mtime;
+		list[n].size = sbuf.st_size;
+		list[n].removed = 0;
+		n++;
+	}
+
+	closedir(dir);
+
+	qsort(list, n, sizeof(struct dump_file), dump_file_cmp);
+	*files = list;
+	return n;
+}
+
+static void remove_dump_file(struct dump_file *file)
+{
+	char dump_path[PATH_MAX];
+
+	snprintf(dump_path, PATH_MAX, "%s/%s", opt_output_dir, file->name);
+
+	if (unlink(dump_path) < 0) {
+		syslog(LOG_NOTICE, "Could not delete file \"%s\" "
+		       "(%s) to make room for incoming platform dump."
+		       " The new dump will be saved anyways.\n",
+		       dump_path, strerror(errno));
+		return;
+	}
+
+	file->removed = 1;
+}
+
+/*
+ * Names of the dumps firmware presents, the byte budget only removes
+ * files named like one of these or like the incoming dump
+ */
+static const char *dump_name_prefixes[] = {
+	"SYSDUMP.",		/* System dump */
+	"FSPDUMP.",		/* Service processor dump */
+	"platform.",		/* Dump without a name in its header */
+};
+
+static int is_dump_file(const char *dumpname, const char *name)
+{
+	unsigned int i;
+
+	if (!strncmp(dumpname, name, DUMP_TYPE_LEN))
+		return 1;
+
+	for (i = 0; i < sizeof(dump_name_prefixes) / sizeof(char *); i++)
+		if (!strncmp(name, dump_name_prefixes[i],
+			     strlen(dump_name_prefixes[i])))
+			return 1;
+
+	return 0;
 }
 
 /**
@@ -167,49 +270,425 @@ static int timesort(const struct dirent **file1, const struct dirent **file2)
  * via command line option. This routine will search through and remove
  * any dump files of the specified type if the count exceeds the maximum value.
  *
+ * If a byte budget is set, the oldest dumps of any type are then removed
+ * until the remaining ones and the incoming dump of dump_size bytes fit
+ * in it. Other files of the output directory are left alone, and so are
+ * the dumps if the incoming one would not fit on its own.
  */
-static void remove_dump_files(char *dumpname)
+static void remove_dump_files(char *dumpname, uint64_t dump_size)
 {
-	struct dirent **namelist;
-	struct dirent *dirent;
-	char dump_path[PATH_MAX];
+	struct dump_file *files;
+	uint64_t total = dump_size;
 	int i;
 	int n;
 	int count = 0;
 
 	check_dup_dump_file(dumpname);
 
-	n = scandir(opt_output_dir, &namelist, NULL, timesort);
+	n = get_dump_files(&files);
 	if (n < 0)
 		return;
 
 	for (i = 0; i < n; i++) {
-		dirent = namelist[i];
-
 		/* Skip dump files of different type */
-		if (dirent->d_name[0] == '.' ||
-		    strncmp(dumpname, dirent->d_name, DUMP_TYPE_LEN)) {
-			free(namelist[i]);
+		if (strncmp(dumpname, files[i].name, DUMP_TYPE_LEN))
 			continue;
-		}
 
 		count++;
-		snprintf(dump_path, PATH_MAX, "%s/%s",
-			 opt_output_dir, dirent->d_name);
+		if (count < opt_max_dump)
+			continue;
 
-		free(namelist[i]);
+		remove_dump_file(&files[i]);
+	}
 
-		if (count < opt_max_dump)
+	if (opt_max_bytes && dump_size > opt_max_bytes) {
+		syslog(LOG_NOTICE, "Platform dump %s of %" PRIu64 " bytes "
+		       "exceeds the %" PRIu64 " bytes allowed to dumps, not "
+		       "deleting older dumps for it\n", dumpname, dump_size,
+		       opt_max_bytes);
+	} else if (opt_max_bytes) {
+		for (i = 0; i < n; i++)
+			if (!files[i].removed &&
+			    is_dump_file(dumpname, files[i].name))
+				total += files[i].size;
+
+		for (i = n - 1; i >= 0 && total > opt_max_bytes; i--) {
+			if (files[i].removed ||
+			    !is_dump_file(dumpname, files[i].name))
+				continue;
+
+			remove_dump_file(&files[i]);
+			if (files[i].removed) {
+				total -= files[i].size;
+				syslog(LOG_NOTICE, "Deleted platform dump %s/%s"
+				       " to keep dumps within %" PRIu64
+				       " bytes\n", opt_output_dir,
+				       files[i].name, opt_max_bytes);
+			}
+		}
+	}
+
+	free(files);
+}
+
+/*
+ * Amount of the dump copied at a time, memory use does not depend on its
+ * size. A chunk of a compressed dump goes to a frame of its own.
+ */
+#define DUMP_COPY_BUF_SIZE	DUMP_FRAME_MAX
+
+/*
+ * Index of the saved dumps by content, in the output directory
+ *
+ * Firmware may present a dump we already saved again, after a failed
+ * ack or a restart of the daemon. Each line holds the name of a saved
+ * dump, its size, the hash of its first DUMP_COPY_BUF_SIZE bytes and the
+ * hash of all of it. The name starts with a dot so that the retention
+ * policy leaves the index alone.
+ */
+#define DUMP_INDEX_FILE		".dump_index"
+
+/* 128 bit hash of the dump content, two independent 64 bit lanes */
+struct dump_hash {
+	uint64_t	h[2];
+	uint64_t	len;
+	uint8_t		tail[8];	/* Bytes short of a whole word */
+	int		tail_len;
+};
+
+struct dump_index_entry {
+	char		name[NAME_MAX + 1];
+	uint64_t	size;
+	uint64_t	head[2];
+	uint64_t	hash[2];
+};
+
+struct dump_index {
+	struct dump_index_entry	*entries;
+	int			nr_entries;
+};
+
+static inline uint64_t dump_hash_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline void dump_hash_word(struct dump_hash *hash, uint64_t w)
+{
+	hash->h[0] = (hash->h[0] ^ dump_hash_mix(w)) * 0x9e3779b97f4a7c15ULL;
+	hash->h[1] = (hash->h[1] + dump_hash_mix(w ^ 0x5851f42d4c957f2dULL)) *
+		     0xd6e8feb86659fd93ULL;
+}
+
+static void dump_hash_init(struct dump_hash *hash)
+{
+	memset(hash, 0, sizeof(*hash));
+	hash->h[0] = 0x243f6a8885a308d3ULL;
+	hash->h[1] = 0x13198a2e03707344ULL;
+}
+
+/* Hashes a word at a time, the hash is not meant to resist an attacker */
+static void dump_hash_update(struct dump_hash *hash, const char *buf,
+			     size_t len)
+{
+	uint64_t w;
+
+	hash->len += len;
+
+	while (hash->tail_len && len) {
+		hash->tail[hash->tail_len++] = *buf++;
+		len--;
+		if (hash->tail_len == sizeof(w)) {
+			memcpy(&w, hash->tail, sizeof(w));
+			dump_hash_word(hash, w);
+			hash->tail_len = 0;
+		}
+	}
+
+	for (; len >= sizeof(w); buf += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, buf, sizeof(w));
+		dump_hash_word(hash, w);
+	}
+
+	memcpy(hash->tail, buf, len);
+	hash->tail_len = len;
+}
+
+static void dump_hash_final(struct dump_hash *hash, uint64_t out[2])
+{
+	uint64_t w = 0;
+
+	if (hash->tail_len) {
+		memcpy(&w, hash->tail, hash->tail_len);
+		dump_hash_word(hash, w);
+	}
+
+	out[0] = dump_hash_mix(hash->h[0] ^ hash->len);
+	out[1] = dump_hash_mix(hash->h[1] ^ dump_hash_mix(hash->len));
+}
+
+static void dump_hash_buf(const char *buf, size_t len, uint64_t out[2])
+{
+	struct dump_hash hash;
+
+	dump_hash_init(&hash);
+	dump_hash_update(&hash, buf, len);
+	dump_hash_final(&hash, out);
+}
+
+/* Reads the index of the dumps saved in output_dir, a missing index is empty */
+static void load_dump_index(const char *output_dir, struct dump_index *index)
+{
+	struct dump_index_entry entry, *tmp;
+	char path[PATH_MAX];
+	char line[NAME_MAX + 128];
+	int size = 0;
+	FILE *fp;
+
+	index->entries = NULL;
+	index->nr_entries = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", output_dir, DUMP_INDEX_FILE);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%255s %" SCNu64 " %16" SCNx64 "%16" SCNx64
+			   " %16" SCNx64 "%16" SCNx64, entry.name, &entry.size,
+			   &entry.head[0], &entry.head[1],
+			   &entry.hash[0], &entry.hash[1]) != 6)
 			continue;
 
-		if (unlink(dump_path) < 0)
-			syslog(LOG_NOTICE, "Could not delete file \"%s\" "
-			"(%s) to make room for incoming platform dump."
-			" The new dump will be saved anyways.\n",
-			dump_path, strerror(errno));
+		if (index->nr_entries == size) {
+			size = size ? size * 2 : 16;
+			tmp = realloc(index->entries,
+				      size * sizeof(struct dump_index_entry));
+			if (!tmp)
+				break;
+			index->entries = tmp;
+		}
+		index->entries[index->nr_entries++] = entry;
+	}
+
+	fclose(fp);
+}
+
+/*
+ * Writes the index back, with entry added (replacing any entry of the
+ * same name) and without the dumps that have been removed since
+ */
+static void save_dump_index(const char *output_dir, struct dump_index *index,
+			    struct dump_index_entry *entry)
+{
+	struct dump_index_entry *e;
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	struct stat sbuf;
+	FILE *fp;
+	int i;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/%s.tmp", output_dir,
+		 DUMP_INDEX_FILE);
+
+	fp = fopen(tmp_path, "w");
+	if (!fp) {
+		syslog(LOG_NOTICE, "Failed to write platform dump index: %s "
+		       "(%d:%s)\n", tmp_path, errno, strerror(errno));
+		return;
 	}
 
-	free(namelist);
+	for (i = 0; i <= index->nr_entries; i++) {
+		e = i < index->nr_entries ? &index->entries[i] : entry;
+		if (e != entry && !strcmp(e->name, entry->name))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", output_dir, e->name);
+		if (stat(path, &sbuf) == -1)
+			continue;
+
+		fprintf(fp, "%s %" PRIu64 " %016" PRIx64 "%016" PRIx64
+			" %016" PRIx64 "%016" PRIx64 "\n", e->name, e->size,
+			e->head[0], e->head[1], e->hash[0], e->hash[1]);
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", output_dir, DUMP_INDEX_FILE);
+	if (fflush(fp) || fsync(fileno(fp)) || fclose(fp) ||
+	    rename(tmp_path, path)) {
+		syslog(LOG_NOTICE, "Failed to write platform dump index: %s "
+		       "(%d:%s)\n", path, errno, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+static ssize_t read_dump_chunk(int fd, char *buf, size_t len)
+{
+	ssize_t readsz;
+	size_t sz = 0;
+
+	while (sz < len) {
+		readsz = read(fd, buf + sz, len - sz);
+		if (readsz == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (readsz == 0)
+			break;
+		sz += readsz;
+	}
+
+	return sz;
+}
+
+static int write_dump_chunk(int fd, const char *buf, size_t len)
+{
+	ssize_t sz;
+
+	while (len) {
+		sz = write(fd, buf, len);
+		if (sz == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += sz;
+		len -= sz;
+	}
+
+	return 0;
+}
+
+/*
+ * Looks for a saved dump with the same content as the one being read
+ *
+ * Only a saved dump with the same size and the same first chunk, held in
+ * buf, is a candidate. The rest of the dump is then hashed once without
+ * being written anywhere, and compared with the hash of every candidate.
+ * If it turns out to be different, the dump is read again from its start
+ * so that it can be copied as usual.
+ *
+ * Returns the matching entry, NULL if there is none or on error.
+ */
+static struct dump_index_entry *find_dup_dump(int in_fd, char *buf,
+					      ssize_t *readsz, uint64_t size,
+					      const char *output_dir,
+					      struct dump_index *index,
+					      const uint64_t head[2])
+{
+	struct dump_index_entry *entry;
+	struct dump_hash hash;
+	char path[PATH_MAX];
+	uint64_t full[2];
+	ssize_t sz = 0;
+	int i, hashed = 0;
+
+	for (i = 0; i < index->nr_entries; i++) {
+		entry = &index->entries[i];
+		if (entry->size != size || entry->head[0] != head[0] ||
+		    entry->head[1] != head[1])
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", output_dir, entry->name);
+		if (access(path, F_OK))
+			continue;
+
+		/* Hashed on the first candidate, the dump is read once */
+		if (!hashed) {
+			dump_hash_init(&hash);
+			sz = *readsz;
+			while (sz > 0) {
+				dump_hash_update(&hash, buf, sz);
+				sz = read_dump_chunk(in_fd, buf,
+						     DUMP_COPY_BUF_SIZE);
+			}
+			dump_hash_final(&hash, full);
+			hashed = 1;
+
+			if (sz != 0)
+				break;
+		}
+
+		if (full[0] == entry->hash[0] && full[1] == entry->hash[1])
+			return entry;
+	}
+
+	if (!hashed)
+		return NULL;
+
+	/* Not the same, start over */
+	if (lseek(in_fd, 0, SEEK_SET) == -1 ||
+	    (*readsz = read_dump_chunk(in_fd, buf, DUMP_COPY_BUF_SIZE)) == -1)
+		*readsz = -1;
+
+	return NULL;
+}
+
+/*
+ * Sets up compression of the dump, returns NULL if it is to be saved as is
+ *
+ * The dump is compressed a chunk at a time, each chunk going to its own
+ * frame, on the same path it is copied through. The frames are listed by
+ * the index frames built in *zindex.
+ */
+static struct dump_frame_ctx *get_compression(char **zbuf, size_t *zbuf_len,
+					      struct dump_frame_index **zindex)
+{
+	static int warned;
+	struct dump_frame_ctx *ctx;
+
+	if (!opt_compress)
+		return NULL;
+
+	ctx = dump_frame_ctx_new();
+	if (!ctx) {
+		if (errno == ENOTSUP && !warned)
+			syslog(LOG_WARNING, "Dump compression is not "
+			       "supported, saving platform dumps "
+			       "uncompressed\n");
+		else if (errno != ENOTSUP)
+			syslog(LOG_ERR, "Failed to allocate memory for dump "
+			       "compression, saving platform dump "
+			       "uncompressed\n");
+		warned = 1;
+		return NULL;
+	}
+
+	*zbuf_len = dump_frame_bound(DUMP_COPY_BUF_SIZE);
+	*zbuf = malloc(*zbuf_len);
+	*zindex = malloc(sizeof(**zindex));
+	if (!*zbuf || !*zindex) {
+		syslog(LOG_ERR, "Failed to allocate memory for dump "
+		       "compression, saving platform dump uncompressed\n");
+		free(*zbuf);
+		free(*zindex);
+		*zbuf = NULL;
+		*zindex = NULL;
+		dump_frame_ctx_free(ctx);
+		return NULL;
+	}
+	dump_frame_index_init(*zindex);
+
+	return ctx;
+}
+
+/* Writes the index frame of the frames since the last one */
+static int write_frame_index(int out_fd, struct dump_frame_index *zindex,
+			     uint64_t *total_out)
+{
+	size_t size;
+
+	size = dump_frame_index_finish(zindex, *total_out);
+	if (write_dump_chunk(out_fd, (char *)zindex->frame, size) == -1)
+		return -1;
+
+	*total_out += size;
+	return 0;
 }
 
 static int process_dump(const char* dump_dir_path, const char *output_dir)
@@ -220,12 +699,22 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 	char dump_path[PATH_MAX];
 	char final_dump_path[PATH_MAX];
 	char *buf;
-	size_t bufsz;
+	char *zbuf = NULL;
+	size_t zbuf_len = 0;
+	struct dump_frame_ctx *zctx = NULL;
+	struct dump_frame_index *zindex = NULL;
+	struct dump_index index;
+	struct dump_index_entry entry, *dup;
+	struct dump_hash hash;
 	struct stat sbuf;
+	struct timespec start, end;
+	double secs;
 	int ret = -1;
-	ssize_t sz = 0;
+	uint64_t total = 0;
+	uint64_t total_out = 0;
 	ssize_t readsz = 0;
-	char outfname[DUMP_MAX_FNAME_LEN];
+	ssize_t frame_size;
+	char outfname[DUMP_MAX_FNAME_LEN + sizeof(DUMP_FRAME_SUFFIX)];
 	uint16_t prefix_size;
 	int rc;
 
@@ -234,13 +723,19 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 	if (stat(dump_path,&sbuf) == -1)
 		return -1;
 
-	bufsz = sbuf.st_size;
-	buf = malloc(bufsz);
+	/*
+	 * The dump is streamed through a fixed size buffer, a dump can be
+	 * many GB and we may be running on a system in trouble.
+	 */
+	buf = malloc(DUMP_COPY_BUF_SIZE);
 	if (!buf) {
 		syslog(LOG_ERR, "Failed to allocate memory for dump\n");
 		return -1;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	load_dump_index(output_dir, &index);
+
 	in_fd = open(dump_path, O_RDONLY);
 
 	if (in_fd == -1) {
@@ -249,25 +744,47 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 		goto err;
 	}
 
-	do {
-		readsz = read(in_fd, buf+sz, bufsz-sz);
-		if (readsz == -1) {
-			syslog(LOG_ERR, "Failed to read platform dump: %s "
-			       "(%d:%s)\n",
-			       dump_path, errno, strerror(errno));
-			goto err;
-		}
-
-		sz += readsz;
-	} while(sz != bufsz);
+	/* The first chunk holds the header with the file name */
+	readsz = read_dump_chunk(in_fd, buf, DUMP_COPY_BUF_SIZE);
+	if (readsz == -1) {
+		syslog(LOG_ERR, "Failed to read platform dump: %s "
+		       "(%d:%s)\n",
+		       dump_path, errno, strerror(errno));
+		goto err;
+	}
 
-	dump_get_file_name(buf, bufsz, outfname,
+	dump_get_file_name(buf, readsz, outfname,
 			   DUMP_MAX_FNAME_LEN, &prefix_size);
 
+	memset(&entry, 0, sizeof(entry));
+	entry.size = sbuf.st_size;
+	dump_hash_buf(buf, readsz, entry.head);
+
+	dup = find_dup_dump(in_fd, buf, &readsz, entry.size, output_dir,
+			    &index, entry.head);
+	if (dup) {
+		syslog(LOG_NOTICE, "Platform dump %s is the same as %s/%s "
+		       "already saved, not saving it again\n",
+		       outfname, output_dir, dup->name);
+		ret = 0;
+		goto err;
+	}
+	if (readsz == -1) {
+		syslog(LOG_ERR, "Failed to read platform dump: %s/dump "
+		       "(%d:%s)\n",
+		       dump_dir_path, errno, strerror(errno));
+		goto err;
+	}
+	dump_hash_init(&hash);
+
+	zctx = get_compression(&zbuf, &zbuf_len, &zindex);
+	if (zctx)
+		strcat(outfname, DUMP_FRAME_SUFFIX);
+
 	snprintf(dump_path, sizeof(dump_path), "%s/%s.tmp", output_dir, outfname);
 	snprintf(final_dump_path, sizeof(dump_path), "%s/%s", output_dir, outfname);
 
-	remove_dump_files(outfname);
+	remove_dump_files(outfname, sbuf.st_size);
 
 	out_fd = open(dump_path, O_WRONLY|O_CREAT|O_EXCL, S_IRUSR|S_IRGRP);
 
@@ -277,19 +794,66 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 		goto err;
 	}
 
-	sz = write(out_fd, buf, bufsz);
-	if (sz != bufsz) {
+	while (readsz > 0) {
+		if (zctx) {
+			frame_size = dump_frame_compress(zctx, buf, readsz,
+							 zbuf, zbuf_len);
+			if (frame_size == -1) {
+				syslog(LOG_ERR, "Failed to compress platform "
+				       "dump: %s (%d:%s)\n",
+				       dump_path, errno, strerror(errno));
+				goto err_unlink;
+			}
+			rc = write_dump_chunk(out_fd, zbuf, frame_size);
+			total_out += frame_size;
+			if (rc != -1 &&
+			    dump_frame_index_add(zindex, frame_size, readsz))
+				rc = write_frame_index(out_fd, zindex,
+						       &total_out);
+		} else {
+			rc = write_dump_chunk(out_fd, buf, readsz);
+			total_out += readsz;
+		}
+		if (rc == -1) {
+			syslog(LOG_ERR, "Failed to write platform dump: %s "
+			       "(%d:%s)\n",
+			       dump_path, errno, strerror(errno));
+			goto err_unlink;
+		}
+		total += readsz;
+		dump_hash_update(&hash, buf, readsz);
+
+		readsz = read_dump_chunk(in_fd, buf, DUMP_COPY_BUF_SIZE);
+		if (readsz == -1) {
+			snprintf(final_dump_path, sizeof(final_dump_path),
+				 "%s/dump", dump_dir_path);
+			syslog(LOG_ERR, "Failed to read platform dump: %s "
+			       "(%d:%s)\n",
+			       final_dump_path, errno, strerror(errno));
+			goto err_unlink;
+		}
+	}
+
+	/* A dump cut short must not be saved, nor acked */
+	if (total != sbuf.st_size) {
+		syslog(LOG_ERR, "Platform dump %s/dump ended after %" PRIu64
+		       " of %" PRIu64 " bytes, not saving it\n", dump_dir_path,
+		       total, (uint64_t)sbuf.st_size);
+		goto err_unlink;
+	}
+
+	/* A compressed dump ends with an index frame */
+	if (zctx && write_frame_index(out_fd, zindex, &total_out) == -1) {
 		syslog(LOG_ERR, "Failed to write platform dump: %s (%d:%s)\n",
 		       dump_path, errno, strerror(errno));
-		unlink(dump_path);
-		goto err;
+		goto err_unlink;
 	}
 
 	rc = fsync(out_fd);
 	if (rc == -1) {
 		syslog(LOG_ERR, "Failed to sync platform dump: %s (%d:%s)\n",
 		       dump_path, errno, strerror(errno));
-		goto err;
+		goto err_unlink;
 	}
 
 	rc = rename(dump_path, final_dump_path);
@@ -298,9 +862,14 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 		syslog(LOG_ERR, "Failed to rename platform dump %s to %s"
 		       "(%d: %s)\n",
 		       dump_path, final_dump_path, errno, strerror(errno));
-		goto err;
+		goto err_unlink;
 	}
 
+	strncpy(entry.name, outfname, NAME_MAX);
+	entry.size = total;
+	dump_hash_final(&hash, entry.hash);
+	save_dump_index(output_dir, &index, &entry);
+
 	dir_fd = open(output_dir, O_RDONLY|O_DIRECTORY);
 	if (dir_fd == -1) {
 		syslog(LOG_ERR, "Failed to open platform dump directory: %s"
@@ -314,10 +883,27 @@ static int process_dump(const char* dump_dir_path, const char *output_dir)
 		       " (%d:%s)\n", output_dir, errno, strerror(errno));
 	}
 
-	syslog(LOG_NOTICE, "New platform dump available. File: %s/%s\n",
-	       output_dir, outfname);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	if (zctx)
+		syslog(LOG_NOTICE, "New platform dump available. File: %s/%s "
+		       "(%" PRIu64 " bytes compressed to %" PRIu64 " in %.3f s,"
+		       " %.1f MB/s)\n",
+		       output_dir, outfname, total, total_out, secs,
+		       secs > 0 ? total / secs / 1000000 : 0);
+	else
+		syslog(LOG_NOTICE, "New platform dump available. File: %s/%s "
+		       "(%" PRIu64 " bytes in %.3f s, %.1f MB/s)\n",
+		       output_dir, outfname, total, secs,
+		       secs > 0 ? total / secs / 1000000 : 0);
 
 	ret = 0;
+	goto err;
+
+err_unlink:
+	unlink(dump_path);
 err:
 	if (in_fd != -1)
 		close(in_fd);
@@ -325,6 +911,10 @@ err:
 		close(out_fd);
 	if (dir_fd != -1)
 		close(dir_fd);
+	dump_frame_ctx_free(zctx);
+	free(index.entries);
+	free(zindex);
+	free(zbuf);
 	free(buf);
 	return ret;
 }
@@ -375,7 +965,8 @@ static int find_and_process_dumps(const char *opal_dump_dir,
 				retval = -1;
 			if (rc == 0 && retval >= 0)
 				retval++;
-			if (opt_ack_dump)
+			/* Firmware deletes an acked dump, only ack a saved one */
+			if (opt_ack_dump && rc == 0)
 				ack_dump(dump_path);
 		}
 		free(namelist[i]);
@@ -386,6 +977,37 @@ static int find_and_process_dumps(const char *opal_dump_dir,
 	return retval;
 }
 
+/* Parses a size in bytes with an optional K, M or G suffix */
+static int parse_size(const char *str, uint64_t *size)
+{
+	unsigned long long val;
+	char *end;
+
+	errno = 0;
+	val = strtoull(str, &end, 10);
+	if (errno || end == str || str[0] == '-')
+		return -1;
+
+	switch (*end) {
+	case 'G': case 'g':
+		val <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		val <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		val <<= 10;
+		end++;
+		break;
+	}
+
+	if (*end)
+		return -1;
+
+	*size = val;
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	int opt;
@@ -398,7 +1020,7 @@ int main(int argc, char *argv[])
 	openlog("OPAL_DUMP", LOG_CONS | LOG_PID | LOG_NDELAY | LOG_PERROR,
 		LOG_LOCAL1);
 
-	while ((opt = getopt(argc, argv, "As:o:m:wh")) != -1) {
+	while ((opt = getopt(argc, argv, "As:o:m:b:zwh")) != -1) {
 		switch (opt) {
 		case 'A':
 			opt_ack_dump = 0;
@@ -418,6 +1040,17 @@ int main(int argc, char *argv[])
 				opt_max_dump = DEFAULT_MAX_DUMP;
 			}
 			break;
+		case 'b':
+			if (parse_size(optarg, &opt_max_bytes)) {
+				syslog(LOG_ERR, "Invalid value specified for "
+					"-b option (%s), not limiting the size "
+					"of the saved dumps\n", optarg);
+				opt_max_bytes = 0;
+			}
+			break;
+		case 'z':
+			opt_compress = 1;
+			break;
 		case 'w':
 			opt_wait = 1;
 			break;
@@ -30,32 +30,24 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <syslog.h>
+#include <getopt.h>
 #include <sys/types.h>
+#include <sys/inotify.h>
 
 #include "libopalevents.h"
 #include "opal-event-data.h"
 #include "parse-opal-event.h"
 #include "parse-esel-header.h"
+#include "opal-elog-stats.h"
+#include "opal-elog-summary.h"
 
 #define DEFAULT_opt_platform_dir "/var/log/opal-elog"
 char *opt_platform_dir = DEFAULT_opt_platform_dir;
 
-#define ELOG_COMMIT_TIME_OFFSET	0x10
-#define ELOG_CREATOR_ID_OFFSET	0x18
 #define ELOG_ID_OFFSET		0x2c
-#define ELOG_SEVERITY_OFFSET	0x3a
-#define ELOG_ACTION_OFFSET	0x42
-#define ELOG_SRC_OFFSET		0x78
-#define OPAL_ERROR_LOG_MAX	16384
-/* Service Action or Customer Attention Required */
-#define ELOG_ACTION_FLAG	0x8000
-
-#define ELOG_SRC_SIZE		8
 #define OPAL_ERROR_LOG_MAX	16384
 #define ELOG_BUF_MAX		OPAL_ERROR_LOG_MAX * 10
 
-#define ELOG_MIN_READ_OFFSET	ELOG_SRC_OFFSET + ELOG_SRC_SIZE
-
 /* Severity of the log */
 #define OPAL_INFORMATION_LOG    0x00
 #define OPAL_RECOVERABLE_LOG    0x10
@@ -65,20 +57,39 @@ char *opt_platform_dir = DEFAULT_opt_platform_dir;
 #define OPAL_DIAGNOSTICS_LOG	0x60
 #define OPAL_SYMPTOM_LOG	0x70
 
+/* Enough room for at least one inotify event with the longest name */
+#define INOTIFY_BUF_SIZE	(sizeof(struct inotify_event) + NAME_MAX + 1)
+
+static struct option long_options[] = {
+	{"follow",	no_argument,	NULL, 'w'},
+	{"help",	no_argument,	NULL, 'h'},
+	{"stats",	no_argument,	NULL, 'S'},
+	{"top",		required_argument, NULL, 'n'},
+	{0, 0, 0, 0}
+};
+
 void print_usage(char *command)
 {
 	printf("%s - Parse OPAL plaform error logs\n\n", command);
-	printf("Usage: %s { -d  <logid> | -e <logid> | -a | -l | -s | -h }"
-			" [ -p dir | -f file]\n\n"
+	printf("Usage: %s { -d  <logid> | -e <logid> | -a | -l | -s | -S | -h }"
+			" [ -p dir | -f file | -w | -n num ]\n\n"
 			"\t-a       - Display all error log entry details\n"
 			"\t-d logid - Display error log entry details\n"
 			"\t-e logid - Erase error log entry details (cannot be combined with -f)\n"
 			"\t-l       - List all error logs\n"
 			"\t-s       - List all service action logs\n"
+			"\t-S       - Display error log counts by severity, subsystem,\n"
+			"\t           creator, SRC and FRU location code\n"
+			"\t-n num   - Show the num most frequent entries of each -S\n"
+			"\t           category, 0 for all (default %d)\n"
 			"\t-p dir   - Use dir as elog directory (default %s)\n"
 			"\t-f file  - Specify elog by filename\n"
+			"\t-w       - Follow the elog directory, after the existing logs\n"
+			"\t           are shown display new logs as they are written\n"
+			"\t           (with -l, -s or -a; cannot be combined with -f)\n"
 			"\t-h       - Print this message and exit\n",
-			command, DEFAULT_opt_platform_dir);
+			command, OPAL_ELOG_STATS_TOP_DEFAULT,
+			DEFAULT_opt_platform_dir);
 }
 
 static int file_filter(const struct dirent *d)
@@ -220,34 +231,28 @@ out:
 
 }
 
-void print_elog_summary(char *buffer, int bufsz, uint32_t service_flag)
+void print_elog_summary(const struct opal_elog_summary *summary,
+			uint32_t service_flag)
 {
-	const char *parse;
-	uint32_t logid;
-	char src[ELOG_SRC_SIZE + 1];
-	char severity;
-	uint16_t action;
-	struct opal_datetime date_time_in, date_time_out;
-	uint8_t creator_id;
-	int plus;
-	logid = be32toh(*(uint32_t*)(buffer+ELOG_ID_OFFSET));
-	memcpy(src, (buffer + ELOG_SRC_OFFSET), sizeof(src));
-	src[ELOG_SRC_SIZE] = '\0';
-	severity = buffer[ELOG_SEVERITY_OFFSET];
-	action = be16toh(*(uint16_t *)(buffer + ELOG_ACTION_OFFSET));
-	plus = ((action & ELOG_ACTION_FLAG) == ELOG_ACTION_FLAG);
-	parse = get_severity_desc(severity & 0xF0);
-	/* & with 0xF0 to get only the category of severity, not the full description */
-
-	date_time_in = *(const struct opal_datetime *)(buffer + ELOG_COMMIT_TIME_OFFSET);
-	date_time_out = parse_opal_datetime(date_time_in);
-	creator_id = buffer[ELOG_CREATOR_ID_OFFSET];
+	const struct opal_datetime *date_time = &summary->commit_datetime;
+	/* Service Action or Customer Attention Required */
+	int plus = !!(summary->action & OPAL_UH_ACTION_SERVICE);
+
 	if (service_flag != 1 || plus)
 		printf("|%08X %04u-%02u-%02u %02u:%02u:%02u %8.8s %c %-17.17s %-20.20s|\n",
-		       logid, date_time_out.year, date_time_out.month,
-		       date_time_out.day, date_time_out.hour,
-		       date_time_out.minutes, date_time_out.seconds,
-		       src, (plus && !service_flag) ? '+' : ' ', get_creator_name(creator_id), parse);
+		       summary->log_entry_id, date_time->year, date_time->month,
+		       date_time->day, date_time->hour,
+		       date_time->minutes, date_time->seconds,
+		       summary->src, (plus && !service_flag) ? '+' : ' ',
+		       get_creator_name(summary->creator_id),
+		       get_severity_desc(summary->event_severity & 0xF0));
+}
+
+static void print_elog_summary_header(void)
+{
+	printf("|------------------------------------------------------------------------------|\n");
+	printf("|ID       Date       Time     SRC        Creator           Event Severity      |\n");
+	printf("|------------------------------------------------------------------------------|\n");
 }
 
 /* parse error log entry from file */
@@ -347,53 +352,51 @@ int elogdisplayentry(uint32_t eid, int display_all)
 	return ret;
 }
 
-/* print summary of specified file */
-int elog_summary(char *elog_path, uint32_t service_flag)
+/* print the summary line of a single elog in the platform directory */
+static int elog_summary_entry(char *elog_name, uint32_t service_flag)
 {
-	int ret = 0;
+	struct opal_elog_summary summary;
 	char *buffer;
 	ssize_t sz = 0;
+	int ret = 0;
 
-	printf("|------------------------------------------------------------------------------|\n");
-	printf("|ID       Date       Time     SRC        Creator           Event Severity      |\n");
-	printf("|------------------------------------------------------------------------------|\n");
-
-	sz = read_elog(elog_path, &buffer);
+	sz = read_elog(elog_name, &buffer);
 	if (sz < 0)
 		return -1;
 
-	if (sz < ELOG_MIN_READ_OFFSET) {
+	/* An eSEL header is skipped by the decoder */
+	if (opal_elog_summary_decode(&summary, buffer, sz)) {
 		fprintf(stderr, "Partially read elog, cannot parse\n");
 		ret = -1;
 	} else {
-		/* If the file is an eSEL, we need to ignore the header. */
-		if (parse_esel_header(buffer))
-			print_elog_summary(buffer + sizeof(struct esel_header),
-					   sz, service_flag);
-		else
-			print_elog_summary(buffer, sz, service_flag);
+		print_elog_summary(&summary, service_flag);
 	}
 
+	free(buffer);
+	return ret;
+}
+
+/* print summary of specified file */
+int elog_summary(char *elog_path, uint32_t service_flag)
+{
+	int ret;
+
+	print_elog_summary_header();
+
+	ret = elog_summary_entry(elog_path, service_flag);
 	if (!ret)
 		printf("|------------------------------------------------------------------------------|\n");
 
-	free(buffer);
 	return ret;
 }
 
-/* list all the error logs */
-int eloglist(uint32_t service_flag)
+/* print the summary line of every elog in the platform directory */
+static int elogdirlist(uint32_t service_flag)
 {
-	char *buffer;
 	struct dirent **filelist;
 	int nfiles;
-	ssize_t sz = 0;
 	int i;
 
-	printf("|------------------------------------------------------------------------------|\n");
-	printf("|ID       Date       Time     SRC        Creator           Event Severity      |\n");
-	printf("|------------------------------------------------------------------------------|\n");
-
 	nfiles = scandir(opt_platform_dir, &filelist,
 			 file_filter, alphasort);
 
@@ -407,31 +410,232 @@ int eloglist(uint32_t service_flag)
 	}
 
 	for (i = 0; i < nfiles; i++){
-		sz = read_elog(filelist[i]->d_name, &buffer);
-		if (sz < 0){
+		elog_summary_entry(filelist[i]->d_name, service_flag);
+		free(filelist[i]);
+	}
+	free(filelist);
+
+	return 0;
+}
+
+/* list all the error logs */
+int eloglist(uint32_t service_flag)
+{
+	print_elog_summary_header();
+
+	if (elogdirlist(service_flag))
+		return -1;
+
+	printf("|------------------------------------------------------------------------------|\n");
+
+	return 0;
+}
+
+/* Names of the elogs a follower has shown, sorted with strcmp() */
+struct elog_names {
+	char **name;
+	int nr;
+};
+
+static int elog_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int elog_name_shown(const struct elog_names *shown, const char *name)
+{
+	if (!shown->nr)
+		return 0;
+	return bsearch(&name, shown->name, shown->nr, sizeof(char *),
+		       elog_name_cmp) != NULL;
+}
+
+static void elog_name_add(struct elog_names *shown, const char *name)
+{
+	char **names;
+	char *copy;
+	int i;
+
+	copy = strdup(name);
+	names = realloc(shown->name, (shown->nr + 1) * sizeof(char *));
+	if (!copy || !names) {
+		/* Not fatal, the log may only be shown again */
+		free(copy);
+		if (names)
+			shown->name = names;
+		return;
+	}
+
+	for (i = shown->nr; i > 0 && strcmp(names[i - 1], name) > 0; i--)
+		names[i] = names[i - 1];
+	names[i] = copy;
+	shown->name = names;
+	shown->nr++;
+}
+
+static void elog_names_free(struct elog_names *shown)
+{
+	int i;
+
+	for (i = 0; i < shown->nr; i++)
+		free(shown->name[i]);
+	free(shown->name);
+	shown->name = NULL;
+	shown->nr = 0;
+}
+
+static int follow_show(char *elog_name, uint32_t service_flag, int display_all)
+{
+	if (display_all)
+		return elogdisplayfile(elog_name, 0, 1);
+
+	return elog_summary_entry(elog_name, service_flag);
+}
+
+/*
+ * Show the logs of the platform directory that are not in shown yet, and
+ * replace shown with the logs of the directory that have been shown, which
+ * also forgets the logs removed since.
+ */
+static int follow_scan(struct elog_names *shown, uint32_t service_flag,
+		       int display_all)
+{
+	struct elog_names scanned = { NULL, 0 };
+	struct dirent **filelist;
+	char *name;
+	int nfiles;
+	int i;
+
+	nfiles = scandir(opt_platform_dir, &filelist,
+			 file_filter, alphasort);
+	if (nfiles < 0) {
+		fprintf(stderr, "Error accessing directory: %s\n",
+			opt_platform_dir);
+		return -1;
+	}
+
+	scanned.name = calloc(nfiles + 1, sizeof(char *));
+	if (!scanned.name) {
+		fprintf(stderr, "Out of memory listing %s\n",
+			opt_platform_dir);
+		for (i = 0; i < nfiles; i++)
 			free(filelist[i]);
-			continue;
-		} else if (sz < ELOG_MIN_READ_OFFSET) {
-			fprintf(stderr, "Partially read elog, cannot parse\n");
-		} else {
-			/* If the file is an eSEL, we need to ignore the header */
-			if (parse_esel_header(buffer))
-				print_elog_summary(buffer+sizeof(struct esel_header),
-						   sz, service_flag);
-			else
-				print_elog_summary(buffer, sz, service_flag);
-		}
+		free(filelist);
+		return -1;
+	}
 
-		free(buffer);
+	for (i = 0; i < nfiles; i++) {
+		name = filelist[i]->d_name;
+
+		/* A log that could not be shown is retried on its event */
+		if (elog_name_shown(shown, name) ||
+		    !follow_show(name, service_flag, display_all)) {
+			scanned.name[scanned.nr] = strdup(name);
+			if (scanned.name[scanned.nr])
+				scanned.nr++;
+		}
 		free(filelist[i]);
 	}
 	free(filelist);
 
-	printf("|------------------------------------------------------------------------------|\n");
+	qsort(scanned.name, scanned.nr, sizeof(char *), elog_name_cmp);
+	elog_names_free(shown);
+	*shown = scanned;
 
 	return 0;
 }
 
+/*
+ * Show the existing error logs, then block on inotify and show each new
+ * log once opal_errd has finished writing it (IN_CLOSE_WRITE) or moved it
+ * into place (IN_MOVED_TO). Nothing is rescanned while waiting, so an
+ * idle follower costs nothing.
+ *
+ * The names of the logs shown are kept so that a log written while the
+ * directory is scanned is not shown twice, and so that the directory can
+ * be rescanned for the logs whose events were lost when the inotify queue
+ * overflows (IN_Q_OVERFLOW).
+ */
+int eloglist_follow(uint32_t service_flag, int display_all)
+{
+	char buf[INOTIFY_BUF_SIZE]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	struct elog_names shown = { NULL, 0 };
+	ssize_t len;
+	char *ptr;
+	int fd;
+	int ret = 0;
+
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "Error setting up inotify: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * Add the watch before listing so that a log written while the
+	 * directory is being scanned is not missed.
+	 */
+	if (inotify_add_watch(fd, opt_platform_dir,
+			      IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		fprintf(stderr, "Error watching directory: %s (%s)\n",
+			opt_platform_dir, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (!display_all)
+		print_elog_summary_header();
+	follow_scan(&shown, service_flag, display_all);
+	fflush(stdout);
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len == -1) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error reading inotify events: %s\n",
+				strerror(errno));
+			ret = -1;
+			break;
+		}
+
+		for (ptr = buf; ptr < buf + len;
+		     ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			if (event->mask & IN_IGNORED) {
+				fprintf(stderr, "Directory %s went away\n",
+					opt_platform_dir);
+				ret = -1;
+				goto out;
+			}
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				follow_scan(&shown, service_flag, display_all);
+				continue;
+			}
+
+			if (!event->len || (event->mask & IN_ISDIR) ||
+			    event->name[0] == '.' ||
+			    elog_name_shown(&shown, event->name))
+				continue;
+
+			if (!follow_show((char *)event->name, service_flag,
+					 display_all))
+				elog_name_add(&shown, event->name);
+		}
+		fflush(stdout);
+	}
+
+out:
+	elog_names_free(&shown);
+	close(fd);
+	return ret;
+}
+
 int delete_elog(const char *eid)
 {
 	int error = -1;
@@ -455,8 +659,14 @@ int main(int argc, char *argv[])
 	char *elog_path;
 	int opt_display_file = 0;
 	int opt_display_all = 0;
-
-	while ((opt = getopt(argc, argv, "ad:lshf:p:e:")) != -1) {
+	int opt_follow = 0;
+	int opt_top = OPAL_ELOG_STATS_TOP_DEFAULT;
+	int opt_top_given = 0;
+	char *end;
+	long val;
+
+	while ((opt = getopt_long(argc, argv, "ad:lshf:p:e:wSn:", long_options,
+				  NULL)) != -1) {
 		switch (opt) {
 		case 'e':
 		case 'd':
@@ -470,6 +680,7 @@ int main(int argc, char *argv[])
 			/* fallthrough */
 		case 'l':
 		case 's':
+		case 'S':
 			arg_cnt++;
 			do_operation = opt;
 			break;
@@ -485,6 +696,22 @@ int main(int argc, char *argv[])
 		case 'p':
 			opt_platform_dir = optarg;
 			break;
+		case 'w':
+			opt_follow = 1;
+			break;
+		case 'n':
+			errno = 0;
+			val = strtol(optarg, &end, 0);
+			if (errno || end == optarg || *end != '\0' ||
+			    val < 0 || val > INT_MAX) {
+				fprintf(stderr, "Invalid input for -n: %s\n",
+					optarg);
+				print_usage(argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			opt_top = val;
+			opt_top_given = 1;
+			break;
 		case 'h':
 			print_usage(argv[0]);
 			exit(EXIT_SUCCESS);
@@ -495,18 +722,45 @@ int main(int argc, char *argv[])
 	}
 
 	if (arg_cnt > 1) {
-		fprintf(stderr, "Only one operation (-d | -a | -l | -s | -e) "
+		fprintf(stderr, "Only one operation (-d | -a | -l | -s | -S | -e) "
 			"can be selected at any one time.\n");
 		print_usage(argv[0]);
 		return -1;
 	}
 
-	if (do_operation == 'e' && opt_display_file) {
-		fprintf(stderr, "Cannot combine -e and -f flags\n");
+	if ((do_operation == 'e' || do_operation == 'S') && opt_display_file) {
+		fprintf(stderr, "Cannot combine -%c and -f flags\n", do_operation);
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	if (opt_top_given && do_operation != 'S') {
+		fprintf(stderr, "-n can only be used with -S\n");
 		print_usage(argv[0]);
 		return -1;
 	}
 
+	if (opt_follow) {
+		if (opt_display_file) {
+			fprintf(stderr, "Cannot combine -w and -f flags\n");
+			print_usage(argv[0]);
+			return -1;
+		}
+
+		switch (do_operation) {
+		case 'l':
+		case 's':
+		case 'a':
+			return eloglist_follow(do_operation == 's',
+					       do_operation == 'a');
+		default:
+			fprintf(stderr, "-w can only be used with -l, -s "
+				"or -a\n");
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
 	switch (do_operation) {
 	case 'l':
 		if(opt_display_file){
@@ -518,6 +772,9 @@ int main(int argc, char *argv[])
 	case 'e':
 		ret = delete_elog(eid_opt);
 		break;
+	case 'S':
+		ret = elog_stats(opt_platform_dir, opt_top);
+		break;
 	case 'd':
 		/* fallthrough */
 	case 'a':
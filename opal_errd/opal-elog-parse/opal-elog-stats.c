@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <endian.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "opal-elog-stats.h"
+#include "opal-elog-summary.h"
+#include "opal-event-data.h"
+
+/*
+ * The statistics only need the private header, the user header and the
+ * primary SRC with its FRU callouts, which are always the first three
+ * sections. Reading this much of each elog is enough for all of them.
+ */
+#define ELOG_STATS_READ_MAX	4096
+
+#define ELOG_STATS_KEY_MAX	(OPAL_FRU_LOC_CODE_MAX + 1)
+
+/* Initial number of slots in a string keyed table, must be a power of 2 */
+#define ELOG_STATS_TABLE_INIT	64
+
+struct stats_entry {
+	char key[ELOG_STATS_KEY_MAX];
+	uint32_t count;
+};
+
+/* Open addressing hash table, slots with an empty key are free */
+struct stats_table {
+	struct stats_entry *slots;
+	uint32_t size;
+	uint32_t used;
+};
+
+struct elog_stats {
+	uint32_t nr_logs;
+	uint32_t nr_bad;
+	uint32_t nr_callouts;
+	uint32_t severity[256];
+	uint32_t subsystem[256];
+	uint32_t creator[256];
+	struct stats_table src;
+	struct stats_table location;
+};
+
+/* 32 bit FNV-1a */
+static uint32_t stats_hash(const char *key)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*key) {
+		hash ^= (uint8_t)*key++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct stats_entry *stats_slot(struct stats_entry *slots,
+				      uint32_t size, const char *key)
+{
+	uint32_t i = stats_hash(key) & (size - 1);
+
+	while (slots[i].key[0] != '\0' && strcmp(slots[i].key, key))
+		i = (i + 1) & (size - 1);
+
+	return &slots[i];
+}
+
+static int stats_table_grow(struct stats_table *table)
+{
+	struct stats_entry *slots;
+	struct stats_entry *slot;
+	uint32_t size;
+	uint32_t i;
+
+	size = table->size ? table->size * 2 : ELOG_STATS_TABLE_INIT;
+	slots = calloc(size, sizeof(struct stats_entry));
+	if (!slots)
+		return -ENOMEM;
+
+	for (i = 0; i < table->size; i++) {
+		if (table->slots[i].key[0] == '\0')
+			continue;
+		slot = stats_slot(slots, size, table->slots[i].key);
+		*slot = table->slots[i];
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->size = size;
+	return 0;
+}
+
+static int stats_table_add(struct stats_table *table, const char *key)
+{
+	struct stats_entry *slot;
+
+	if (key[0] == '\0')
+		return 0;
+
+	/* Keep the load factor under 3/4 */
+	if ((table->used + 1) * 4 > table->size * 3) {
+		if (stats_table_grow(table))
+			return -ENOMEM;
+	}
+
+	slot = stats_slot(table->slots, table->size, key);
+	if (slot->key[0] == '\0') {
+		strncpy(slot->key, key, ELOG_STATS_KEY_MAX - 1);
+		table->used++;
+	}
+	slot->count++;
+	return 0;
+}
+
+/*
+ * Account for the fields we aggregate on. The summary decoder looks at
+ * nothing but the PH, UH and PS sections and allocates nothing. An elog
+ * is only counted if both of its headers were found.
+ */
+static int elog_stats_add(struct elog_stats *stats, const char *buf,
+			  int buflen)
+{
+	struct opal_elog_summary summary;
+	int i;
+
+	if (opal_elog_summary_decode(&summary, buf, buflen))
+		return -EINVAL;
+
+	if ((summary.sections & (OPAL_ELOG_SUMMARY_PH | OPAL_ELOG_SUMMARY_UH)) !=
+	    (OPAL_ELOG_SUMMARY_PH | OPAL_ELOG_SUMMARY_UH))
+		return -EINVAL;
+
+	stats->creator[summary.creator_id]++;
+	stats->subsystem[summary.subsystem_id]++;
+	stats->severity[summary.event_severity]++;
+
+	if (!(summary.sections & OPAL_ELOG_SUMMARY_PS) || summary.scn_count < 3)
+		return 0;
+
+	stats_table_add(&stats->src, summary.src);
+	for (i = 0; i < summary.fru_count; i++) {
+		stats_table_add(&stats->location, summary.fru[i].location_code);
+		stats->nr_callouts++;
+	}
+
+	return 0;
+}
+
+static int elog_stats_read(int dir_fd, const char *name, char *buf)
+{
+	struct stat sbuf;
+	ssize_t readsz;
+	int sz = 0;
+	int fd;
+
+	fd = openat(dir_fd, name, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &sbuf) || !S_ISREG(sbuf.st_mode)) {
+		close(fd);
+		return -1;
+	}
+
+	do {
+		readsz = read(fd, buf + sz, ELOG_STATS_READ_MAX - sz);
+		if (readsz < 0) {
+			if (errno == EINTR)
+				continue;
+			sz = -1;
+			break;
+		}
+		sz += readsz;
+	} while (readsz && sz < ELOG_STATS_READ_MAX);
+
+	close(fd);
+	return sz;
+}
+
+static int stats_entry_cmp(const void *a, const void *b)
+{
+	const struct stats_entry *ea = a;
+	const struct stats_entry *eb = b;
+
+	if (ea->count != eb->count)
+		return ea->count < eb->count ? 1 : -1;
+	return strcmp(ea->key, eb->key);
+}
+
+static void print_stats_entries(const char *title, struct stats_entry *entries,
+				uint32_t nr_entries, int top_n)
+{
+	uint32_t i;
+
+	qsort(entries, nr_entries, sizeof(struct stats_entry), stats_entry_cmp);
+
+	printf("|------------------------------------------------------------------------------|\n");
+	printf("|%-68.68s %8s |\n", title, "Count");
+	printf("|------------------------------------------------------------------------------|\n");
+	for (i = 0; i < nr_entries && (!top_n || i < top_n); i++)
+		printf("|%-68.68s %8u |\n", entries[i].key, entries[i].count);
+	if (i < nr_entries)
+		printf("|%-68.68s %8s |\n", "...", "");
+	printf("|------------------------------------------------------------------------------|\n");
+	printf("\n");
+}
+
+static int print_stats_table(const char *title, struct stats_table *table,
+			     int top_n)
+{
+	struct stats_entry *entries;
+	uint32_t i, n = 0;
+
+	entries = malloc((table->used ? table->used : 1) *
+			 sizeof(struct stats_entry));
+	if (!entries)
+		return -ENOMEM;
+
+	for (i = 0; i < table->size; i++)
+		if (table->slots[i].key[0] != '\0')
+			entries[n++] = table->slots[i];
+
+	print_stats_entries(title, entries, n, top_n);
+	free(entries);
+	return 0;
+}
+
+static void print_stats_ids(const char *title, const uint32_t *counts,
+			    const char *(*get_desc)(uint8_t), int top_n)
+{
+	struct stats_entry entries[256];
+	uint32_t n = 0;
+	int id;
+
+	for (id = 0; id < 256; id++) {
+		if (!counts[id])
+			continue;
+		snprintf(entries[n].key, ELOG_STATS_KEY_MAX, "0x%02x %s",
+			 id, get_desc(id));
+		entries[n].count = counts[id];
+		n++;
+	}
+
+	print_stats_entries(title, entries, n, top_n);
+}
+
+int elog_stats(const char *elog_dir, int top_n)
+{
+	struct elog_stats *stats;
+	struct dirent *dirent;
+	char buf[ELOG_STATS_READ_MAX];
+	DIR *dir;
+	int sz;
+	int ret = 0;
+
+	dir = opendir(elog_dir);
+	if (!dir) {
+		fprintf(stderr, "Error accessing directory: %s\n", elog_dir);
+		return -1;
+	}
+
+	stats = calloc(1, sizeof(struct elog_stats));
+	if (!stats) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		closedir(dir);
+		return -1;
+	}
+
+	while ((dirent = readdir(dir)) != NULL) {
+		if (dirent->d_name[0] == '.' || dirent->d_type == DT_DIR)
+			continue;
+
+		sz = elog_stats_read(dirfd(dir), dirent->d_name, buf);
+		if (sz < 0)
+			continue;
+
+		stats->nr_logs++;
+		if (elog_stats_add(stats, buf, sz))
+			stats->nr_bad++;
+	}
+	closedir(dir);
+
+	if (!stats->nr_logs) {
+		fprintf(stderr, "0 files found in directory: %s\n", elog_dir);
+		ret = -1;
+		goto out;
+	}
+
+	printf("Error logs: %u\n", stats->nr_logs);
+	if (stats->nr_bad)
+		printf("Error logs that could not be decoded: %u\n",
+		       stats->nr_bad);
+	printf("FRU callouts: %u\n\n", stats->nr_callouts);
+
+	print_stats_ids("Event Severity", stats->severity,
+			get_severity_desc, top_n);
+	print_stats_ids("Subsystem", stats->subsystem,
+			get_subsystem_name, top_n);
+	print_stats_ids("Creator", stats->creator, get_creator_name, top_n);
+	if (print_stats_table("SRC", &stats->src, top_n) ||
+	    print_stats_table("FRU Location Code", &stats->location, top_n)) {
+		fprintf(stderr, "Failed to allocate buffer\n");
+		ret = -1;
+	}
+
+out:
+	free(stats->src.slots);
+	free(stats->location.slots);
+	free(stats);
+	return ret;
+}
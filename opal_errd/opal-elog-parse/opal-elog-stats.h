@@ -0,0 +1,14 @@
+#ifndef _H_OPAL_ELOG_STATS
+#define _H_OPAL_ELOG_STATS
+
+/* Number of entries shown per category unless asked otherwise */
+#define OPAL_ELOG_STATS_TOP_DEFAULT	10
+
+/*
+ * Aggregate every elog in elog_dir by SRC, subsystem, severity, creator
+ * and FRU location code and print the top_n entries of each category
+ * (all of them if top_n is 0).
+ */
+int elog_stats(const char *elog_dir, int top_n);
+
+#endif /* _H_OPAL_ELOG_STATS */
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+#include "opal-elog-summary.h"
+#include "opal-priv-hdr-scn.h"
+#include "opal-usr-scn.h"
+#include "parse-esel-header.h"
+
+/* Copy a fixed width field, dropping trailing blanks and NULs */
+static void summary_copy_str(char *dst, const char *src, int len)
+{
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	while (len > 0 && (dst[len - 1] == ' ' || dst[len - 1] == '\0'))
+		dst[--len] = '\0';
+}
+
+static void summary_decode_callouts(struct opal_elog_summary *summary,
+				    const char *buf, int buflen)
+{
+	const struct opal_src_scn *src = (const struct opal_src_scn *)buf;
+	const struct opal_fru_scn *fru;
+	struct opal_elog_fru_summary *fru_summary;
+	int offset = OPAL_SRC_SCN_STATIC_SIZE;
+	int end;
+
+	if (!(src->flags & OPAL_SRC_ADD_SCN))
+		return;
+
+	offset += sizeof(struct opal_src_add_scn_hdr);
+	if (offset > buflen || src->addhdr.id != OPAL_FRU_SCN_ID)
+		return;
+
+	end = be16toh(src->srclength);
+	if (end > buflen)
+		end = buflen;
+
+	while (offset + OPAL_FRU_SCN_STATIC_SIZE <= end &&
+	       summary->fru_count < OPAL_SRC_FRU_MAX) {
+		fru = (const struct opal_fru_scn *)(buf + offset);
+		if (fru->length < OPAL_FRU_SCN_STATIC_SIZE ||
+		    fru->loc_code_len > OPAL_FRU_LOC_CODE_MAX ||
+		    offset + OPAL_FRU_SCN_STATIC_SIZE + fru->loc_code_len > end)
+			break;
+
+		fru_summary = &summary->fru[summary->fru_count++];
+		fru_summary->priority = fru->priority;
+		summary_copy_str(fru_summary->location_code,
+				 fru->location_code, fru->loc_code_len);
+
+		offset += fru->length;
+	}
+}
+
+int opal_elog_summary_decode(struct opal_elog_summary *summary,
+			     const char *buf, int buflen)
+{
+	const struct opal_priv_hdr_scn *ph;
+	const struct opal_usr_hdr_scn *uh;
+	const struct opal_src_scn *ps;
+	uint16_t ps_length;
+
+	memset(summary, 0, sizeof(*summary));
+
+	if (buflen >= sizeof(struct esel_header) && parse_esel_header(buf)) {
+		buf += sizeof(struct esel_header);
+		buflen -= sizeof(struct esel_header);
+	}
+
+	if (buflen < OPAL_ELOG_SUMMARY_MIN_LEN)
+		return -EINVAL;
+
+	ph = (const struct opal_priv_hdr_scn *)(buf + OPAL_ELOG_SUMMARY_PH_OFFSET);
+	uh = (const struct opal_usr_hdr_scn *)(buf + OPAL_ELOG_SUMMARY_UH_OFFSET);
+	ps = (const struct opal_src_scn *)(buf + OPAL_ELOG_SUMMARY_PS_OFFSET);
+
+	if (strncmp(ph->v6hdr.id, "PH", 2) == 0)
+		summary->sections |= OPAL_ELOG_SUMMARY_PH;
+	if (strncmp(uh->v6hdr.id, "UH", 2) == 0)
+		summary->sections |= OPAL_ELOG_SUMMARY_UH;
+	if (strncmp(ps->v6hdr.id, "PS", 2) == 0)
+		summary->sections |= OPAL_ELOG_SUMMARY_PS;
+
+	summary->create_datetime = parse_opal_datetime(ph->create_datetime);
+	summary->commit_datetime = parse_opal_datetime(ph->commit_datetime);
+	summary->creator_id = ph->creator_id;
+	summary->scn_count = ph->scn_count;
+	summary->plid = be32toh(ph->plid);
+	summary->log_entry_id = be32toh(ph->log_entry_id);
+
+	summary->subsystem_id = uh->subsystem_id;
+	summary->event_severity = uh->event_severity;
+	summary->event_type = uh->event_type;
+	summary->action = be16toh(uh->action);
+
+	memcpy(summary->src, ps->primary_refcode, OPAL_ELOG_SUMMARY_SRC_LEN);
+	summary->src[OPAL_ELOG_SUMMARY_SRC_LEN] = '\0';
+
+	if (summary->sections & OPAL_ELOG_SUMMARY_PS) {
+		ps_length = be16toh(ps->v6hdr.length);
+		if (ps_length > buflen - OPAL_ELOG_SUMMARY_PS_OFFSET)
+			ps_length = buflen - OPAL_ELOG_SUMMARY_PS_OFFSET;
+		summary_decode_callouts(summary, (const char *)ps, ps_length);
+	}
+
+	return 0;
+}
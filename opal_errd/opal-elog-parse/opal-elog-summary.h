@@ -0,0 +1,69 @@
+#ifndef _H_OPAL_ELOG_SUMMARY
+#define _H_OPAL_ELOG_SUMMARY
+
+#include <inttypes.h>
+
+#include "opal-datetime.h"
+#include "opal-src-scn.h"
+
+/*
+ * In PEL v6 the private header, the user header and the primary SRC are
+ * the first three sections and the first two have a fixed size, so the
+ * fields needed to summarise a log live at fixed offsets.
+ */
+#define OPAL_ELOG_SUMMARY_PH_OFFSET	0x00
+#define OPAL_ELOG_SUMMARY_UH_OFFSET	0x30
+#define OPAL_ELOG_SUMMARY_PS_OFFSET	0x48
+
+#define OPAL_ELOG_SUMMARY_SRC_LEN	8
+
+/* Minimum amount of a log (eSEL header excluded) needed for a summary */
+#define OPAL_ELOG_SUMMARY_MIN_LEN	(OPAL_ELOG_SUMMARY_PS_OFFSET + \
+					 OPAL_SRC_SCN_STATIC_SIZE - \
+					 OPAL_SRC_SCN_PRIMARY_REFCODE_LEN + \
+					 OPAL_ELOG_SUMMARY_SRC_LEN)
+
+/* Sections found with the expected id at their fixed offset */
+#define OPAL_ELOG_SUMMARY_PH	0x1
+#define OPAL_ELOG_SUMMARY_UH	0x2
+#define OPAL_ELOG_SUMMARY_PS	0x4
+
+struct opal_elog_fru_summary {
+	uint8_t priority;
+	char location_code[OPAL_FRU_LOC_CODE_MAX + 1];
+};
+
+struct opal_elog_summary {
+	uint32_t sections;	/* OPAL_ELOG_SUMMARY_* */
+
+	/* Private header */
+	struct opal_datetime create_datetime;
+	struct opal_datetime commit_datetime;
+	uint8_t creator_id;
+	uint8_t scn_count;
+	uint32_t plid;
+	uint32_t log_entry_id;
+
+	/* User header */
+	uint8_t subsystem_id;
+	uint8_t event_severity;
+	uint8_t event_type;
+	uint16_t action;
+
+	/* Primary SRC, FRU callouts are only decoded from a valid PS */
+	char src[OPAL_ELOG_SUMMARY_SRC_LEN + 1];
+	uint8_t fru_count;
+	struct opal_elog_fru_summary fru[OPAL_SRC_FRU_MAX];
+};
+
+/*
+ * Decode the summary fields of the log in buf, skipping an eSEL header
+ * if there is one. Nothing is allocated or printed, so this is usable
+ * from the daemon as well as from the tools.
+ *
+ * Returns 0 on success or -EINVAL if buf is too short to hold a summary.
+ */
+int opal_elog_summary_decode(struct opal_elog_summary *summary,
+			     const char *buf, int buflen);
+
+#endif /* _H_OPAL_ELOG_SUMMARY */
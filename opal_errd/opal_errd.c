@@ -50,6 +50,8 @@
 #include <sys/wait.h>
 
 #include "opal-elog-parse/opal-event-data.h"
+#include "opal-elog-parse/opal-elog-summary.h"
+#include "opal-elog-parse/opal-usr-scn.h"
 #define INOTIFY_FD	0
 #define UDEV_FD		1
 #define POLL_TIMEOUT	1000 /* In milliseconds */
@@ -73,33 +75,6 @@
 #define DEFAULT_MAX_ELOGS		1000
 #define DEFAULT_MAX_DAYS		30
 
-/*
- * As per PEL v6 (defined in PAPR spec) fixed offset for
- * error log information.
- */
-#define ELOG_SRC_SIZE		8
-
-#define ELOG_DATE_OFFSET	0x8
-#define ELOG_TIME_OFFSET	0xc
-#define ELOG_ID_OFFSET		0x2c
-#define ELOG_SEVERITY_OFFSET	0x3a
-#define ELOG_SUBSYSTEM_OFFSET	0x38
-#define ELOG_ACTION_OFFSET	0x42
-#define ELOG_SRC_OFFSET		0x78
-#define ELOG_MIN_READ_OFFSET	ELOG_SRC_OFFSET + ELOG_SRC_SIZE
-
-/* Severity of the log */
-#define OPAL_INFORMATION_LOG	0x00
-#define OPAL_RECOVERABLE_LOG	0x10
-#define OPAL_PREDICTIVE_LOG	0x20
-#define OPAL_UNRECOVERABLE_LOG	0x40
-#define OPAL_CRITICAL_LOG	0x50
-#define OPAL_DIAGNOSTICS_LOG	0x60
-#define OPAL_SYMPTOM_LOG	0x70
-
-#define ELOG_ACTION_FLAG_SERVICE	0x8000
-#define ELOG_ACTION_FLAG_CALL_HOME	0x0800
-
 volatile int terminate;
 
 /* Safe to ignore sig, this only gets called on SIGTERM */
@@ -271,50 +246,38 @@ static int rotate_logs(const char *elog_dir, int max_logs, int max_age)
 /* Parse required fields from error log */
 static int parse_log(char *buffer, size_t bufsz)
 {
-	uint32_t logid;
-	char src[ELOG_SRC_SIZE+1];
-	uint8_t severity;
-	uint8_t subsysid;
-	uint16_t action;
+	struct opal_elog_summary summary;
 	const char *parse;
 	char *parse_action = "NONE";
 	const char *failingsubsys = "Not Applicable";
 
-	if (bufsz < ELOG_MIN_READ_OFFSET) {
+	if (opal_elog_summary_decode(&summary, buffer, bufsz)) {
 		syslog(LOG_NOTICE, "Insufficient data, cannot parse elog.\n");
 		return -1;
 	}
 
-	logid = be32toh(*(uint32_t*)(buffer + ELOG_ID_OFFSET));
-
-	memcpy(src, (buffer + ELOG_SRC_OFFSET), ELOG_SRC_SIZE);
-	src[ELOG_SRC_SIZE] = '\0';
-
-	subsysid = buffer[ELOG_SUBSYSTEM_OFFSET];
-	severity = buffer[ELOG_SEVERITY_OFFSET];
-
 	/* Every category has a generic entry at 0x?0 */
-	parse = get_severity_desc(severity & 0xF0);
+	parse = get_severity_desc(summary.event_severity & 0xF0);
 
-	action = be16toh(*(uint16_t *)(buffer + ELOG_ACTION_OFFSET));
-	if ((action & ELOG_ACTION_FLAG_SERVICE) &&
-	    (action & ELOG_ACTION_FLAG_CALL_HOME))
+	if ((summary.action & OPAL_UH_ACTION_SERVICE) &&
+	    (summary.action & OPAL_UH_ACTION_CALL_HOME))
 		parse_action = "Service action and call home required";
-	else if ((action & ELOG_ACTION_FLAG_SERVICE))
+	else if ((summary.action & OPAL_UH_ACTION_SERVICE))
 		parse_action = "Service action required";
 	else
 		parse_action = "No service action required";
 
 	/* Every category has a generic entry at 0x?0 */
-	failingsubsys = get_subsystem_name(subsysid  & 0xF0);
+	failingsubsys = get_subsystem_name(summary.subsystem_id & 0xF0);
 
 	syslog(LOG_NOTICE, "LID[%x]::SRC[%s]::%s::%s::%s\n",
-	       logid, src, failingsubsys, parse, parse_action);
+	       summary.log_entry_id, summary.src, failingsubsys, parse,
+	       parse_action);
 
-	if ((action & ELOG_ACTION_FLAG_SERVICE) &&
-	    !(action & ELOG_ACTION_FLAG_CALL_HOME))
+	if ((summary.action & OPAL_UH_ACTION_SERVICE) &&
+	    !(summary.action & OPAL_UH_ACTION_CALL_HOME))
 		syslog(LOG_NOTICE, "Run \'opal-elog-parse -d 0x%x\' "
-		       "for the details.\n", logid);
+		       "for the details.\n", summary.log_entry_id);
 
 	return 0;
 }
@@ -323,7 +286,8 @@ static int parse_log(char *buffer, size_t bufsz)
  * Check platform dump
  */
 static void check_platform_dump(const char *extract_opal_dump_cmd,
-		const char *sysfs_path, const char *max_dump)
+		const char *sysfs_path, const char *max_dump,
+		const char *max_dump_size, int compress)
 {
 	int status;
 	pid_t fork_pid;
@@ -346,13 +310,22 @@ static void check_platform_dump(const char *extract_opal_dump_cmd,
 		/* Child */
 		char *args[] = { (char *)extract_opal_dump_cmd, "-s", (char *)sysfs_path,
 			/* space for -m */(char *) NULL, /* space for max_dump */(char *) NULL,
+			/* space for -b */(char *) NULL, /* space for max_dump_size */(char *) NULL,
+			/* space for -z */(char *) NULL,
 			(char *) NULL
 		};
 		char *envs[] = { NULL };
+		int i = 3;
 		if (max_dump) {
-			args[3] = "-m";
-			args[4] = (char *)max_dump;
+			args[i++] = "-m";
+			args[i++] = (char *)max_dump;
+		}
+		if (max_dump_size) {
+			args[i++] = "-b";
+			args[i++] = (char *)max_dump_size;
 		}
+		if (compress)
+			args[i++] = "-z";
 		execve(extract_opal_dump_cmd, args, envs);
 		syslog(LOG_ERR, "Couldn't execv() into: %s (%d:%s)\n",
 		       extract_opal_dump_cmd, errno, strerror(errno));
@@ -678,6 +651,8 @@ static void help(const char* argv0)
 	fprintf(stderr, "-w      - watch for new events (default when daemon)\n");
 	fprintf(stderr, "-m max  - maximum number of dumps of a specific type"
 			" to be saved\n");
+	fprintf(stderr, "-b size - maximum total size of the saved dumps\n");
+	fprintf(stderr, "-z      - compress the saved dumps\n");
 	fprintf(stderr, "-n max  - maximum number of elogs to keep (default %d)\n",
 			DEFAULT_MAX_ELOGS);
 	fprintf(stderr, "-a days - maximum age in days of elogs to keep (default %d)\n",
@@ -713,10 +688,12 @@ int main(int argc, char *argv[])
 	int opt_max_age = DEFAULT_MAX_DAYS;
 	const char *opt_extract_opal_dump_cmd = NULL;
 	const char *opt_max_dump = NULL;
+	const char *opt_max_dump_size = NULL;
+	int opt_compress_dump = 0;
 	const char *opt_sysfs = DEFAULT_SYSFS_PATH;
 	const char *opt_output_dir = DEFAULT_OUTPUT_DIR;
 
-	while ((opt = getopt(argc, argv, "De:ho:s:m:wn:a:")) != -1) {
+	while ((opt = getopt(argc, argv, "De:ho:s:m:b:zwn:a:")) != -1) {
 		switch (opt) {
 		case 'D':
 			opt_daemon = 0;
@@ -738,6 +715,12 @@ int main(int argc, char *argv[])
 		case 'm':
 			opt_max_dump = optarg;
 			break;
+		case 'b':
+			opt_max_dump_size = optarg;
+			break;
+		case 'z':
+			opt_compress_dump = 1;
+			break;
 		case 'n':
 			errno = 0;
 			opt_max_logs = strtol(optarg,0,0);
@@ -879,7 +862,8 @@ int main(int argc, char *argv[])
 
 		if (extract_opal_dump_cmd)
 			check_platform_dump(extract_opal_dump_cmd,
-					opt_sysfs, opt_max_dump);
+					opt_sysfs, opt_max_dump,
+					opt_max_dump_size, opt_compress_dump);
 
 		if (!opt_watch) {
 			terminate = 1;
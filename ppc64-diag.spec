@@ -13,6 +13,7 @@ BuildRequires:  libvpd-devel
 BuildRequires:  librtas-devel >= 1.4.0
 BuildRequires:	ncurses-devel
 BuildRequires:	systemd-devel
+BuildRequires:	zlib-devel
 
 Requires:	servicelog
 Requires:	systemd
@@ -0,0 +1,77 @@
+/**
+ * @file bench.c
+ * @brief Replay benchmark of the RTAS event path
+ *
+ * In DEBUG builds "rtas_errd -b N" replays the RTAS test file or scenario
+ * N times, as fast as the events can be handled, and reports the number
+ * of events handled per second along with the statistics of the event
+ * path (see stats.c).  See test/run_bench.
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifdef DEBUG
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "rtas_errd.h"
+
+/**
+ * @var bench_passes
+ * @brief Number of passes over the test events, 0 when not benchmarking
+ */
+int bench_passes = 0;
+
+static struct timespec bench_start_ts;
+static uint64_t bench_start_handled;
+
+/**
+ * bench_start
+ * @brief Start the clock of the benchmark
+ */
+void
+bench_start(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &bench_start_ts);
+	bench_start_handled = stats_stage_count(STATS_HANDLE);
+}
+
+/**
+ * bench_report
+ * @brief Print the events/s followed by the statistics of the event path
+ *
+ * @param fp stream to print the report to
+ */
+void
+bench_report(FILE *fp)
+{
+	struct timespec now;
+	uint64_t events;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = (now.tv_sec - bench_start_ts.tv_sec) +
+		(now.tv_nsec - bench_start_ts.tv_nsec) / 1e9;
+	events = stats_stage_count(STATS_HANDLE) - bench_start_handled;
+
+	fprintf(fp, "%llu RTAS events handled in %.3f s, %.0f events/s\n\n",
+		(unsigned long long)events, secs, secs > 0 ? events / secs : 0);
+	print_stats(fp);
+}
+
+#endif /* DEBUG */
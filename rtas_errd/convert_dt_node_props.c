@@ -29,6 +29,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include "platform.c"
+#include "drc_map.h"
 
 #define MAX_IRQ_SERVERS_PER_CPU	16
 
@@ -40,11 +41,6 @@ static struct option long_options[] = {
 	{0,0,0,0}
 };
 
-int cpu_interruptserver_to_drcindex(uint32_t, uint32_t *);
-int cpu_drcindex_to_drcname(uint32_t, char *, int);
-int cpu_drcindex_to_interruptserver(uint32_t, uint32_t *, int);
-int cpu_drcname_to_drcindex(char *, uint32_t *);
-
 void
 print_usage(char *command) {
 	printf ("Usage: %s --context <x> --from <y> --to <z> <value>\n"
@@ -59,78 +55,6 @@ print_usage(char *command) {
 	return;
 }
 
-/**
- * mem_drcindex_to_drcname
- * @brief converts drcindex of mem type to drcname
- *
- * @param drc_idx - drc index whose drc name is to be found.
- * @param drc_name - buffer for drc_name
- * @param buf_size - size of buffer.
- */
-static int
-mem_drcindex_to_drcname(uint32_t drc_idx, char *drc_name, int buf_size)
-{
-	int fd, offset=0, found=0;
-	uint32_t index;
-	uint8_t ch;
-
-	if ((fd = open("/proc/device-tree/ibm,drc-indexes",
-				O_RDONLY)) < 0) {
-		fprintf(stderr, "error opening /proc/device-tree/"
-			"ibm,drc-indexes");
-		return 0;
-	}
-
-	/* skip the first one; it indicates how many are in the file */
-	read(fd, &index, 4);
-
-	while ((read(fd, &index, 4)) != 0) {
-		if (be32toh(index) == drc_idx) {
-			found = 1;
-			break;
-		}
-		offset++;
-	}
-	close(fd);
-
-	if (found) {
-		if ((fd = open("/proc/device-tree/ibm,drc-names",
-				O_RDONLY)) < 0) {
-			fprintf(stderr, "error opening /proc/device-tree/"
-				"ibm,drc-names");
-			return 0;
-		}
-
-		/* skip the first one; it indicates how many are in the file */
-		read(fd, &index, 4);
-
-		while (offset > 0) {
-			/* skip to (and one past) the next null char */
-			do {
-				if ((read(fd, &ch, 1)) != 1) {
-					close(fd);
-					return 0;
-				}
-			} while (ch != 0);
-			offset--;
-		}
-
-		/* copy the drc-name at the current location to the buffer */
-		while ((read(fd, &ch, 1)) == 1) {
-			if (offset+1 == buf_size) {
-				drc_name[offset] = '\0';
-				break;
-			}
-			drc_name[offset++] = ch;
-			if (ch == 0)
-				break;
-		}
-	}
-	close(fd);
-
-	return found;
-}
-
 int
 main(int argc, char *argv[]) {
 	int option_index, rc, i;
@@ -265,7 +189,7 @@ main(int argc, char *argv[]) {
 						"retrieve the entire list\n",
 						MAX_IRQ_SERVERS_PER_CPU, rc);
 				i = 0;
-				while (i < rc)
+				while (i < rc && i < MAX_IRQ_SERVERS_PER_CPU)
 					printf("0x%08x\n", intservs_array[i++]);
 			}
 			else {
@@ -311,7 +235,7 @@ main(int argc, char *argv[]) {
 						"retrieve the entire list\n",
 						MAX_IRQ_SERVERS_PER_CPU, rc);
 				i = 0;
-				while (i < rc)
+				while (i < rc && i < MAX_IRQ_SERVERS_PER_CPU)
 					printf("0x%08x\n", intservs_array[i++]);
 			}
 			else {
@@ -332,7 +256,7 @@ main(int argc, char *argv[]) {
 						drcname, 20)) {
 					fprintf(stderr, "could not find the "
 						"drc-name corresponding to "
-						"drc-index 0x%08x\n", drcindex);
+						"drc-index 0x%08lx\n", drc_tmp_idx);
 					return 4;
 				}
 				printf("%s\n", drcname);
@@ -350,222 +274,3 @@ main(int argc, char *argv[]) {
 
 	return 0;
 }
-
-int
-cpu_interruptserver_to_drcindex(uint32_t int_serv, uint32_t *drc_idx) {
-	DIR *dir;
-	struct dirent *entry;
-	int found=0, fd;
-	char buffer[1024];
-	uint32_t temp;
-
-	dir = opendir("/proc/device-tree/cpus");
-
-	while (!found && (entry = readdir(dir)) != NULL) {
-		if (!strncmp(entry->d_name, "PowerPC,POWER", 13)) {
-			snprintf(buffer, 1024, "/proc/device-tree/cpus/%s/"
-				"ibm,ppc-interrupt-server#s", entry->d_name);
-			if ((fd = open(buffer, O_RDONLY)) < 0) {
-				fprintf(stderr, "error opening %s\n", buffer);
-				goto cleanup;
-			}
-			while ((read(fd, &temp, 4)) != 0) {
-				if (be32toh(temp) == int_serv) {
-					close(fd);
-					snprintf(buffer, 1024, "/proc/device-"
-						"tree/cpus/%s/ibm,my-drc-index",
-						entry->d_name);
-					if ((fd = open(buffer, O_RDONLY)) < 0) {
-						fprintf(stderr, "error opening"
-							" %s\n", buffer);
-						goto cleanup;
-					}
-					if ((read(fd, &temp, 4)) == 4)  {
-						*drc_idx = be32toh(temp);
-						found = 1;
-					} /* if read */
-					break;
-				} /* if be32toh  */
-			} /* while */
-			close(fd);
-		}
-	} /* readdir */
-
-cleanup:
-	closedir(dir);
-	return found;
-}
-
-int
-cpu_drcindex_to_drcname(uint32_t drc_idx, char *drc_name, int buf_size) {
-	int fd, offset=0, found=0;
-	uint32_t index;
-	uint8_t ch;
-
-	if ((fd = open("/proc/device-tree/cpus/ibm,drc-indexes",
-				O_RDONLY)) < 0) {
-		fprintf(stderr, "error opening /proc/device-tree/cpus/"
-			"ibm,drc-indexes");
-		return 0;
-	}
-
-	/* skip the first one; it indicates how many are in the file */
-	read(fd, &index, 4);
-
-	while ((read(fd, &index, 4)) != 0) {
-		if (be32toh(index) == drc_idx) {
-			found = 1;
-			break;
-		}
-		offset++;
-	}
-	close(fd);
-
-	if (found) {
-		if ((fd = open("/proc/device-tree/cpus/ibm,drc-names",
-				O_RDONLY)) < 0) {
-			fprintf(stderr, "error opening /proc/device-tree/cpus/"
-				"ibm,drc-names");
-			return 0;
-		}
-
-		/* skip the first one; it indicates how many are in the file */
-		read(fd, &index, 4);
-
-		while (offset > 0) {
-			/* skip to (and one past) the next null char */
-			do {
-				if ((read(fd, &ch, 1)) != 1) {
-					close(fd);
-					return 0;
-				}
-			} while (ch != 0);
-			offset--;
-		}
-
-		/* copy the drc-name at the current location to the buffer */
-		while ((read(fd, &ch, 1)) == 1) {
-			if (offset+1 == buf_size) {
-				drc_name[offset] = '\0';
-				break;
-			}
-			drc_name[offset++] = ch;
-			if (ch == 0)
-				break;
-		}
-	}
-	close(fd);
-
-	return found;
-}
-
-/* returns # of interrupt-server numbers found, rather than a boolean value */
-int
-cpu_drcindex_to_interruptserver(uint32_t drc_idx, uint32_t *int_servs,
-		int array_elements) {
-	DIR *dir;
-	struct dirent *entry;
-	int intr_fd, drc_fd, found=0;
-	char buffer[1024];
-	uint32_t temp;
-
-	dir = opendir("/proc/device-tree/cpus");
-	if (!dir)
-		return 0;
-
-	while (!found && (entry = readdir(dir)) != NULL) {
-		if (!strncmp(entry->d_name, "PowerPC,POWER", 13)) {
-			snprintf(buffer, 1024, "/proc/device-tree/cpus/%s/"
-				"ibm,my-drc-index", entry->d_name);
-			if ((drc_fd = open(buffer, O_RDONLY)) < 0) {
-				fprintf(stderr, "error opening %s\n", buffer);
-				closedir(dir);
-				return 0;
-			}
-			while ((read(drc_fd, &temp, 4)) != 0) {
-				if (be32toh(temp) == drc_idx) {
-					snprintf(buffer, 1024, "/proc/device-"
-						"tree/cpus/%s/"
-						"ibm,ppc-interrupt-server#s",
-						entry->d_name);
-					if ((intr_fd = open(buffer, O_RDONLY)) < 0) {
-						fprintf(stderr, "error opening"
-							" %s\n", buffer);
-						closedir(dir);
-						return 0;
-					}
-					while (found < array_elements &&
-						(read(intr_fd, &temp, 4)) == 4)
-							int_servs[found++] = temp;
-					close(intr_fd);
-					break;
-				}
-			}
-			close(drc_fd);
-		}
-	}
-
-	closedir(dir);
-	return found;
-}
-
-int
-cpu_drcname_to_drcindex(char *drc_name, uint32_t *drc_idx) {
-	int fd, offset=0, found=0, i, rc;
-	uint32_t index;
-	uint8_t ch;
-	char buffer[64];
-
-	if ((fd = open("/proc/device-tree/cpus/ibm,drc-names",
-				O_RDONLY)) < 0) {
-		fprintf(stderr, "error opening /proc/device-tree/cpus/"
-			"ibm,drc-names");
-		return 0;
-	}
-
-	/* skip the first one; it indicates how many are in the file */
-	read(fd, &index, 4);
-
-	do {
-		i = 0;
-		while ((rc = read(fd, &ch, 1)) == 1) {
-			buffer[i++] = ch;
-			if (ch == 0)
-				break;
-		}
-		if (!strcmp(buffer, drc_name)) {
-			found = 1;
-			break;
-		}
-		offset++;
-	} while (rc);
-	close(fd);
-
-	if (found) {
-		if ((fd = open("/proc/device-tree/cpus/ibm,drc-indexes",
-				O_RDONLY)) < 0) {
-			fprintf(stderr, "error opening /proc/device-tree/cpus/"
-				"ibm,drc-indexes");
-			return 0;
-		}
-
-		/*
-		 * skip the first one (indicating the number of entries)
-		 * + offset number of indices
-		 */
-		if (lseek(fd, (1 + offset) * 4, SEEK_SET) !=
-				(1 + offset ) * 4) {
-			close(fd);
-			return 0;
-		}
-
-		if ((read(fd, &index, 4)) == 4)
-			*drc_idx = be32toh(index);
-		else
-			found = 0;
-		close(fd);
-	}
-
-	return found;
-}
-
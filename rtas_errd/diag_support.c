@@ -18,6 +18,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE	/* nftw() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -26,14 +27,15 @@
 #include <errno.h>
 #include <ctype.h>
 #include <librtas.h>
+#include <limits.h>
+#include <ftw.h>
+#include <pthread.h>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include "utils.h"
+#include <sys/stat.h>
 #include "rtas_errd.h"
 
 #define CMD_LSVPD "/usr/sbin/lsvpd"
-
-char target_status[80];
+#define DEVICE_TREE "/proc/device-tree"
 
 void
 free_diag_vpd(struct event *event)
@@ -73,13 +75,13 @@ free_diag_vpd(struct event *event)
  * Execute the 'lsvpd' command and open a pipe to read the data
  */
 static int
-lsvpd_init(FILE **fp, pid_t *cpid)
+lsvpd_init(FILE **fp, struct helper **helper)
 {
 	char *system_args[2] = {CMD_LSVPD, NULL,}; /* execv arguments      */
 
 	dbg("start lsvpd_init");
 
-	*fp = spopen(system_args, cpid);
+	*fp = helper_popen(HELPER_LSVPD, system_args, helper);
 	if (!*fp) {
 		perror("popen");
 		dbg("lsvpd_init failed popen (%s)", CMD_LSVPD);
@@ -95,7 +97,7 @@ lsvpd_init(FILE **fp, pid_t *cpid)
  * Close the open a pipe on 'lsvpd'.
  */
 static int
-lsvpd_term(FILE *fp, pid_t *cpid)
+lsvpd_term(FILE *fp, struct helper *helper)
 {
 	int rc = 0;
 	char line[512];
@@ -104,7 +106,7 @@ lsvpd_term(FILE *fp, pid_t *cpid)
         /* entries until pipe is empty.      */
         if (fp) {
 		while (fgets(line, sizeof(line), fp));
-		rc = spclose(fp, *cpid);
+		rc = helper_pclose(fp, helper);
         }
 
         return rc;
@@ -204,171 +206,249 @@ get_diag_vpd(struct event *event, char *phyloc)
 {
 	int rc = 0;
 	FILE *fp = NULL;
-	pid_t cpid;                       /* child pid */
+	struct helper *helper;            /* lsvpd */
+	struct timespec ts;
 
 	dbg("start get_diag_vpd");
 
 	if (event->diag_vpd.yl != NULL)
 		free_diag_vpd(event);
 
-	/* sigchld_handler() messes up pclose(). */
-	restore_sigchld_default();
-
-	if (lsvpd_init(&fp, &cpid) != 0) {
-		setup_sigchld_handler();
+	stats_clock(&ts);
+	if (lsvpd_init(&fp, &helper) != 0)
 		return 1;
-	}
 
 	while (event->diag_vpd.yl == NULL ||
 	       strcmp(event->diag_vpd.yl, phyloc)) {
 		if (lsvpd_read(event, fp)) {
 			dbg("end get_diag_vpd, failure");
-			rc = lsvpd_term(fp, &cpid);
-			setup_sigchld_handler();
+			rc = lsvpd_term(fp, helper);
+			stats_stage(STATS_LSVPD, &ts);
 			return 1;
 		}
 	}
-	rc = lsvpd_term(fp, &cpid);
+	rc = lsvpd_term(fp, helper);
+	stats_stage(STATS_LSVPD, &ts);
 	if (rc)
 		dbg("end get_diag_vpd, pclose failure");
 	else
 		dbg("end get_diag_vpd, success");
 
-	setup_sigchld_handler();
-
 	return rc;
 }
 
-char *
-get_dt_status(char *dev)
+/**
+ * @def DT_STATUS_BUCKETS
+ * @brief Size of the hash table of the device tree status index
+ */
+#define DT_STATUS_BUCKETS	1024
+
+/**
+ * @struct dt_status
+ * @brief status of a device tree node, indexed by its ibm,loc-code
+ */
+struct dt_status {
+	char			*path;		/**< node, for debugging */
+	char			*loc_code;
+	char			status[32];
+	struct dt_status	*next;		/**< in hash bucket */
+};
+
+/**
+ * @var dt_status_index
+ * @brief Nodes with a status property, hashed on their location code
+ *
+ * Built from a walk of the device tree, at startup and again on the
+ * first lookup after the device tree changed (PRRN, hotplug, DLPAR),
+ * rather than running find(1) on every lookup.
+ */
+static struct dt_status *dt_status_index[DT_STATUS_BUCKETS];
+static int dt_status_stale = 1;
+static pthread_mutex_t dt_status_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bucket being filled by the nftw() walk, under dt_status_lock */
+static struct dt_status **dt_status_tail[DT_STATUS_BUCKETS];
+
+static unsigned int
+dt_status_hash(const char *loc_code)
+{
+	unsigned int hash = 5381;
+
+	while (*loc_code)
+		hash = hash * 33 + (unsigned char)*loc_code++;
+
+	return hash % DT_STATUS_BUCKETS;
+}
+
+/**
+ * read_dt_string
+ * @brief Read a string property of the device tree
+ *
+ * @return length of the string, -1 if the property could not be read
+ */
+static int
+read_dt_string(const char *path, char *buf, size_t len)
 {
-	FILE *fp1 = NULL, *fp2 = NULL;
-	char loc_file[80];
-	char target[80];
-	char *ptr;
-	char *system_args[6] = {NULL, };		/* execv args		*/
-	char tmp_file[] = "/tmp/get_dt_files-XXXXXX";
+	ssize_t rc;
 	int fd;
-	pid_t cpid;					/* child pid		*/
-	int rc;						/* return value		*/
-	int status;					/* child exit status	*/
-
-	system_args[0] = "/usr/bin/find";
-	system_args[1] = "/proc/device-tree";
-	system_args[2] = "-name";
-	system_args[3] = "status";
-	system_args[4] = "-print";
-
-	fd = mkstemp(tmp_file);
-	if (fd == -1) {
-		log_msg(NULL, "tmp file creation failed, at "
-			"get_dt_status\n");
-		exit (-2);
-	} /* open */
-
-	cpid = fork();
-	if (cpid == -1) {
-		close(fd);
-		log_msg(NULL, "Fork failed, at get_dt_status\n");
-		return NULL;
-	} /* fork */
-
-	if (cpid == 0) { /* child */
-		int fd = open(tmp_file, O_CREAT | O_WRONLY | O_TRUNC,
-					S_IRUSR | S_IWUSR);
-		if (fd == -1) {
-			log_msg(NULL, "tmp file creation failed, at "
-				"get_dt_status\n");
-			exit (-2);
-		} /* open */
-
-		rc = dup2(fd, STDOUT_FILENO);
-		if (rc == -1) {
-			log_msg(NULL, "STDOUT redirection failed, at "
-				"get_dt_status\n");
-			close(fd);
-			exit (-2);
-		}
 
-		rc = execv(system_args[0], system_args);
-		log_msg(NULL, "get_dt_status find command failed\n");
-		close(fd);
-		exit (-2);
-	} else { /* parent */
-		close(fd);
-		rc = waitpid(cpid, &status, 0);
-		if (rc == -1) {
-			log_msg(NULL, "wait on child failed at, "
-				"get_dt_status\n");
-			return NULL;
-		} /* waitpid */
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
 
-		/* Return on EXIT_FAILURE */
-		if ((signed char)WEXITSTATUS(status) == -2)
-			return NULL;
-	}
+	rc = read(fd, buf, len - 1);
+	close(fd);
+	if (rc < 0)
+		return -1;
 
-	/* results of the find command */
-	fp1 = fopen(tmp_file, "r");
-	if (fp1 == 0) {
-		fprintf(stderr, "open failed on %s\n", tmp_file);
-		return NULL;
+	buf[rc] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return strlen(buf);
+}
+
+/**
+ * add_dt_status
+ * @brief nftw() callback adding the nodes with a status to the index
+ */
+static int
+add_dt_status(const char *path, const struct stat *sb, int type,
+	      struct FTW *ftw)
+{
+	char prop[PATH_MAX];
+	char loc_code[80];
+	struct dt_status *node;
+	unsigned int hash;
+
+	if (type != FTW_F || strcmp(path + ftw->base, "status"))
+		return 0;
+
+	snprintf(prop, sizeof(prop), "%.*sibm,loc-code", ftw->base, path);
+	if (read_dt_string(prop, loc_code, sizeof(loc_code)) <= 0)
+		return 0;
+
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return -1;
+
+	node->path = strndup(path, ftw->base);
+	node->loc_code = strdup(loc_code);
+	if (node->path == NULL || node->loc_code == NULL) {
+		free(node->path);
+		free(node->loc_code);
+		free(node);
+		return -1;
 	}
 
-	while (fscanf (fp1, "%s", loc_file) != EOF) {
-		dbg("read from /%s, \"%s\"", tmp_file, loc_file);
+	if (read_dt_string(path, node->status, sizeof(node->status)) < 0)
+		node->status[0] = '\0';
 
-		/* read the status in case this is the one */
-		fp2 = fopen(loc_file, "r");
-		if (fp2 == 0) {
-			fprintf(stderr, "open failed on %s\n", loc_file);
-			goto out;
-		}
+	/* Appended, so that lookups find nodes in the order of the walk */
+	hash = dt_status_hash(loc_code);
+	*dt_status_tail[hash] = node;
+	dt_status_tail[hash] = &node->next;
 
-		if (fscanf(fp2, "%s", target_status)) {
-			dbg("target_status = \"%s\", loc_file = \"%s\"",
-			    target_status, loc_file);
-		} else {
-			fprintf(stderr, "read failed on %s\n", loc_file);
-			goto out;
+	return 0;
+}
+
+static void
+free_dt_status_index(void)
+{
+	struct dt_status *node, *next;
+	int i;
+
+	for (i = 0; i < DT_STATUS_BUCKETS; i++) {
+		for (node = dt_status_index[i]; node; node = next) {
+			next = node->next;
+			free(node->path);
+			free(node->loc_code);
+			free(node);
 		}
+		dt_status_index[i] = NULL;
+	}
+}
 
-		fclose(fp2);
+/**
+ * build_dt_status_index
+ * @brief Walk the device tree to (re)build the status index
+ *
+ * Called with dt_status_lock held.
+ */
+static void
+build_dt_status_index(void)
+{
+	int i;
 
-		/* read the loc-code file to determine if found dev */
-		ptr = strstr(loc_file, "status");
-		strcpy(ptr, "ibm,loc-code");
-		fp2 = fopen(loc_file, "r");
-		if (fp2 == 0) {
-			fprintf(stderr, "open failed on %s\n", loc_file);
-			goto out;
-		}
+	free_dt_status_index();
+	for (i = 0; i < DT_STATUS_BUCKETS; i++)
+		dt_status_tail[i] = &dt_status_index[i];
 
-		if (fscanf(fp2, "%s", target)) {
-			dbg("target = \"%s\", loc_file = \"%s\"",
-			    target, loc_file);
-			if (strcmp(dev, target) == 0) {
-				dbg("status = \"%s\"", target_status);
-					fclose (fp2);
-					fclose (fp1);
-					return target_status;
-			}
-		} else {
-			fprintf(stderr, "read failed on %s\n", loc_file);
-			goto out;
-		}
+	if (nftw(DEVICE_TREE, add_dt_status, 32, FTW_PHYS)) {
+		log_msg(NULL, "Could not index the status of the device tree "
+			"nodes, %s", strerror(errno));
+		free_dt_status_index();
 	}
 
-	fprintf(stderr, "error: status NOT FOUND\n");
+	dt_status_stale = 0;
+}
 
-out:
-	if (fp2)
-		fclose(fp2);
+/**
+ * init_dt_status_index
+ * @brief Build the device tree status index at startup
+ */
+void
+init_dt_status_index(void)
+{
+	pthread_mutex_lock(&dt_status_lock);
+	build_dt_status_index();
+	pthread_mutex_unlock(&dt_status_lock);
+}
 
-	if (fp1)
-		fclose(fp1);
+/**
+ * invalidate_dt_status_index
+ * @brief Have the index rebuilt on the next lookup
+ *
+ * To be called once the device tree may have changed.
+ */
+void
+invalidate_dt_status_index(void)
+{
+	pthread_mutex_lock(&dt_status_lock);
+	dt_status_stale = 1;
+	pthread_mutex_unlock(&dt_status_lock);
+}
 
-	return NULL;
+/**
+ * get_dt_status
+ * @brief Get the status of the device tree node with a location code
+ *
+ * @param dev location code of the device
+ * @param status buffer for the status of the first node found
+ * @param len size of status
+ * @return 0 if the device was found, -1 otherwise
+ */
+int
+get_dt_status(char *dev, char *status, size_t len)
+{
+	struct dt_status *node;
+	int rc = -1;
+
+	pthread_mutex_lock(&dt_status_lock);
+	if (dt_status_stale)
+		build_dt_status_index();
+
+	for (node = dt_status_index[dt_status_hash(dev)]; node;
+	     node = node->next) {
+		if (!strcmp(node->loc_code, dev)) {
+			dbg("status = \"%s\", node = \"%s\"", node->status,
+			    node->path);
+			snprintf(status, len, "%s", node->status);
+			rc = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dt_status_lock);
+
+	return rc;
 }
 
 /**
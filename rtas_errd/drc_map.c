@@ -0,0 +1,680 @@
+/**
+ * @file drc_map.c
+ * @brief Map of the dynamic reconfiguration connectors in the device tree
+ *
+ * Resolves drc-indexes to drc-names, phandles, location codes and
+ * interrupt servers, and back. The map is built from the device tree on
+ * the first lookup and kept until drc_map_invalidate() is called, which
+ * rtas_errd does whenever the device tree may have changed (PRRN events,
+ * drmgr runs).
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "drc_map.h"
+
+#define DEVICE_TREE		"/proc/device-tree"
+#define DRC_MAP_BUCKETS		1024
+
+/**
+ * @struct drc_entry
+ * @brief One connector of an ibm,drc-indexes/ibm,drc-names pair
+ */
+struct drc_entry {
+	uint32_t	index;
+	char		*name;		/**< in drc_table.names */
+};
+
+/**
+ * @struct drc_table
+ * @brief The connectors listed by a node, sorted by drc-index
+ */
+struct drc_table {
+	int			nr;
+	struct drc_entry	*entries;
+	char			*names;		/**< ibm,drc-names property */
+};
+
+/**
+ * @struct drc_node
+ * @brief A device tree node with an ibm,my-drc-index property
+ */
+struct drc_node {
+	char		*path;		/**< relative to DEVICE_TREE */
+	uint32_t	drc_index;
+	uint32_t	phandle;	/**< 0 if none */
+	char		*loc_code;	/**< NULL if none */
+	uint32_t	*servers;	/**< interrupt servers, cpus only */
+	int		nr_servers;
+	struct drc_node	*next;		/**< in drc_map.nodes */
+	struct drc_node	*next_index;	/**< in drc_map.by_index bucket */
+	struct drc_node	*next_path;	/**< in drc_map.by_path bucket */
+};
+
+/**
+ * @struct drc_map
+ * @brief Everything known about the connectors, built on demand
+ */
+struct drc_map {
+	struct drc_table	cpus;		/**< /cpus connectors */
+	struct drc_table	root;		/**< / connectors (mem, slots) */
+	struct drc_node		*nodes;
+	struct drc_node		*by_index[DRC_MAP_BUCKETS];
+	struct drc_node		*by_path[DRC_MAP_BUCKETS];
+	int			stale;
+};
+
+static struct drc_map drc_map = {
+	.stale = 1,
+};
+
+static pthread_mutex_t drc_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int
+hash_index(uint32_t index)
+{
+	return (index * 2654435761u) % DRC_MAP_BUCKETS;
+}
+
+static unsigned int
+hash_path(const char *path)
+{
+	uint32_t hash = 2166136261u;
+
+	/* FNV-1a */
+	while (*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 16777619;
+	}
+
+	return hash % DRC_MAP_BUCKETS;
+}
+
+/**
+ * read_prop
+ * @brief Read a whole device tree property
+ *
+ * The buffer is NUL terminated, one byte past the property, so that
+ * string properties can be used as such.
+ *
+ * @param dir path of the node
+ * @param name name of the property
+ * @param len filled in with the length of the property
+ * @return allocated buffer, NULL if the property could not be read
+ */
+static char *
+read_prop(const char *dir, const char *name, int *len)
+{
+	char path[PATH_MAX];
+	struct stat sbuf;
+	char *buf;
+	int fd, rc, total = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &sbuf) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(sbuf.st_size + 1);
+	if (buf == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	while (total < sbuf.st_size) {
+		rc = read(fd, buf + total, sbuf.st_size - total);
+		if (rc <= 0)
+			break;
+		total += rc;
+	}
+	close(fd);
+
+	buf[total] = '\0';
+	*len = total;
+	return buf;
+}
+
+/**
+ * read_u32_prop
+ * @brief Read a single cell device tree property, in host endian
+ *
+ * @return 0 on success, -1 if the property could not be read
+ */
+static int
+read_u32_prop(const char *dir, const char *name, uint32_t *val)
+{
+	char *buf;
+	int len;
+
+	buf = read_prop(dir, name, &len);
+	if (buf == NULL)
+		return -1;
+
+	if (len < sizeof(uint32_t)) {
+		free(buf);
+		return -1;
+	}
+
+	*val = be32toh(*(uint32_t *)buf);
+	free(buf);
+	return 0;
+}
+
+static int
+cmp_drc_entry(const void *a, const void *b)
+{
+	const struct drc_entry *ea = a, *eb = b;
+
+	if (ea->index < eb->index)
+		return -1;
+	return ea->index > eb->index;
+}
+
+/**
+ * build_table
+ * @brief Pair up the ibm,drc-indexes and ibm,drc-names of a node
+ *
+ * Both properties start with the number of connectors they list.
+ */
+static void
+build_table(struct drc_table *table, const char *dir)
+{
+	char *indexes, *names, *p, *end;
+	int indexes_len, names_len, nr, i;
+	uint32_t *cell;
+
+	indexes = read_prop(dir, "ibm,drc-indexes", &indexes_len);
+	if (indexes == NULL)
+		return;
+
+	names = read_prop(dir, "ibm,drc-names", &names_len);
+	if (names == NULL || indexes_len < 4 || names_len < 4)
+		goto out;
+
+	cell = (uint32_t *)indexes;
+	nr = be32toh(cell[0]);
+	if (nr > indexes_len / 4 - 1)
+		nr = indexes_len / 4 - 1;
+
+	table->entries = calloc(nr, sizeof(struct drc_entry));
+	if (table->entries == NULL)
+		goto out;
+
+	p = names + 4;
+	end = names + names_len;
+	for (i = 0; i < nr && p < end; i++) {
+		table->entries[i].index = be32toh(cell[i + 1]);
+		table->entries[i].name = p;
+		p += strlen(p) + 1;
+	}
+
+	table->nr = i;
+	table->names = names;
+	names = NULL;
+	qsort(table->entries, table->nr, sizeof(struct drc_entry),
+	      cmp_drc_entry);
+
+out:
+	free(names);
+	free(indexes);
+}
+
+static struct drc_entry *
+table_lookup(struct drc_table *table, uint32_t index)
+{
+	struct drc_entry key = { .index = index };
+
+	if (!table->nr)
+		return NULL;
+
+	return bsearch(&key, table->entries, table->nr,
+		       sizeof(struct drc_entry), cmp_drc_entry);
+}
+
+static void
+free_table(struct drc_table *table)
+{
+	free(table->entries);
+	free(table->names);
+	memset(table, 0, sizeof(*table));
+}
+
+/**
+ * add_node
+ * @brief Add a node with an ibm,my-drc-index property to the map
+ *
+ * @param path full path of the node
+ * @param drc_index its drc-index
+ */
+static void
+add_node(const char *path, uint32_t drc_index)
+{
+	struct drc_node *node;
+	unsigned int hash;
+	char *servers;
+	int len, i;
+
+	node = calloc(1, sizeof(*node));
+	if (node == NULL)
+		return;
+
+	node->path = strdup(path + strlen(DEVICE_TREE));
+	if (node->path == NULL) {
+		free(node);
+		return;
+	}
+
+	node->drc_index = drc_index;
+	if (read_u32_prop(path, "ibm,phandle", &node->phandle))
+		read_u32_prop(path, "phandle", &node->phandle);
+	node->loc_code = read_prop(path, "ibm,loc-code", &len);
+
+	servers = read_prop(path, "ibm,ppc-interrupt-server#s", &len);
+	if (servers != NULL) {
+		node->servers = (uint32_t *)servers;
+		node->nr_servers = len / sizeof(uint32_t);
+		for (i = 0; i < node->nr_servers; i++)
+			node->servers[i] = be32toh(node->servers[i]);
+	}
+
+	node->next = drc_map.nodes;
+	drc_map.nodes = node;
+
+	hash = hash_index(drc_index);
+	node->next_index = drc_map.by_index[hash];
+	drc_map.by_index[hash] = node;
+
+	hash = hash_path(node->path);
+	node->next_path = drc_map.by_path[hash];
+	drc_map.by_path[hash] = node;
+}
+
+/**
+ * add_nodes
+ * @brief Walk the device tree for the nodes that have a drc-index
+ *
+ * @param path full path of the node to start at, a PATH_MAX buffer
+ */
+static void
+add_nodes(char *path)
+{
+	struct dirent *de;
+	uint32_t drc_index;
+	size_t len;
+	DIR *d;
+
+	if (!read_u32_prop(path, "ibm,my-drc-index", &drc_index))
+		add_node(path, drc_index);
+
+	d = opendir(path);
+	if (d == NULL)
+		return;
+
+	len = strlen(path);
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_type != DT_DIR || !strcmp(de->d_name, ".") ||
+		    !strcmp(de->d_name, ".."))
+			continue;
+
+		if (len + strlen(de->d_name) + 2 > PATH_MAX)
+			continue;
+
+		path[len] = '/';
+		strcpy(path + len + 1, de->d_name);
+		add_nodes(path);
+		path[len] = '\0';
+	}
+
+	closedir(d);
+}
+
+static void
+free_nodes(void)
+{
+	struct drc_node *node, *next;
+
+	for (node = drc_map.nodes; node; node = next) {
+		next = node->next;
+		free(node->path);
+		free(node->loc_code);
+		free(node->servers);
+		free(node);
+	}
+
+	drc_map.nodes = NULL;
+	memset(drc_map.by_index, 0, sizeof(drc_map.by_index));
+	memset(drc_map.by_path, 0, sizeof(drc_map.by_path));
+}
+
+/**
+ * get_drc_map
+ * @brief Lock the map, (re)building it if needed
+ *
+ * Must be paired with put_drc_map().
+ */
+static struct drc_map *
+get_drc_map(void)
+{
+	char path[PATH_MAX];
+
+	pthread_mutex_lock(&drc_map_lock);
+
+	if (drc_map.stale) {
+		free_table(&drc_map.cpus);
+		free_table(&drc_map.root);
+		free_nodes();
+
+		build_table(&drc_map.cpus, DEVICE_TREE "/cpus");
+		build_table(&drc_map.root, DEVICE_TREE);
+
+		strcpy(path, DEVICE_TREE);
+		add_nodes(path);
+
+		drc_map.stale = 0;
+	}
+
+	return &drc_map;
+}
+
+static void
+put_drc_map(void)
+{
+	pthread_mutex_unlock(&drc_map_lock);
+}
+
+static struct drc_node *
+node_by_index(struct drc_map *map, uint32_t drc_index)
+{
+	struct drc_node *node;
+
+	for (node = map->by_index[hash_index(drc_index)]; node;
+	     node = node->next_index)
+		if (node->drc_index == drc_index)
+			return node;
+
+	return NULL;
+}
+
+static int
+copy_name(struct drc_entry *entry, char *buf, int buf_size)
+{
+	if (entry == NULL)
+		return 0;
+
+	snprintf(buf, buf_size, "%s", entry->name);
+	return 1;
+}
+
+/**
+ * drc_map_invalidate
+ * @brief Have the next lookup rebuild the map from the device tree
+ */
+void
+drc_map_invalidate(void)
+{
+	pthread_mutex_lock(&drc_map_lock);
+	drc_map.stale = 1;
+	pthread_mutex_unlock(&drc_map_lock);
+}
+
+/**
+ * cpu_interruptserver_to_drcindex
+ * @brief Find the drc-index of the cpu serving an interrupt server
+ *
+ * @param int_serv interrupt server number (logical cpu id)
+ * @param drc_idx filled in with the drc-index
+ * @return 1 if found, 0 otherwise
+ */
+int
+cpu_interruptserver_to_drcindex(uint32_t int_serv, uint32_t *drc_idx)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_node *node;
+	int i, found = 0;
+
+	for (node = map->nodes; node && !found; node = node->next) {
+		for (i = 0; i < node->nr_servers; i++) {
+			if (node->servers[i] == int_serv) {
+				*drc_idx = node->drc_index;
+				found = 1;
+				break;
+			}
+		}
+	}
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * cpu_drcindex_to_drcname
+ * @brief Find the drc-name of a cpu connector
+ *
+ * @param drc_idx drc-index of the cpu
+ * @param drc_name buffer for the drc-name
+ * @param buf_size size of drc_name
+ * @return 1 if found, 0 otherwise
+ */
+int
+cpu_drcindex_to_drcname(uint32_t drc_idx, char *drc_name, int buf_size)
+{
+	struct drc_map *map = get_drc_map();
+	int found;
+
+	found = copy_name(table_lookup(&map->cpus, drc_idx), drc_name,
+			  buf_size);
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * cpu_drcindex_to_interruptserver
+ * @brief Find the interrupt servers of a cpu
+ *
+ * At most array_elements servers are copied to int_servs, in host endian.
+ *
+ * @param drc_idx drc-index of the cpu
+ * @param int_servs array for the interrupt servers
+ * @param array_elements size of int_servs
+ * @return number of interrupt servers of the cpu, 0 if not found
+ */
+int
+cpu_drcindex_to_interruptserver(uint32_t drc_idx, uint32_t *int_servs,
+				int array_elements)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_node *node;
+	int i, found = 0;
+
+	node = node_by_index(map, drc_idx);
+	if (node != NULL) {
+		found = node->nr_servers;
+		for (i = 0; i < found && i < array_elements; i++)
+			int_servs[i] = node->servers[i];
+	}
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * cpu_drcname_to_drcindex
+ * @brief Find the drc-index of a cpu connector by name
+ *
+ * @param drc_name drc-name of the cpu
+ * @param drc_idx filled in with the drc-index
+ * @return 1 if found, 0 otherwise
+ */
+int
+cpu_drcname_to_drcindex(char *drc_name, uint32_t *drc_idx)
+{
+	struct drc_map *map = get_drc_map();
+	int i, found = 0;
+
+	for (i = 0; i < map->cpus.nr; i++) {
+		if (!strcmp(map->cpus.entries[i].name, drc_name)) {
+			*drc_idx = map->cpus.entries[i].index;
+			found = 1;
+			break;
+		}
+	}
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * mem_drcindex_to_drcname
+ * @brief Find the drc-name of a memory connector
+ *
+ * @param drc_idx drc-index of the LMB
+ * @param drc_name buffer for the drc-name
+ * @param buf_size size of drc_name
+ * @return 1 if found, 0 otherwise
+ */
+int
+mem_drcindex_to_drcname(uint32_t drc_idx, char *drc_name, int buf_size)
+{
+	struct drc_map *map = get_drc_map();
+	int found;
+
+	found = copy_name(table_lookup(&map->root, drc_idx), drc_name,
+			  buf_size);
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * drcindex_to_drcname
+ * @brief Find the drc-name of any connector
+ *
+ * @param drc_idx drc-index of the connector
+ * @param drc_name buffer for the drc-name
+ * @param buf_size size of drc_name
+ * @return 1 if found, 0 otherwise
+ */
+int
+drcindex_to_drcname(uint32_t drc_idx, char *drc_name, int buf_size)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_entry *entry;
+	int found;
+
+	entry = table_lookup(&map->root, drc_idx);
+	if (entry == NULL)
+		entry = table_lookup(&map->cpus, drc_idx);
+	found = copy_name(entry, drc_name, buf_size);
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * drcindex_to_loc_code
+ * @brief Find the location code of the node behind a connector
+ *
+ * @param drc_idx drc-index of the node
+ * @param loc_code buffer for the location code
+ * @param buf_size size of loc_code
+ * @return 1 if found, 0 otherwise
+ */
+int
+drcindex_to_loc_code(uint32_t drc_idx, char *loc_code, int buf_size)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_node *node;
+	int found = 0;
+
+	node = node_by_index(map, drc_idx);
+	if (node != NULL && node->loc_code != NULL) {
+		snprintf(loc_code, buf_size, "%s", node->loc_code);
+		found = 1;
+	}
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * drcindex_to_phandle
+ * @brief Find the phandle of the node behind a connector
+ *
+ * @param drc_idx drc-index of the node
+ * @param phandle filled in with the phandle
+ * @return 1 if found, 0 otherwise
+ */
+int
+drcindex_to_phandle(uint32_t drc_idx, uint32_t *phandle)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_node *node;
+	int found = 0;
+
+	node = node_by_index(map, drc_idx);
+	if (node != NULL && node->phandle != 0) {
+		*phandle = node->phandle;
+		found = 1;
+	}
+
+	put_drc_map();
+	return found;
+}
+
+/**
+ * dt_path_to_drcindex
+ * @brief Find the drc-index of a device tree node
+ *
+ * @param path path of the node, relative to /proc/device-tree
+ * @param drc_idx filled in with the drc-index
+ * @return 1 if found, 0 otherwise
+ */
+int
+dt_path_to_drcindex(const char *path, uint32_t *drc_idx)
+{
+	struct drc_map *map = get_drc_map();
+	struct drc_node *node;
+	int found = 0;
+
+	for (node = map->by_path[hash_path(path)]; node;
+	     node = node->next_path) {
+		if (!strcmp(node->path, path)) {
+			*drc_idx = node->drc_index;
+			found = 1;
+			break;
+		}
+	}
+
+	put_drc_map();
+	return found;
+}
@@ -0,0 +1,44 @@
+/**
+ * @file drc_map.h
+ * @brief Header for the device tree DRC map
+ *
+ * Copyright (C) 2015 IBM Corporation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _DRC_MAP_H
+#define _DRC_MAP_H
+
+#include <stdint.h>
+
+/*
+ * All lookups return 1 if found, 0 otherwise, except
+ * cpu_drcindex_to_interruptserver() which returns a count.
+ */
+
+/* drc_map.c */
+void drc_map_invalidate(void);
+int cpu_interruptserver_to_drcindex(uint32_t, uint32_t *);
+int cpu_drcindex_to_drcname(uint32_t, char *, int);
+int cpu_drcindex_to_interruptserver(uint32_t, uint32_t *, int);
+int cpu_drcname_to_drcindex(char *, uint32_t *);
+int mem_drcindex_to_drcname(uint32_t, char *, int);
+int drcindex_to_drcname(uint32_t, char *, int);
+int drcindex_to_loc_code(uint32_t, char *, int);
+int drcindex_to_phandle(uint32_t, uint32_t *);
+int dt_path_to_drcindex(const char *, uint32_t *);
+
+#endif /* _DRC_MAP_H */
@@ -29,7 +29,6 @@
 #include <librtasevent.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
-#include "utils.h"
 #include "rtas_errd.h"
 
 #define DUMP_MAX_FNAME_LEN	40
@@ -281,7 +280,7 @@ check_platform_dump(struct event *event)
 	int	rc, bytes;
 	char    *system_args[3] = {NULL, };     /* execv arguments      */
 	char 	tmp_sys_arg[60];		/* tmp sys_args		*/
-	pid_t	cpid;                           /* child pid            */
+	struct helper *helper;			/* extract_platdump	*/
 
 	dump_scn = rtas_get_dump_scn(event->rtas_event);
 	if (dump_scn == NULL)
@@ -305,20 +304,15 @@ check_platform_dump(struct event *event)
 	system_args[0] = EXTRACT_PLATDUMP_CMD;
 	system_args[1] = tmp_sys_arg;
 
-	/* sigchld_handler() messes up pclose(). */
-	restore_sigchld_default();
-
-	f = spopen(system_args, &cpid);
+	f = helper_popen(HELPER_PLATDUMP, system_args, &helper);
 	if (f == NULL) {
 		log_msg(event, "Failed to open pipe to %s.",
 			EXTRACT_PLATDUMP_CMD);
-		setup_sigchld_handler();
 		return;
 	}
-	fgets(filename, DUMP_MAX_FNAME_LEN + 20, f);
-	rc = spclose(f, cpid);
-
-	setup_sigchld_handler();
+	if (fgets(filename, DUMP_MAX_FNAME_LEN + 20, f) == NULL)
+		filename[0] = '\0';
+	rc = helper_pclose(f, helper);
 
 	if (rc) {
 		dbg("%s failed to extract the dump", EXTRACT_PLATDUMP_CMD);
@@ -341,8 +335,10 @@ check_platform_dump(struct event *event)
 
 	snprintf(pathname, DUMP_MAX_FNAME_LEN + 40, "%s/%s",
 		 d_cfg.platform_dump_path, filename);
+	platform_log_lock();
 	platform_log_write("Platform Dump Notification\n");
 	platform_log_write("    Dump Location: %s\n", pathname);
+	platform_log_unlock();
 
 	return;
 }
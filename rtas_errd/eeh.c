@@ -94,6 +94,7 @@ check_eeh(struct event *event)
 	 * Write the EEH Event notification out to /var/log/platform
 	 * Please trust the compiler to get this right 
 	 */
+	platform_log_lock();
 	platform_log_write("EEH Event Notification\n");
 
 	privhdr = rtas_get_priv_hdr_scn(event->rtas_event);
@@ -128,6 +129,7 @@ check_eeh(struct event *event)
 		snprintf(event->addl_text, ADDL_TEXT_MAX, "%s, no "
 			"location code provided", event_descs[index].desc);
 	}
+	platform_log_unlock();
 
 	return;
 }
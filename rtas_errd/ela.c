@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <librtasevent.h>
 
 #include <sys/types.h>
@@ -98,6 +99,17 @@ short rctab[MAXREFCODES+1];
  */
 char  rctabloc[MAXREFCODES+1];
 
+/**
+ * @var ela_lock
+ * @brief Serializes the pre-v6 analysis
+ *
+ * The analysis keeps its state in the globals above and fills in the
+ * event descriptions of dchrp_frus.h, events handled concurrently are
+ * analyzed one at a time.  The part numbers of the callouts are looked
+ * up with lsvpd once the lock is dropped, see add_callout_frupns().
+ */
+static pthread_mutex_t ela_lock = PTHREAD_MUTEX_INITIALIZER;
+
 char *
 get_tod()
 {
@@ -151,25 +163,23 @@ get_refcode(struct event_description_pre_v6 *event, int index)
 /**
  * add_more_descrs
  *
+ * The part numbers of the callouts are left to add_callout_frupns().
  */
 int
 add_more_descrs(struct event *event, struct event_description_pre_v6 *ptr)
 {
 	int i, rc = 0;
-	char *frupn = NULL;
+	char *frupn;
 	char *refcode;
 	char na[] = "n/a";
 
 	i = 0;
 	while (i < MAXFRUS && ptr->frus[i].conf != 0) {
-		if (ptr->frus[i].floc[0])
-			frupn = diag_get_fru_pn(event,
-						ptr->frus[i].floc);
-		else
+		frupn = NULL;
+		if (ptr->frus[i].floc[0] == 0) {
 			strcpy(ptr->frus[i].floc, na);
-
-		if (frupn == NULL)
 			frupn = na;
+		}
 
 		refcode = get_refcode(ptr, i);
 		if (refcode == NULL)
@@ -178,8 +188,8 @@ add_more_descrs(struct event *event, struct event_description_pre_v6 *ptr)
 		add_callout(event, ' ', 0, refcode, ptr->frus[i].floc,
 			    frupn, NULL, NULL);
 
-		dbg("loc = \"%s\",\nfrupn = \"%s\",\nrefcode = \"%s\"",
-		    ptr->frus[i].floc, frupn, refcode);
+		dbg("loc = \"%s\",\nrefcode = \"%s\"",
+		    ptr->frus[i].floc, refcode);
 
 		i++;
 	}
@@ -192,7 +202,8 @@ add_more_descrs(struct event *event, struct event_description_pre_v6 *ptr)
  * @brief Determines the SRN and creates callout structs
  *
  * Note that the sl_entry struct in event struct (1st parameter) must be
- * allocated before calling this routing.
+ * allocated before calling this routing.  The part numbers of the
+ * callouts are left to add_callout_frupns().
  *
  * @param event the event on which to operate
  * @param ptr the description of the event as established by ELA
@@ -205,7 +216,7 @@ set_srn_and_callouts(struct event *event, struct event_description_pre_v6 *ptr,
 {
 	char srn[80];
 	int i;
-	char *frupn = NULL;
+	char *frupn;
 	char *refcode;
 	char na[] = "n/a";
 
@@ -229,21 +240,18 @@ set_srn_and_callouts(struct event *event, struct event_description_pre_v6 *ptr,
 
 	i = 0;
 	while (i < MAXFRUS && ptr->frus[i].conf != 0) {
-		if (ptr->frus[i].floc[0])
-			frupn = diag_get_fru_pn(event, ptr->frus[i].floc);
-		else
+		frupn = NULL;
+		if (ptr->frus[i].floc[0] == 0) {
 			strcpy(ptr->frus[i].floc, na);
-
-		if (frupn == NULL)
 			frupn = na;
+		}
 
 		refcode = get_refcode(ptr, i);
 		if (refcode == NULL)
 			refcode = na;
 
-		dbg("formatting fru list \"%s\", frupn = \"%s\"\n"
-		    "refcode = \"%s\"", ptr->frus[i].floc, frupn,
-		    refcode);
+		dbg("formatting fru list \"%s\", refcode = \"%s\"",
+		    ptr->frus[i].floc, refcode);
 
 		add_callout(event, ' ', 0, refcode, ptr->frus[i].floc,
 			    frupn, NULL, NULL);
@@ -254,6 +262,44 @@ set_srn_and_callouts(struct event *event, struct event_description_pre_v6 *ptr,
 	return 0;
 }
 
+/**
+ * add_callout_frupns
+ * @brief Look up the FRU part numbers of the pre-v6 callouts
+ *
+ * set_srn_and_callouts() and add_more_descrs() leave the part number of
+ * a callout with a location code to be looked up here, with lsvpd,
+ * outside of ela_lock.
+ *
+ * @param event the analyzed event
+ */
+static void
+add_callout_frupns(struct event *event)
+{
+	struct sl_callout *callout;
+	char *frupn;
+
+	if (event->sl_entry == NULL)
+		return;
+
+	for (callout = event->sl_entry->callouts; callout != NULL;
+	     callout = callout->next) {
+		if (callout->fru != NULL || callout->location == NULL)
+			continue;
+
+		frupn = diag_get_fru_pn(event, callout->location);
+		if (frupn == NULL)
+			frupn = "n/a";
+
+		dbg("loc = \"%s\", frupn = \"%s\"", callout->location,
+		    frupn);
+
+		callout->fru = strdup(frupn);
+		if (callout->fru == NULL)
+			log_msg(event, "Memory allocation failed, at "
+				"callout->fru");
+	}
+}
+
 /**
  * add_cpu_id
  *
@@ -531,14 +577,14 @@ process_epow(struct event *event, int error_type)
 }
 
 /**
- * process_pre_v6
- * @brief Handle older (pre-v6) style events
+ * analyze_pre_v6
+ * @brief Analysis of an older (pre-v6) style event, under ela_lock
  *
  * @param event the event to be parsed
- * @return always returns 0
+ * @return 0, -1 on a memory allocation failure
  */
-int
-process_pre_v6(struct event *event)
+static int
+analyze_pre_v6(struct event *event)
 {
 	int error_fmt;
 	int error_type;
@@ -559,8 +605,7 @@ process_pre_v6(struct event *event)
 	int rc;
 	int loc_mode;
 	int ignore_fru;
-	char *devtree = NULL;
-	char target[80];
+	char status[32];
 
 	struct rtas_event_exthdr *exthdr;
 
@@ -668,23 +713,18 @@ process_pre_v6(struct event *event)
 		ignore_fru = FALSE;
 		while ((loc = get_loc_code(event, loc_mode, NULL)) != NULL) {
 			loc_mode = NEXT_LOC;
-			if (devtree == NULL)
-				devtree = get_dt_status(NULL);
-			if (devtree) {
-				sprintf(target, "%s fail-offline", loc);
-				if (strstr(devtree, target)) {
-					/* found FRU and status in devtree */
-					/* can ignore this fru */
-					ignore_fru = TRUE;
-					continue;
-				}
-				else {
-					/* fru not disabled */
-					/* can not ignore this error log */
-					ignore_fru = FALSE;
-					break;
-				}
+			if (get_dt_status(loc, status, sizeof(status)) == 0 &&
+			    strcmp(status, "fail-offline") == 0) {
+				/* found FRU and status in devtree */
+				/* can ignore this fru */
+				ignore_fru = TRUE;
+				continue;
 			}
+
+			/* fru not disabled */
+			/* can not ignore this error log */
+			ignore_fru = FALSE;
+			break;
 		}
 		if (ignore_fru == TRUE)
 			return 0;
@@ -1117,6 +1157,25 @@ process_pre_v6(struct event *event)
 	return 0;
 }
 
+/**
+ * process_pre_v6
+ * @brief Handle older (pre-v6) style events
+ *
+ * @param event the event to be parsed
+ * @return always returns 0
+ */
+int
+process_pre_v6(struct event *event)
+{
+	pthread_mutex_lock(&ela_lock);
+	analyze_pre_v6(event);
+	pthread_mutex_unlock(&ela_lock);
+
+	add_callout_frupns(event);
+
+	return 0;
+}
+
 /**
  * analyze_io_bus_error
  * @brief Analyze the io bus errors, i.e. IOB12b0, IOB12b1, or IOB12b2. 
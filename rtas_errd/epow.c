@@ -392,9 +392,8 @@ parse_epow(struct event *event)
 int
 check_epow(struct event *event)
 {
-	pid_t	child;
 	char	*childargs[2];
-	int	rc, current_status;
+	int	current_status;
 
 	/*
 	 * Dissect the EPOW extended error information;
@@ -407,22 +406,9 @@ check_epow(struct event *event)
 	if (current_status > 0) {
 		childargs[0] = EPOW_PROGRAM_NOPATH;
 		childargs[1] = NULL;
-		child = fork();
-		if (child == -1) {
-			log_msg(event, "Fork error, %s cannot be run to handle"
-				"an incoming EPOW event, %s", EPOW_PROGRAM,
-				strerror(errno));
-		}
-		else if (child == 0) {
-			/* child process */
-			rc = execv(EPOW_PROGRAM, childargs);
-
-			/* shouldn't get here */
-			log_msg(event, "Could not exec %s, %s.  Could not "
-				"handle an incoming EPOW event", EPOW_PROGRAM,
-				strerror(errno));
-			exit(1);
-		}
+		if (spawn_helper(HELPER_EPOW, EPOW_PROGRAM, childargs))
+			log_msg(event, "%s cannot be run to handle an incoming "
+				"EPOW event, %s", EPOW_PROGRAM, strerror(errno));
 	}
 
 	return current_status;
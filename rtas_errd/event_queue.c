@@ -0,0 +1,284 @@
+/**
+ * @file event_queue.c
+ * @brief Reader thread and queue of the RTAS events read from the kernel
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include "rtas_errd.h"
+
+/**
+ * @def RTAS_EVENT_QUEUE_MAX
+ * @brief Number of RTAS events that can be waiting to be handled
+ *
+ * The kernel only buffers a few dozen events, handling an event may
+ * take a while when it runs helpers such as drmgr or lsvpd.
+ */
+#define RTAS_EVENT_QUEUE_MAX	256
+
+/**
+ * @struct queued_event
+ * @brief An RTAS event as read from /proc, sequence number first
+ */
+struct queued_event {
+	int		len;
+	struct timespec	queued;		/**< when it was read */
+	char		buf[sizeof(int) + RTAS_ERROR_LOG_MAX];
+};
+
+/**
+ * @struct event_queue
+ * @brief Ring of events filled by the reader thread
+ */
+struct event_queue {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	pthread_cond_t		space;		/**< an event was taken (-b) */
+	struct queued_event	events[RTAS_EVENT_QUEUE_MAX];
+	unsigned int		head;
+	unsigned int		count;
+	int			done;		/**< reader has stopped */
+	int			error;		/**< ... on a read error */
+	struct event_queue_stats stats;
+	unsigned int		dropped;	/**< not reported yet */
+	int			dropped_seq;	/**< last one dropped */
+};
+
+static struct event_queue event_queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_t reader_thread;
+
+/**
+ * queue_event
+ * @brief Add an event read by the reader thread to the queue
+ *
+ * If the queue is full the event is dropped and counted, it is reported
+ * by the handler thread once it catches up.  A benchmark replay waits
+ * for room instead, so that every event it reads gets handled.
+ */
+static void
+queue_event(struct event_queue *q, const char *buf, int len)
+{
+	struct queued_event *qe;
+
+	pthread_mutex_lock(&q->lock);
+#ifdef DEBUG
+	while (bench_passes && q->count == RTAS_EVENT_QUEUE_MAX)
+		pthread_cond_wait(&q->space, &q->lock);
+#endif
+
+	q->stats.read++;
+	if (q->count == RTAS_EVENT_QUEUE_MAX) {
+		q->stats.dropped++;
+		q->dropped++;
+		memcpy(&q->dropped_seq, buf, sizeof(int));
+	} else {
+		qe = &q->events[(q->head + q->count) % RTAS_EVENT_QUEUE_MAX];
+		memcpy(qe->buf, buf, len);
+		qe->len = len;
+		stats_clock(&qe->queued);
+		q->count++;
+		if (q->count > q->stats.max_queued)
+			q->stats.max_queued = q->count;
+	}
+
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * event_reader
+ * @brief Reader thread, drains /proc into the event queue
+ *
+ * Does nothing but read events, so that the kernel buffer is emptied as
+ * fast as events arrive whatever the handler thread is busy with.
+ */
+static void *
+event_reader(void *arg)
+{
+	struct event_queue *q = arg;
+	char buf[sizeof(int) + RTAS_ERROR_LOG_MAX];
+	int len, done, retries = 0;
+
+	while (1) {
+		len = read_proc_error_log(buf, RTAS_ERROR_LOG_MAX);
+		if (len <= 0) {
+			if (++retries >= 3)
+				break;
+			continue;
+		}
+
+		retries = 0;
+		if (len > sizeof(buf))
+			len = sizeof(buf);
+		queue_event(q, buf, len);
+
+		/* Stopped by stop_event_reader() */
+		pthread_mutex_lock(&q->lock);
+		done = q->done;
+		pthread_mutex_unlock(&q->lock);
+		if (done)
+			return NULL;
+
+#ifdef DEBUG
+		/*
+		 * If we are reading a fake rtas event from a test file
+		 * we only want to read it once
+		 */
+		if (testing_finished) {
+			pthread_mutex_lock(&q->lock);
+			q->done = 1;
+			pthread_cond_signal(&q->cond);
+			pthread_mutex_unlock(&q->lock);
+			return NULL;
+		}
+#endif
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->done = 1;
+	q->error = 1;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+/**
+ * start_event_reader
+ * @brief Start the thread reading RTAS events from the kernel
+ *
+ * Signals are blocked in the reader thread, so that the SIGALRM, SIGHUP
+ * and SIGCHLD handlers keep running on the main thread.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+start_event_reader(void)
+{
+	sigset_t set, old_set;
+	int rc;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	rc = pthread_create(&reader_thread, NULL, event_reader, &event_queue);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (rc) {
+		log_msg(NULL, "Could not start the RTAS event reader thread, "
+			"%s", strerror(rc));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * stop_event_reader
+ * @brief Stop handing out new events to the handler thread
+ *
+ * The events already queued are still returned by get_queued_event(),
+ * which then reports the reader as done.  The reader thread may be
+ * blocked reading /proc, it exits once it has queued the event it reads.
+ */
+void
+stop_event_reader(void)
+{
+	pthread_mutex_lock(&event_queue.lock);
+	event_queue.done = 1;
+	pthread_cond_signal(&event_queue.cond);
+	pthread_mutex_unlock(&event_queue.lock);
+}
+
+/**
+ * get_queued_event
+ * @brief Wait for the next RTAS event read from the kernel
+ *
+ * Copies the sequence number and the event to the start of event, the
+ * way read_proc_error_log() does (see rtas_errd.h).
+ *
+ * @param event struct event to fill in
+ * @return length of the event, 0 once the reader is done, -1 if it
+ * stopped on a read error
+ */
+int
+get_queued_event(struct event *event)
+{
+	struct event_queue *q = &event_queue;
+	struct queued_event *qe;
+	unsigned int dropped;
+	int dropped_seq;
+	int len, done;
+
+	do {
+		pthread_mutex_lock(&q->lock);
+		while (!q->count && !q->done && !q->dropped)
+			pthread_cond_wait(&q->cond, &q->lock);
+
+		dropped = q->dropped;
+		dropped_seq = q->dropped_seq;
+		q->dropped = 0;
+
+		len = 0;
+		done = 0;
+		if (q->count) {
+			qe = &q->events[q->head];
+			len = qe->len;
+			memcpy(event, qe->buf, len);
+			stats_stage(STATS_QUEUED, &qe->queued);
+			q->head = (q->head + 1) % RTAS_EVENT_QUEUE_MAX;
+			q->count--;
+			pthread_cond_signal(&q->space);
+		} else if (q->done) {
+			len = q->error ? -1 : 0;
+			done = 1;
+		}
+		pthread_mutex_unlock(&q->lock);
+
+		/* Logged here, the reader thread never blocks on a file */
+		if (dropped)
+			log_msg(NULL, "The RTAS event queue was full, %u events"
+				" up to event %d were lost", dropped,
+				dropped_seq);
+	} while (!len && !done);
+
+	return len;
+}
+
+/**
+ * get_event_queue_stats
+ * @brief Get the counters of the event queue
+ *
+ * @param stats filled in with the counters
+ */
+void
+get_event_queue_stats(struct event_queue_stats *stats)
+{
+	pthread_mutex_lock(&event_queue.lock);
+	*stats = event_queue.stats;
+	stats->queued = event_queue.count;
+	pthread_mutex_unlock(&event_queue.lock);
+}
@@ -0,0 +1,390 @@
+/**
+ * @file event_workers.c
+ * @brief Pool of threads handling RTAS events, ordered per resource
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <librtasevent.h>
+#include "rtas_errd.h"
+
+/**
+ * @def RTAS_EVENT_WORKERS
+ * @brief Number of threads handling RTAS events
+ *
+ * Most of the time spent handling an event is spent waiting for a
+ * helper (drmgr, extract_platdump, lsvpd), a few threads are enough.
+ */
+#define RTAS_EVENT_WORKERS	4
+
+/**
+ * @def RTAS_WORKER_QUEUE_MAX
+ * @brief Number of events that can be waiting for a given worker
+ *
+ * Once full the dispatcher waits, and events pile up in the event
+ * queue filled by the reader thread (see event_queue.c).
+ */
+#define RTAS_WORKER_QUEUE_MAX	32
+
+/*
+ * Keys of the events that are handled in order with every other event
+ * of their kind, whatever resource they are about
+ */
+#define EVENT_KEY_DEFAULT	0
+#define EVENT_KEY_EPOW		1
+#define EVENT_KEY_DUMP		2
+#define EVENT_KEY_PRRN		3
+
+/**
+ * @struct event_worker
+ * @brief A handler thread and the events dispatched to it
+ */
+struct event_worker {
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/**< an event was queued */
+	pthread_cond_t	space;		/**< an event was taken */
+	struct event	*events[RTAS_WORKER_QUEUE_MAX];
+	unsigned int	head;
+	unsigned int	count;
+	int		stop;
+};
+
+static struct event_worker workers[RTAS_EVENT_WORKERS];
+static int nr_workers;
+
+/**
+ * @var busy_workers
+ * @brief Number of events being handled
+ *
+ * rtas_errd may only be re-configured on a SIGHUP when none is.
+ */
+static int busy_workers;
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * hash_key
+ * @brief Mix len bytes of data into a resource key
+ */
+static uint32_t
+hash_key(uint32_t key, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		key ^= p[i];
+		key *= 16777619;
+	}
+
+	return key;
+}
+
+/**
+ * hash_u32
+ * @brief Mix a value, possibly read from a bit field, into a resource key
+ */
+static uint32_t
+hash_u32(uint32_t key, uint32_t val)
+{
+	return hash_key(key, &val, sizeof(val));
+}
+
+/**
+ * event_key
+ * @brief Key of the resource an RTAS event is about
+ *
+ * Events with the same key are handled by the same worker, in the order
+ * they were read. Deallocation events are keyed on the resource they are
+ * about, hotplug events on the type of resource, platform errors on the
+ * location code of their first FRU callout. EPOW, dump and PRRN events
+ * share state with every other event of their kind and are keyed on their
+ * type alone.
+ *
+ * @param event parsed RTAS event
+ * @return key of the event
+ */
+static uint32_t
+event_key(struct event *event)
+{
+	struct rtas_event_hdr *rtas_hdr = event->rtas_hdr;
+	struct rtas_hotplug_scn *hotplug;
+	struct rtas_lri_scn *lri;
+	struct rtas_src_scn *src;
+	uint32_t key;
+
+	key = hash_u32(2166136261u, rtas_hdr->type);
+
+	switch (rtas_hdr->type) {
+	    case RTAS_HDR_TYPE_EPOW:
+		return EVENT_KEY_EPOW;
+
+	    case RTAS_HDR_TYPE_DUMP_NOTIFICATION:
+		return EVENT_KEY_DUMP;
+
+	    case RTAS_HDR_TYPE_PRRN:
+		/* Device tree updates are applied in order, whatever scope */
+		return EVENT_KEY_PRRN;
+
+	    case RTAS_HDR_TYPE_HOTPLUG:
+		if (rtas_hdr->version < 6)
+			break;
+		hotplug = rtas_get_hotplug_scn(event->rtas_event);
+		if (hotplug == NULL)
+			break;
+
+		/*
+		 * Requests for a number of resources of a type may pick any
+		 * DRC of that type, every request of a type is ordered with
+		 * them, whatever DRC it names.
+		 */
+		return hash_u32(key, hotplug->type);
+
+	    case RTAS_HDR_TYPE_CACHE_PARITY:
+	    case RTAS_HDR_TYPE_RESOURCE_DEALLOC:
+		if (rtas_hdr->version < 6)
+			break;
+		lri = rtas_get_lri_scn(event->rtas_event);
+		if (lri == NULL)
+			break;
+
+		key = hash_u32(key, lri->resource);
+		if (lri->resource == RTAS_LRI_RES_PROC)
+			key = hash_u32(key, lri->lri_cpu_id);
+		else if (lri->resource == RTAS_LRI_RES_MEM_LMB)
+			key = hash_u32(key, lri->lri_drc_index);
+		return key;
+
+	    case RTAS_HDR_TYPE_PLATFORM_ERROR:
+	    case RTAS_HDR_TYPE_PLATFORM_INFO:
+		if (rtas_hdr->version < 6)
+			break;
+		src = rtas_get_src_scn(event->rtas_event);
+		if (src == NULL || src->fru_scns == NULL)
+			break;
+
+		return hash_key(key, src->fru_scns->loc_code,
+				strlen(src->fru_scns->loc_code));
+	}
+
+	return EVENT_KEY_DEFAULT;
+}
+
+/**
+ * free_event
+ * @brief Release an event once it has been handled
+ */
+static void
+free_event(struct event *event)
+{
+	if (event->loc_codes != NULL)
+		free(event->loc_codes);
+	free_diag_vpd(event);
+	cleanup_rtas_event(event->rtas_event);
+	free(event);
+}
+
+/**
+ * run_event
+ * @brief Handle an event, holding off re-configuration meanwhile
+ */
+static void
+run_event(struct event *event)
+{
+	struct timespec ts;
+
+	/*
+	 * Mark ourselves as not being able to handle SIGHUP
+	 * signals while handling the RTAS event
+	 */
+	pthread_mutex_lock(&busy_lock);
+	if (busy_workers++ == 0)
+		d_cfg.flags &= ~RE_CFG_RECFG_SAFE;
+	pthread_mutex_unlock(&busy_lock);
+
+	stats_clock(&ts);
+	handle_rtas_event(event);
+	stats_stage(STATS_HANDLE, &ts);
+
+	pthread_mutex_lock(&busy_lock);
+	if (--busy_workers == 0) {
+		d_cfg.flags |= RE_CFG_RECFG_SAFE;
+
+		if (d_cfg.flags & RE_CFG_RECEIVED_SIGHUP) {
+			diag_cfg(1, &cfg_log);
+			d_cfg.flags &= ~RE_CFG_RECEIVED_SIGHUP;
+		}
+	}
+	pthread_mutex_unlock(&busy_lock);
+
+	free_event(event);
+}
+
+/**
+ * sighup_reconfig
+ * @brief Re-read the configuration file on a SIGHUP
+ *
+ * Called by the signal waiter thread.  rtas_errd is re-configured right
+ * away if no event is being handled, otherwise by the worker handling
+ * the last one.
+ */
+void
+sighup_reconfig(void)
+{
+	pthread_mutex_lock(&busy_lock);
+	if (busy_workers == 0)
+		diag_cfg(1, &cfg_log);
+	else
+		d_cfg.flags |= RE_CFG_RECEIVED_SIGHUP;
+	pthread_mutex_unlock(&busy_lock);
+}
+
+/**
+ * event_worker
+ * @brief Handler thread, handles the events dispatched to it in order
+ */
+static void *
+event_worker(void *arg)
+{
+	struct event_worker *w = arg;
+	struct event *event;
+
+	while (1) {
+		pthread_mutex_lock(&w->lock);
+		while (!w->count && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+
+		if (!w->count) {
+			pthread_mutex_unlock(&w->lock);
+			break;
+		}
+
+		event = w->events[w->head];
+		w->head = (w->head + 1) % RTAS_WORKER_QUEUE_MAX;
+		w->count--;
+		pthread_cond_signal(&w->space);
+		pthread_mutex_unlock(&w->lock);
+
+		run_event(event);
+	}
+
+	return NULL;
+}
+
+/**
+ * start_event_workers
+ * @brief Start the threads handling RTAS events
+ *
+ * Signals are blocked in the workers, as in the reader thread. If no
+ * worker can be started the events are handled by the caller of
+ * dispatch_event().
+ */
+void
+start_event_workers(void)
+{
+	struct event_worker *w;
+	sigset_t set, old_set;
+	int i, rc;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+
+	for (i = 0; i < RTAS_EVENT_WORKERS; i++) {
+		w = &workers[i];
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->cond, NULL);
+		pthread_cond_init(&w->space, NULL);
+
+		rc = pthread_create(&w->thread, NULL, event_worker, w);
+		if (rc) {
+			log_msg(NULL, "Could not start RTAS event handler "
+				"thread %d, %s", i, strerror(rc));
+			break;
+		}
+		nr_workers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	dbg("Started %d RTAS event handler threads", nr_workers);
+}
+
+/**
+ * dispatch_event
+ * @brief Hand an RTAS event to the worker for its resource
+ *
+ * The worker takes ownership of event, which must have been allocated
+ * with malloc(), and frees it once handled.
+ *
+ * @param event parsed RTAS event
+ */
+void
+dispatch_event(struct event *event)
+{
+	struct event_worker *w;
+	uint32_t key;
+
+	if (!nr_workers) {
+		run_event(event);
+		return;
+	}
+
+	key = event_key(event);
+	w = &workers[key % nr_workers];
+	dbg("Dispatching RTAS event %d to handler thread %ld", event->seq_num,
+	    (long)(w - workers));
+
+	pthread_mutex_lock(&w->lock);
+	while (w->count == RTAS_WORKER_QUEUE_MAX)
+		pthread_cond_wait(&w->space, &w->lock);
+
+	w->events[(w->head + w->count) % RTAS_WORKER_QUEUE_MAX] = event;
+	w->count++;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * stop_event_workers
+ * @brief Wait for the dispatched events to be handled and stop the workers
+ */
+void
+stop_event_workers(void)
+{
+	struct event_worker *w;
+	int i;
+
+	for (i = 0; i < nr_workers; i++) {
+		w = &workers[i];
+		pthread_mutex_lock(&w->lock);
+		w->stop = 1;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+	}
+
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	nr_workers = 0;
+}
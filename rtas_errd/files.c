@@ -32,11 +32,29 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <pthread.h>
 #include "rtas_errd.h"
 
 char *platform_log = "/var/log/platform";
 int platform_log_fd = -1;
 
+/**
+ * @var platform_log_mutex
+ * @brief Serializes the writers of platform_log
+ */
+/**
+ * @var rtas_errd_log_mutex
+ * @brief Serializes the writers of rtas_errd_log and of debug messages
+ *
+ * Both are recursive, logging a message may log another one and the
+ * multi-line notifications are written under platform_log_lock().
+ */
+static pthread_once_t log_mutex_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t platform_log_mutex;
+static pthread_mutex_t rtas_errd_log_mutex;
+
 /**
  * @var proc_error_log1 
  * @brief File to read RTAS events from.
@@ -126,6 +144,12 @@ int	scenario_count = 0;
  */
 int	testing_finished = 0;
 
+/**
+ * @var bench_pass
+ * @brief Current pass over the test events of a benchmark (-b)
+ */
+static int bench_pass = 0;
+
 /**
  * event_dump
  * @brief Dump an RTAS event
@@ -245,6 +269,47 @@ setup_rtas_event_scenario(void)
 }
 #endif /* DEBUG */
 
+/**
+ * init_log_mutexes
+ * @brief Set up the recursive mutexes of the log files
+ */
+static void
+init_log_mutexes(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&platform_log_mutex, &attr);
+	pthread_mutex_init(&rtas_errd_log_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * platform_log_lock
+ * @brief Take the platform log for a series of writes
+ *
+ * Event handlers run concurrently, a notification written in several
+ * platform_log_write() calls must hold the lock so that it is not
+ * interleaved with the output of another handler.
+ */
+void
+platform_log_lock(void)
+{
+	pthread_once(&log_mutex_once, init_log_mutexes);
+	pthread_mutex_lock(&platform_log_mutex);
+}
+
+/**
+ * platform_log_unlock
+ * @brief Release the platform log taken with platform_log_lock()
+ */
+void
+platform_log_unlock(void)
+{
+	pthread_mutex_unlock(&platform_log_mutex);
+}
+
 /** 
  * init_files
  * @brief Initialize files used by rtas_errd
@@ -361,7 +426,8 @@ read_proc_error_log(char *buf, int buflen)
 		struct stat	tf_sbuf;
 		char		*data;
 		char		*tf_mmap;
-		int		seq_num = 1000 + scenario_index;
+		int		seq_num = 1000 + scenario_index +
+					  bench_pass * MAX(scenario_count, 1);
 		int		j = 0, k = 0, ch;
 		char		str[4];
 
@@ -428,7 +494,12 @@ read_proc_error_log(char *buf, int buflen)
 
 		len = tf_sbuf.st_size;
 
+		/* A benchmark replays the test events bench_passes times */
 		if (scenario_files != NULL) {
+			if (scenario_index == scenario_count &&
+			    ++bench_pass < bench_passes)
+				scenario_index = 0;
+
 			if (scenario_index < scenario_count) {
 				char	*tmp;
 				close(proc_error_log_fd);
@@ -443,7 +514,7 @@ read_proc_error_log(char *buf, int buflen)
 				testing_finished = 1;
 			}
 		}
-		else
+		else if (++bench_pass >= bench_passes)
 			testing_finished = 1;
 
 		if (tf_mmap)
@@ -546,7 +617,7 @@ reformat_msg(char *msg)
  * @param ... additional args a la printf()
  */
 static void
-_log_msg(struct event *event, const char *fmt, va_list ap)
+_log_msg_locked(struct event *event, const char *fmt, va_list ap)
 {
 	struct stat sbuf;
 	char	buf[RTAS_ERROR_LOG_MAX];
@@ -667,6 +738,23 @@ _log_msg(struct event *event, const char *fmt, va_list ap)
 	return;
 }
 
+/**
+ * _log_msg
+ * @brief Write a message to rtas_errd_log, see _log_msg_locked()
+ *
+ * @param event reference to event
+ * @param fmt formatted string a la printf()
+ * @param ap additional args
+ */
+static void
+_log_msg(struct event *event, const char *fmt, va_list ap)
+{
+	pthread_once(&log_mutex_once, init_log_mutexes);
+	pthread_mutex_lock(&rtas_errd_log_mutex);
+	_log_msg_locked(event, fmt, ap);
+	pthread_mutex_unlock(&rtas_errd_log_mutex);
+}
+
 /**
  * cfg_log
  * @brief dummy interface for calls to diag_cfg
@@ -731,15 +819,94 @@ _dbg(const char *fmt, ...)
 	va_end(ap);
 
 	len = reformat_msg(buf);
+	pthread_once(&log_mutex_once, init_log_mutexes);
+	pthread_mutex_lock(&rtas_errd_log_mutex);
 	fprintf(stdout, "%s", buf);
 	fflush(stdout);
+	pthread_mutex_unlock(&rtas_errd_log_mutex);
+}
+
+/**
+ * @def HEX_DUMP_LINE_MAX
+ * @brief Longest line of the RTAS event hexdump
+ *
+ * "RTAS <line>:", four groups of " <8 hex digits>" and a newline.
+ */
+#define HEX_DUMP_LINE_MAX	(16 + 4 * 9 + 1)
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * hex_dump_line_label
+ * @brief Write the "RTAS <line>:" prefix of a hexdump line
+ *
+ * @param buf buffer to write to
+ * @param line line number
+ * @return number of characters written
+ */
+static int
+hex_dump_line_label(char *buf, unsigned int line)
+{
+	char digits[10];
+	int i = 0, len;
+
+	do {
+		digits[i++] = '0' + (line % 10);
+		line /= 10;
+	} while (line);
+
+	memcpy(buf, "RTAS ", 5);
+	len = 5;
+	while (i)
+		buf[len++] = digits[--i];
+	buf[len++] = ':';
+
+	return len;
+}
+
+/**
+ * hex_dump_rtas_event
+ * @brief Format the hexdump of an RTAS event
+ *
+ * Prints 16 bytes/line in hex, with a space before every 4 bytes. buf
+ * must hold HEX_DUMP_LINE_MAX characters per line.
+ *
+ * @param buf buffer to write to
+ * @param data RTAS event
+ * @param len length of the RTAS event
+ * @return number of characters written
+ */
+static int
+hex_dump_rtas_event(char *buf, const unsigned char *data, int len)
+{
+	char *p = buf;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if ((i % 16) == 0)
+			p += hex_dump_line_label(p, i / 16);
+
+		if ((i % 4) == 0)
+			*p++ = ' ';
+
+		*p++ = hex_digits[data[i] >> 4];
+		*p++ = hex_digits[data[i] & 0x0f];
+
+		if ((i % 16) == 15)
+			*p++ = '\n';
+	}
+	if ((i % 16) != 0)
+		*p++ = '\n';
+
+	return p - buf;
 }
 
 /**
  * print_rtas_event
  * @brief Print an RTAS event to the platform log
  * 
- * Prints the binary hexdump of an RTAS event to the PLATFORM_LOG file.
+ * Prints the binary hexdump of an RTAS event to the PLATFORM_LOG file,
+ * along with its begin and end markers, in a single writev().
  * 
  * @param event pointer to the struct event to print
  * @return 0 on success, !0 on failure
@@ -747,9 +914,12 @@ _dbg(const char *fmt, ...)
 int
 print_rtas_event(struct event *event)
 {
+	char	begin[64 + PATH_MAX], end[64];
 	char	*out_buf;
-	int	len, buf_size, offset;
-	int	i, rc, nlines;
+	struct iovec iov[3];
+	off_t	offset;
+	int	len, nlines, total;
+	int	rc;
 
 	/* Determine the length of the log */
 	len = event->length;
@@ -760,27 +930,15 @@ print_rtas_event(struct event *event)
 	 */
 	if (len == 0)
 		len = 32;
+	if (len > sizeof(event->event_buf))
+		len = sizeof(event->event_buf);
 
-	/* We need to allocate a buffer big enough to hold all the data
-	 * from the RTAS event plus the additional strings printed
-	 * before and after the RTAS event (roughly 0x40 in length)
-	 * _and_ the strings printed in front of every line (roughly 0x10
-	 * in length).  
-	 *
-	 * We calculate the number of lines needed to print the RTAS event, 
-	 * mulitply that by the space for the strings then add in the 
-	 * beginning/end strings.  For a little extra padding we double the 
-	 * len value also.
-	 *
-	 * size = (len * 2) + (number of lines * 0x10) + (2 * 0x40)
-	 */
 	nlines = len / 0x10;
 	if (len % 0x10)
 		nlines++;
-	buf_size = (len * 2) + (nlines * 0x10) + (2 * 0x40);
 	/* event_dump(event); */
 
-	out_buf = calloc(1, buf_size);
+	out_buf = malloc(nlines * HEX_DUMP_LINE_MAX);
 	if (out_buf == NULL) {
 		log_msg(NULL, "Could not allocate buffer to print RTAS event "
 			"%d, %s.  The event will not copied to %s",
@@ -789,44 +947,46 @@ print_rtas_event(struct event *event)
 		return -1;
 	}
 
-	offset = sprintf(out_buf,
-			 "RTAS: %d -------- RTAS event begin --------\n",
-			 event->seq_num);
+	iov[0].iov_base = begin;
+	iov[0].iov_len = snprintf(begin, sizeof(begin),
+			  "RTAS: %d -------- RTAS event begin --------\n",
+			  event->seq_num);
 
-	if (event->flags & RE_SCANLOG_AVAIL) {
-		offset += sprintf(out_buf + offset, "RTAS: %s\n", scanlog);
+	/* Only the first event written reports the scanlog dump */
+	platform_log_lock();
+	if ((event->flags & RE_SCANLOG_AVAIL) && scanlog != NULL) {
+		iov[0].iov_len += snprintf(begin + iov[0].iov_len,
+					   sizeof(begin) - iov[0].iov_len,
+					   "RTAS: %s\n", scanlog);
 		free(scanlog);
 		scanlog = NULL;
 	}
+	platform_log_unlock();
 
-	/* Print 16 bytes/line in hex, with a space after every 4 bytes */
-	for (i = 0; i < len; i++) {
-		if ((i % 16) == 0)
-			offset += sprintf(out_buf + offset, "RTAS %d:", i/16);
-
-		if ((i % 4) == 0)
-			offset += sprintf(out_buf + offset, " ");
-
-		offset += sprintf(out_buf + offset, "%02x",
-				  event->event_buf[i]);
+	iov[1].iov_base = out_buf;
+	iov[1].iov_len = hex_dump_rtas_event(out_buf,
+				(unsigned char *)event->event_buf, len);
 
-		if ((i % 16) == 15)
-			offset += sprintf(out_buf + offset, "\n");
-	}
-	if ((i % 16) != 0)
-		offset += sprintf(out_buf + offset, "\n");
-
-	offset += sprintf(out_buf + offset,
+	iov[2].iov_base = end;
+	iov[2].iov_len = snprintf(end, sizeof(end),
 			  "RTAS: %d -------- RTAS event end ----------\n",
 			  event->seq_num);
 
+	total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
 	dbg("Writing RTAS event %d to %s", event->seq_num, platform_log);
-	lseek(platform_log_fd, 0, SEEK_END);
-	rc = write(platform_log_fd, out_buf, offset);
-	if (rc != offset) {
+	platform_log_lock();
+	offset = lseek(platform_log_fd, 0, SEEK_END);
+	rc = writev(platform_log_fd, iov, 3);
+	if (rc == total) {
+		checkpoint_platform_log(event->seq_num, offset + total);
+		index_platform_event(event, offset, total);
+	}
+	platform_log_unlock();
+	if (rc != total) {
 		log_msg(NULL, "Writing RTAS event %d to %s failed."
 			"expected to write %d, only wrote %d. %s",
-			event->seq_num, platform_log, offset, rc,
+			event->seq_num, platform_log, total, rc,
 			strerror(errno));
 	}
 
@@ -859,7 +1019,9 @@ platform_log_write(char *fmt, ...)
 	len += vsnprintf(buf + len, (1024 - len), fmt, ap);
 	va_end(ap);
 
+	platform_log_lock();
 	rc = write(platform_log_fd, &buf, len);
+	platform_log_unlock();
 
 	return rc;
 }
@@ -29,12 +29,10 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <dirent.h>
-#include "utils.h"
 #include "rtas_errd.h"
 
 #define DRMGR_PROGRAM		"/usr/sbin/drmgr"
 #define DRMGR_PROGRAM_NOPATH	"drmgr"
-#define CONVERT_DT_PROPS_PROGRAM "/usr/sbin/convert_dt_node_props"
 
 #define RTAS_V6_TYPE_RESOURCE_DEALLOC	0xE3
 
@@ -43,19 +41,18 @@ enum event_type {CPUTYPE, MEMTYPE};
 
 /**
  * run_drmgr
- * @brief build correct options followed by fork and exec drmgr
+ * @brief build correct options and run drmgr under the supervisor
  *
  * @param resource type to deallocate.
  * @param specific drc_name to be de-allocted.
  * @param either quatity or capacity to be deallocated.
- * @param wait do we do a waitpid?
+ * @param wait do we wait for drmgr to complete?
  */
 void
 run_drmgr(enum resource_dealloc_type resource_type, char *drc_name,
 	  unsigned int value, int wait)
 {
-	pid_t child;
-	int status, rc;
+	int rc;
 	char capacity[6], quant_str[5];
 	char *drmgr_args[] = {DRMGR_PROGRAM_NOPATH, "-r", "-c", NULL,
 			NULL, NULL, NULL, NULL, NULL};
@@ -103,26 +100,14 @@ run_drmgr(enum resource_dealloc_type resource_type, char *drc_name,
 		return;
 #endif
 
-	child = fork();
-	if (child == -1) {
+	if (wait)
+		rc = run_helper(HELPER_DRMGR, DRMGR_PROGRAM, drmgr_args);
+	else
+		rc = spawn_helper(HELPER_DRMGR, DRMGR_PROGRAM, drmgr_args);
+
+	if (rc == -1)
 		log_msg(NULL, "%s cannot be run to handle a predictive CPU "
 			"failure, %s", DRMGR_PROGRAM, strerror(errno));
-		return;
-	}
-	else if (child == 0) {
-		/* child process */
-		rc = execv(DRMGR_PROGRAM, drmgr_args);
-
-		/* shouldn't get here */
-		log_msg(NULL, "Could not exec %s to in response to a "
-			"predictive CPU failure, %s", DRMGR_PROGRAM,
-			strerror(errno));
-		exit(1);
-	}
-
-	if (wait) {
-		child = waitpid(child, &status, 0);
-	}
 }
 
 /**
@@ -182,13 +167,14 @@ can_delete_lmb(void)
 
 /**
  * retrieve_drc_name
- * @brief retrieve the drc-name of a cpu
+ * @brief retrieve the drc-name of a cpu or memory block
  * 
- * Retrieves a string containing the drc-name of the CPU specified by the ID 
- * passed as a parameter.  Returns 1 on success, 0 on failure.
+ * Retrieves a string containing the drc-name of the CPU or LMB specified by
+ * the ID passed as a parameter, from the device tree DRC map.  Returns 1 on
+ * success, 0 on failure.
  *
  * @param event rtas event pointer
- * @param id interrupt server number of the cpu
+ * @param id interrupt server number of the cpu, or drc-index of the LMB
  * @param buffer storeage for drc-name
  * @param bufsize size of buffer
  * @return 1 on success, 0 on failure
@@ -197,94 +183,32 @@ static int
 retrieve_drc_name(enum event_type type, struct event *event, unsigned int id,
 		      char *buffer, size_t bufsize)
 {
-	struct stat sbuf;
-	int rc, ret=1;
-	FILE *fp;
-	uint8_t status;
-	char *system_args[9] = {NULL,}; /* execv arguments      	*/
-	char tmp_sys_arg[100];		/* tmp sys_arg for snprintf	*/
-	pid_t cpid;                     /* child pid            	*/
-
-	if (stat(CONVERT_DT_PROPS_PROGRAM, &sbuf) < 0) {
-		log_msg(event, "The command \"%s\" does not exist, %s",
-			CONVERT_DT_PROPS_PROGRAM, strerror(errno));
-		return 0;
-	}
+	uint32_t drc_index;
 
-	system_args[0] = CONVERT_DT_PROPS_PROGRAM;
-	system_args[1] = "--context";
 	if (type == CPUTYPE) {
-		system_args[2] = "cpu";
-		system_args[3] = "--from";
-		system_args[4] = "interrupt-server";
-		system_args[5] = "--to";
-		system_args[6] = "drc-name";
-		snprintf(tmp_sys_arg, 100, "%u", id);
-		system_args[7] = tmp_sys_arg;
-	} else { /* event type is mem */
-		system_args[2] = "mem";
-		system_args[3] = "--from";
-		system_args[4] = "drc-index";
-		system_args[5] = "--to";
-		system_args[6] = "drc-name";
-		snprintf(tmp_sys_arg, 100, "0x%08x", id);
-		system_args[7] = tmp_sys_arg;
-	}
-
-	/* Note :
-	 *        rtas_errd sets up child signal handler
-	 * (setup_sigchld_handler()) which cleanup child process when it
-	 * exited. This caused pclose() to return non-zero value always
-	 * (No child process ). Resulted this function to return 0
-	 * (failure) always. To overcome this issue we will restore
-	 * SIGCHLD handler to default action before doing popen() and
-	 * setup again after completing pclose().
-	 */
-	restore_sigchld_default();
+		if (!cpu_interruptserver_to_drcindex(id, &drc_index)) {
+			log_msg(event, "Cannot obtain the drc-name for the "
+				"CPU with ID %u; no drc-index found for that "
+				"interrupt server", id);
+			return 0;
+		}
 
-	fp = spopen(system_args, &cpid);
-	if (fp == NULL) {
-		if (type == CPUTYPE) {
+		if (!cpu_drcindex_to_drcname(drc_index, buffer, bufsize)) {
 			log_msg(event, "Cannot obtain the drc-name for the "
-				"CPU with ID %u; Could not run %s. %s", id,
-				CONVERT_DT_PROPS_PROGRAM, strerror(errno));
+				"CPU with ID %u; no drc-name found for "
+				"drc-index 0x%08x", id, drc_index);
+			return 0;
 		}
-		else {
+	} else { /* event type is mem */
+		if (!mem_drcindex_to_drcname(id, buffer, bufsize)) {
 			log_msg(event, "Cannot obtain the drc-name for the "
-				"Memory with ID %u; Could not run %s. %s", id,
-				CONVERT_DT_PROPS_PROGRAM, strerror(errno));
+				"Memory with ID %u; no drc-name found for "
+				"that drc-index", id);
+			return 0;
 		}
-		setup_sigchld_handler();
-		return 0;
-	} /* fp == NULL */
-
-	rc = fread(buffer, 1, bufsize, fp);
-	if (rc == bufsize) {
-		log_msg(event, "Cannot obtain the drc-name for the "
-			       "%s with ID %u; Buffer overflow in "
-			       "retrieve_drc_name",
-				(type == CPUTYPE) ? "CPU" : "MEMORY",
-				id);
-		buffer[bufsize-1] = '\0';
-		ret = 0;
-	} else if (rc > 0) {
-		buffer[rc-1] = '\0';	/* overwrite the newline at the end */
-	} else
-		buffer[0] = '\0';
-
-	status = spclose(fp, cpid);
-
-	setup_sigchld_handler();
-
-	if (status != 0) {
-		log_msg(event, "Cannot obtain the drc-name for the "
-			       "%s with ID %u; %s returned %d",
-				(type == CPUTYPE) ? "CPU" : "MEMORY",
-				id, CONVERT_DT_PROPS_PROGRAM, rc);
-		ret = 0;
 	}
 
-	return ret;
+	return 1;
 }
 
 /**
@@ -376,10 +300,12 @@ guard_cpu(struct event *event, int cpu_id)
 	log_msg(event, "The following CPU has been offlined due to the "
 		"reporting of a predictive CPU failure: logical ID "
 		"%d, drc-name %s", cpu_id, drc_name);
+	platform_log_lock();
 	platform_log_write("CPU Deallocation Notification\n");
 	platform_log_write("(resulting from a predictive CPU failure)\n");
 	platform_log_write("    Logical ID: %d\n", cpu_id);
 	platform_log_write("    drc-name:   %s\n", drc_name);
+	platform_log_unlock();
 
 	snprintf(event->addl_text, ADDL_TEXT_MAX,
 		"Predictive CPU Failure: deallocated CPU ID %d "
@@ -433,6 +359,7 @@ guard_spcpu(struct event *event, int ent_loss)
 			"entitled capacity due to a predictive CPU "
 			"failure.  %d virtual CPUs were deallocated "
 			"in order to fulfill this request", quant);
+		platform_log_lock();
 		platform_log_write("CPU Deallocation Notification\n");
 		platform_log_write("(resulting from a predictive CPU "
 			"failure)\n");
@@ -440,6 +367,7 @@ guard_spcpu(struct event *event, int ent_loss)
 				   "offlined: %d\n", quant);
 		platform_log_write("    number of virtual CPUs "
 				   "remaining: %d\n", n_cpus - quant);
+		platform_log_unlock();
 
 		snprintf(event->addl_text, ADDL_TEXT_MAX,
 			"Predictive CPU Failure: deallocated %d "
@@ -450,6 +378,7 @@ guard_spcpu(struct event *event, int ent_loss)
 	log_msg(event, "Entitled capacity in the amount of %d has been "
 		"offlined due to the reporting of a predictive CPU "
 		"failure", ent_loss);
+	platform_log_lock();
 	platform_log_write("Entitled Capacity Deallocation "
 			   "Notification\n");
 	platform_log_write("(resulting from a predictive CPU failure)\n");
@@ -457,6 +386,7 @@ guard_spcpu(struct event *event, int ent_loss)
 			   "%d\n", ent_loss);
 	platform_log_write("    entitled capacity units remaining: "
 			   "%d\n", ent_cap - ent_loss);
+	platform_log_unlock();
 
 	snprintf(event->addl_text, ADDL_TEXT_MAX,
 		"Predictive CPU Failure: deallocated %d entitled "
@@ -520,10 +450,12 @@ guard_memlmb(struct event *event, unsigned int drc_index)
 		       "reporting of a predictive memory failure:"
 			"0x%08x, drc-name %s", drc_index, drc_name);
 
+	platform_log_lock();
 	platform_log_write("MEM Deallocation Notification\n");
 	platform_log_write("(resulting from a predictive MEM failure)\n");
 	platform_log_write("    Logical ID: 0x%08x\n", drc_index);
 	platform_log_write("    drc-name:   %s\n", drc_name);
+	platform_log_unlock();
 
 	snprintf(event->addl_text, ADDL_TEXT_MAX,
 		"Predictive MEM Failure: deallocated LMB ID %u "
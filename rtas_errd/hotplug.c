@@ -35,9 +35,9 @@ void handle_hotplug_event(struct event *re)
 {
         struct rtas_event_hdr *rtas_hdr = re->rtas_hdr;
         struct rtas_hotplug_scn *hotplug;
-        pid_t child;
-        int status, rc;
+        int status;
         char drc_index[11];
+	char drc_name[64];
 	char count[4];
         char *drmgr_args[] = { DRMGR_PROGRAM_NOPATH, "-c", NULL, NULL, NULL,
                         NULL, NULL, "-d4", "-V", NULL};
@@ -86,6 +86,12 @@ void handle_hotplug_event(struct event *re)
                                 drmgr_args[4] = "-s";
                                 snprintf(drc_index, 11, "%#x", hotplug->u1.drc_index);
                                 drmgr_args[5] = drc_index;
+				/* Only worth a lookup of the DRC map for debug */
+				if (debug &&
+				    drcindex_to_drcname(hotplug->u1.drc_index,
+							drc_name, sizeof(drc_name)))
+					dbg("drc-index %s is %s", drc_index,
+					    drc_name);
                                 break;
 			case RTAS_HP_ID_DRC_COUNT:
 				drmgr_args[4] = "-q";
@@ -109,23 +115,13 @@ void handle_hotplug_event(struct event *re)
                 /* invoke drmgr */
                 dbg("Invoke drmgr command\n");
 
-                child = fork();
-                if (child == -1) {
+                status = run_helper(HELPER_DRMGR, DRMGR_PROGRAM, drmgr_args);
+                if (status == -1) {
                         log_msg(NULL, "%s cannot be run to handle a hotplug event, %s",
                                 DRMGR_PROGRAM, strerror(errno));
                         return;
-                } else if (child == 0) {
-                        /* child process */
-                        rc = execv(DRMGR_PROGRAM, drmgr_args);
-
-                        /* shouldn't get here */
-                        log_msg(NULL, "Couldn not exec %s in response to hotplug event, %s",
-                                DRMGR_PROGRAM, strerror(errno));
-                        exit(1);
                 }
 
-                child = waitpid(child, &status, 0);
-
                 dbg("drmgr call exited with %d\n", WEXITSTATUS(status));
         }
 }
@@ -0,0 +1,612 @@
+/**
+ * @file platform_index.c
+ * @brief Index of the RTAS events in the platform log
+ *
+ * Every RTAS event written to platform_log gets a fixed size record in a
+ * sidecar file (platform_log with a ".idx" suffix) giving its sequence
+ * number, when it was logged, its severity and where it is in the log.
+ * An event can then be found with a binary search of the index instead
+ * of a scan of the whole log.
+ *
+ * The index is only a cache of the log: whenever it does not match the
+ * log (different inode, log truncated, record not pointing at the event
+ * it claims) rtas_errd rebuilds it by scanning the log.  "rtas_errd -g"
+ * only reads the index, falling back to a scan of the log.
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "rtas_errd.h"
+
+#define PLATFORM_INDEX_MAGIC	"RTASIDX1"
+
+/**
+ * @struct platform_index_hdr
+ * @brief Start of the index file, followed by the records
+ */
+struct platform_index_hdr {
+	char		magic[8];
+	uint64_t	log_ino;	/**< platform_log indexed */
+	uint32_t	unsorted;	/**< records not in sequence order */
+	uint32_t	reserved;
+};
+
+/**
+ * @struct platform_index
+ * @brief The index as kept open by rtas_errd, under platform_log_lock()
+ */
+struct platform_index {
+	int				fd;
+	struct platform_index_hdr	hdr;
+	uint32_t			last_seq;
+	uint64_t			last_end;	/**< of the last event */
+};
+
+static struct platform_index pindex = {
+	.fd = -1,
+};
+
+/* Start of an event in the platform log, as written by print_rtas_event() */
+#define RTAS_BEGIN_FMT	"RTAS: %d -------- RTAS event begin"
+
+typedef int (*index_fn)(struct platform_index_entry *, void *);
+
+static void
+index_path(char *path, size_t len)
+{
+	snprintf(path, len, "%s.idx", platform_log);
+}
+
+/**
+ * parse_severity
+ * @brief Get the severity of an event from its hexdump in the log
+ *
+ * The severity is the top 3 bits of the second byte of the RTAS header,
+ * that is the third and fourth digits of the "RTAS 0:" line.
+ */
+static uint32_t
+parse_severity(char *p, char *end)
+{
+	char *line;
+
+	for (line = p; line < end; line++) {
+		if ((line == p || line[-1] == '\n') && end - line > 12 &&
+		    !strncmp(line, "RTAS 0: ", 8)) {
+			char byte[3] = { line[10], line[11], '\0' };
+
+			return strtoul(byte, NULL, 16) >> 5;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * scan_platform_log
+ * @brief Call fn on every complete RTAS event in part of the platform log
+ *
+ * The log does not record when an event was logged, the timestamp of the
+ * records passed to fn is 0 (unknown).
+ *
+ * @param log_fd platform log
+ * @param from offset to start from, at the start of a line
+ * @param size size of the platform log
+ * @param fn called for each event found, stops the scan if it returns !0
+ * @param arg passed to fn
+ * @return 0 on success, -1 if the log could not be read
+ */
+static int
+scan_platform_log(int log_fd, off_t from, off_t size, index_fn fn, void *arg)
+{
+	struct platform_index_entry entry;
+	char *map, *start, *end, *p, *line, *next;
+	off_t base;
+	size_t len;
+
+	if (from >= size)
+		return 0;
+
+	base = from & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+	len = size - base;
+	map = mmap(0, len, PROT_READ, MAP_PRIVATE, log_fd, base);
+	if (map == MAP_FAILED)
+		return -1;
+
+	start = map + (from - base);
+	end = map + len;
+
+	for (p = find_rtas_start(start, end); p != NULL;
+	     p = find_rtas_start(next, end)) {
+		line = p;
+		while (line > start && line[-1] != '\n')
+			line--;
+
+		next = find_rtas_end(p, end);
+		if (next != NULL)
+			next = memchr(next, '\n', end - next);
+		if (next == NULL)
+			break;		/* not completely written yet */
+		next++;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.seq = get_rtas_no(p);
+		entry.severity = parse_severity(line, next);
+		entry.offset = from + (line - start);
+		entry.length = next - line;
+
+		if (fn(&entry, arg))
+			break;
+	}
+
+	munmap(map, len);
+	return 0;
+}
+
+/**
+ * check_entry
+ * @brief Check that an index record points at the event it claims
+ */
+static int
+check_entry(int log_fd, off_t log_size, struct platform_index_entry *entry)
+{
+	char marker[64], buf[64];
+	int len;
+
+	if (entry->offset + entry->length > log_size)
+		return 0;
+
+	len = snprintf(marker, sizeof(marker), RTAS_BEGIN_FMT, entry->seq);
+	if (pread(log_fd, buf, len, entry->offset) != len)
+		return 0;
+
+	return !memcmp(buf, marker, len);
+}
+
+struct rebuild_state {
+	FILE		*fp;
+	uint32_t	last_seq;
+	uint64_t	last_end;
+	uint32_t	unsorted;
+	int		error;
+};
+
+static int
+rebuild_add(struct platform_index_entry *entry, void *arg)
+{
+	struct rebuild_state *rs = arg;
+
+	if (rs->last_end && entry->seq <= rs->last_seq)
+		rs->unsorted = 1;
+	rs->last_seq = entry->seq;
+	rs->last_end = entry->offset + entry->length;
+
+	if (fwrite(entry, sizeof(*entry), 1, rs->fp) != 1) {
+		rs->error = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * rebuild_index
+ * @brief Write a new index of the whole platform log
+ *
+ * The index is written to a temporary file then renamed over the old
+ * one, so that readers never see a partial index.
+ *
+ * @param log_fd platform log
+ * @param log_sbuf its status
+ * @param rs filled in with the last event indexed
+ * @return 0 on success, -1 on failure
+ */
+static int
+rebuild_index(int log_fd, struct stat *log_sbuf, struct rebuild_state *rs)
+{
+	struct platform_index_hdr hdr;
+	char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+	int fd;
+
+	index_path(path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+
+	fd = mkstemp(tmp_path);
+	if (fd < 0)
+		return -1;
+
+	memset(rs, 0, sizeof(*rs));
+	rs->fp = fdopen(fd, "w");
+	if (rs->fp == NULL) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, rs->fp);
+
+	if (scan_platform_log(log_fd, 0, log_sbuf->st_size, rebuild_add, rs))
+		rs->error = 1;
+
+	memcpy(hdr.magic, PLATFORM_INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.log_ino = log_sbuf->st_ino;
+	hdr.unsorted = rs->unsorted;
+	if (fseek(rs->fp, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, rs->fp) != 1)
+		rs->error = 1;
+
+	if (fclose(rs->fp))
+		rs->error = 1;
+	rs->fp = NULL;
+
+	if (rs->error || rename(tmp_path, path)) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	dbg("Rebuilt the index of %s", platform_log);
+	return 0;
+}
+
+/**
+ * open_index
+ * @brief Open the index kept by rtas_errd, rebuilding it if needed
+ *
+ * Called with platform_log_lock() held.
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int
+open_index(void)
+{
+	struct platform_index_entry entry;
+	struct rebuild_state rs;
+	struct stat log_sbuf, sbuf;
+	char path[PATH_MAX];
+	off_t nr;
+	int valid = 0;
+
+	if (pindex.fd >= 0)
+		close(pindex.fd);
+	pindex.fd = -1;
+
+	if (fstat(platform_log_fd, &log_sbuf) < 0)
+		return -1;
+
+	index_path(path, sizeof(path));
+	pindex.fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+	if (pindex.fd < 0) {
+		dbg("Could not open %s, %s", path, strerror(errno));
+		return -1;
+	}
+
+	pindex.last_seq = 0;
+	pindex.last_end = 0;
+	if (fstat(pindex.fd, &sbuf) == 0 &&
+	    pread(pindex.fd, &pindex.hdr, sizeof(pindex.hdr), 0) ==
+							sizeof(pindex.hdr) &&
+	    !memcmp(pindex.hdr.magic, PLATFORM_INDEX_MAGIC,
+		    sizeof(pindex.hdr.magic)) &&
+	    pindex.hdr.log_ino == log_sbuf.st_ino &&
+	    (sbuf.st_size - sizeof(pindex.hdr)) % sizeof(entry) == 0) {
+		nr = (sbuf.st_size - sizeof(pindex.hdr)) / sizeof(entry);
+		if (nr == 0) {
+			valid = 1;
+		} else if (pread(pindex.fd, &entry, sizeof(entry),
+				 sbuf.st_size - sizeof(entry)) ==
+							sizeof(entry) &&
+			   check_entry(platform_log_fd, log_sbuf.st_size,
+				       &entry)) {
+			pindex.last_seq = entry.seq;
+			pindex.last_end = entry.offset + entry.length;
+			valid = 1;
+		}
+	}
+
+	if (!valid) {
+		close(pindex.fd);
+		pindex.fd = -1;
+
+		if (rebuild_index(platform_log_fd, &log_sbuf, &rs))
+			return -1;
+
+		pindex.fd = open(path, O_RDWR);
+		if (pindex.fd < 0)
+			return -1;
+		if (pread(pindex.fd, &pindex.hdr, sizeof(pindex.hdr), 0) !=
+							sizeof(pindex.hdr)) {
+			close(pindex.fd);
+			pindex.fd = -1;
+			return -1;
+		}
+		pindex.last_seq = rs.last_seq;
+		pindex.last_end = rs.last_end;
+	}
+
+	return 0;
+}
+
+/**
+ * append_entry
+ * @brief Add a record at the end of the index kept by rtas_errd
+ */
+static int
+append_entry(struct platform_index_entry *entry, void *arg)
+{
+	off_t end;
+
+	if (pindex.last_end && entry->seq <= pindex.last_seq &&
+	    !pindex.hdr.unsorted) {
+		pindex.hdr.unsorted = 1;
+		pwrite(pindex.fd, &pindex.hdr, sizeof(pindex.hdr), 0);
+	}
+
+	end = lseek(pindex.fd, 0, SEEK_END);
+	if (end < 0 || pwrite(pindex.fd, entry, sizeof(*entry), end) !=
+							sizeof(*entry)) {
+		dbg("Could not add RTAS event %u to the index of %s",
+		    entry->seq, platform_log);
+		return 1;
+	}
+
+	pindex.last_seq = entry->seq;
+	pindex.last_end = entry->offset + entry->length;
+	return 0;
+}
+
+/**
+ * index_platform_event
+ * @brief Record an RTAS event just written to the platform log
+ *
+ * Called with platform_log_lock() held. Events written while the index
+ * was not kept up to date (by an older rtas_errd, or if the index could
+ * not be written) are indexed first, and the index is rebuilt if the
+ * log was rotated or truncated, or the index removed.
+ *
+ * @param event RTAS event written
+ * @param offset where it was written in platform_log
+ * @param len number of bytes written
+ */
+void
+index_platform_event(struct event *event, off_t offset, int len)
+{
+	struct platform_index_entry entry;
+	struct stat log_sbuf, sbuf;
+
+	if (fstat(platform_log_fd, &log_sbuf) < 0)
+		return;
+
+	if (pindex.fd < 0 || log_sbuf.st_ino != pindex.hdr.log_ino ||
+	    offset < pindex.last_end ||
+	    fstat(pindex.fd, &sbuf) < 0 || sbuf.st_nlink == 0) {
+		if (open_index())
+			return;
+
+		/* The rebuild may have indexed this event already */
+		if (pindex.last_end >= offset + len)
+			return;
+	}
+
+	/* Catch up with the events written before this one */
+	if (pindex.last_end < offset)
+		scan_platform_log(platform_log_fd, pindex.last_end, offset,
+				  append_entry, NULL);
+
+	memset(&entry, 0, sizeof(entry));
+	entry.seq = event->seq_num;
+	entry.timestamp = time(NULL);
+	entry.severity = event->rtas_hdr ? event->rtas_hdr->severity : 0;
+	entry.offset = offset;
+	entry.length = len;
+	append_entry(&entry, NULL);
+}
+
+struct lookup_state {
+	uint32_t			seq;
+	struct platform_index_entry	*entry;
+	int				found;
+};
+
+static int
+lookup_add(struct platform_index_entry *entry, void *arg)
+{
+	struct lookup_state *ls = arg;
+
+	/* Keep going, the last event with that number wins */
+	if (entry->seq == ls->seq) {
+		*ls->entry = *entry;
+		ls->found = 1;
+	}
+
+	return 0;
+}
+
+static int
+cmp_entry(const void *key, const void *elem)
+{
+	uint32_t seq = *(const uint32_t *)key;
+	const struct platform_index_entry *entry = elem;
+
+	if (seq < entry->seq)
+		return -1;
+	return seq > entry->seq;
+}
+
+/**
+ * search_index
+ * @brief Look an event up in the index file
+ *
+ * @return 1 if found, 0 if not in the index, -1 if the index does not
+ * match the log
+ */
+static int
+search_index(int log_fd, struct stat *log_sbuf, uint32_t seq,
+	     struct platform_index_entry *entry, uint64_t *last_end)
+{
+	struct platform_index_hdr *hdr;
+	struct platform_index_entry *entries, *found = NULL;
+	char path[PATH_MAX];
+	struct stat sbuf;
+	size_t nr, i;
+	void *map;
+	int fd, rc = -1;
+
+	index_path(path, sizeof(path));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &sbuf) < 0 || sbuf.st_size < sizeof(*hdr) ||
+	    (sbuf.st_size - sizeof(*hdr)) % sizeof(*entry)) {
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(0, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	entries = (struct platform_index_entry *)(hdr + 1);
+	nr = (sbuf.st_size - sizeof(*hdr)) / sizeof(*entry);
+
+	if (memcmp(hdr->magic, PLATFORM_INDEX_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->log_ino != log_sbuf->st_ino)
+		goto out;
+
+	*last_end = 0;
+	if (nr) {
+		if (!check_entry(log_fd, log_sbuf->st_size, &entries[nr - 1]))
+			goto out;
+		*last_end = entries[nr - 1].offset + entries[nr - 1].length;
+	}
+
+	if (!hdr->unsorted) {
+		found = bsearch(&seq, entries, nr, sizeof(*entry), cmp_entry);
+	} else {
+		for (i = nr; i > 0 && found == NULL; i--)
+			if (entries[i - 1].seq == seq)
+				found = &entries[i - 1];
+	}
+
+	rc = 0;
+	if (found != NULL) {
+		if (!check_entry(log_fd, log_sbuf->st_size, found)) {
+			rc = -1;
+		} else {
+			*entry = *found;
+			rc = 1;
+		}
+	}
+
+out:
+	munmap(map, sbuf.st_size);
+	return rc;
+}
+
+/**
+ * find_platform_event
+ * @brief Find an RTAS event in the platform log
+ *
+ * Looks the event up in the index, then in the events written after the
+ * last one indexed.  The index belongs to rtas_errd, if it does not match
+ * the log the whole log is scanned instead.
+ *
+ * @param log_fd platform log, opened for reading
+ * @param seq sequence number of the event
+ * @param entry filled in with the index record of the event
+ * @return 0 if found, -1 otherwise
+ */
+int
+find_platform_event(int log_fd, int seq, struct platform_index_entry *entry)
+{
+	struct lookup_state ls = { .seq = seq, .entry = entry };
+	struct stat log_sbuf;
+	uint64_t last_end = 0;
+	int rc;
+
+	if (fstat(log_fd, &log_sbuf) < 0)
+		return -1;
+
+	rc = search_index(log_fd, &log_sbuf, seq, entry, &last_end);
+	if (rc < 0)
+		dbg("The index of %s does not match it", platform_log);
+
+	if (rc > 0)
+		return 0;
+
+	/* Not indexed, or could not be, scan the rest of the log */
+	if (rc < 0)
+		last_end = 0;
+	scan_platform_log(log_fd, last_end, log_sbuf.st_size, lookup_add, &ls);
+
+	return ls.found ? 0 : -1;
+}
+
+/**
+ * print_platform_event
+ * @brief Print an RTAS event from the platform log
+ *
+ * @param seq sequence number of the event
+ * @param fp where to print it
+ * @return 0 on success, -1 on failure
+ */
+int
+print_platform_event(int seq, FILE *fp)
+{
+	struct platform_index_entry entry;
+	char *buf;
+	int log_fd, rc = -1;
+
+	log_fd = open(platform_log, O_RDONLY);
+	if (log_fd < 0) {
+		fprintf(stderr, "Could not open %s, %s\n", platform_log,
+			strerror(errno));
+		return -1;
+	}
+
+	if (find_platform_event(log_fd, seq, &entry)) {
+		fprintf(stderr, "RTAS event %d is not in %s\n", seq,
+			platform_log);
+		goto out;
+	}
+
+	buf = malloc(entry.length);
+	if (buf == NULL)
+		goto out;
+
+	if (pread(log_fd, buf, entry.length, entry.offset) == entry.length &&
+	    fwrite(buf, 1, entry.length, fp) == entry.length)
+		rc = 0;
+
+	free(buf);
+out:
+	close(log_fd);
+	return rc;
+}
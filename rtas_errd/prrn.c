@@ -34,11 +34,12 @@
 #include "rtas_errd.h"
 
 struct pmap_struct {
-	struct pmap_struct	*next;
+	struct pmap_struct	*next;		/* in pmap hash bucket */
 	/* The fields below are stored in host endian */
 	uint32_t		phandle;
 	uint32_t		drc_index;
 	char			*name;
+	unsigned int		gen;		/* last scan that saw it */
 };
 
 struct drconf_cell {
@@ -49,8 +50,21 @@ struct drconf_cell {
 	uint32_t	flags;
 };
 
-static struct pmap_struct *plist;
+/*
+ * Map of phandles to device tree nodes, and of drc-indexes to LMBs (see
+ * add_drconf_phandles()). It is kept from one PRRN event to the next and
+ * only rescanned when rtas_update_nodes() reports a phandle it does not
+ * know. PRRN events are handled one at a time (see event_workers.c), so
+ * it needs no locking.
+ */
+#define PMAP_BUCKETS	4096
+
+static struct pmap_struct *pmap[PMAP_BUCKETS];
+static unsigned int pmap_gen;
+static int pmap_valid;
+static char lmb_name[] = "LMB";
 static int prrn_log_fd;
+static int ofdt_fd = -1;
 static char prrn_filename[128];
 
 #define OFDT_BASE	"/proc/device-tree"
@@ -84,69 +98,82 @@ static void close_prrn_log(void)
 		close(prrn_log_fd);
 }
 
-uint32_t get_drc_index(const char *path)
+static unsigned int pmap_hash(uint32_t phandle)
 {
-	char drc_path[256];
-	FILE *fp;
-	uint32_t drc_index;
-	int rc;
+	return (phandle * 2654435761u) % PMAP_BUCKETS;
+}
 
-	sprintf(drc_path, "%s/%s", path, "ibm,my-drc-index");
-	fp = fopen(drc_path, "r");
-	if (!fp)
-		return 0;
+/**
+ * phandle_to_pms
+ *
+ * @param phandle
+ * @returns the node with that phandle, NULL if unknown
+ */
+static struct pmap_struct *phandle_to_pms(uint32_t phandle)
+{
+	struct pmap_struct *pms = pmap[pmap_hash(phandle)];
 
-	rc = fread(&drc_index, sizeof(drc_index), 1, fp);
-	if (rc != 1)
-		drc_index = 0;
+	while (pms && pms->phandle != phandle)
+		pms = pms->next;
 
-	fclose(fp);
-	return be32toh(drc_index);
+	return pms;
 }
 
 /**
  * add_phandle_to_list
  *
+ * Adds a node to the phandle map, or refreshes it if it is already
+ * there, and marks it as seen by the current scan.
+ *
  * @param name
  * @param phandle
+ * @param drc_index
  */
 static void add_phandle_to_list(char *name, uint32_t phandle,
 				uint32_t drc_index)
 {
 	struct pmap_struct *pm;
+	unsigned int hash;
+	char *pname;
 
-	pm = calloc(1, sizeof(struct pmap_struct));
-	if (!pm)
-		return;
+	pm = phandle_to_pms(phandle);
+	if (pm && strcmp(pm->name, name)) {
+		if (name == lmb_name) {
+			pname = lmb_name;
+		} else {
+			pname = strdup(name);
+			if (!pname)
+				return;
+		}
 
-	pm->name = malloc(strlen(name) + 1);
-	if (!pm->name) {
-		free(pm);
-		return;
+		if (pm->name != lmb_name)
+			free(pm->name);
+		pm->name = pname;
 	}
 
-	sprintf(pm->name, "%s", name);
+	if (!pm) {
+		pm = calloc(1, sizeof(struct pmap_struct));
+		if (!pm)
+			return;
 
-	pm->phandle = phandle;
-	pm->drc_index = drc_index;
-	pm->next = plist;
-	plist = pm;
-}
-
-/**
- * phandle_to_name
- *
- * @param ph
- * @returns
- */
-static struct pmap_struct *phandle_to_pms(uint32_t phandle)
-{
-	struct pmap_struct *pms = plist;
+		if (name == lmb_name) {
+			pm->name = lmb_name;
+		} else {
+			pm->name = strdup(name);
+			if (!pm->name) {
+				free(pm);
+				return;
+			}
+		}
 
-	while (pms && pms->phandle != phandle)
-		pms = pms->next;
+		pm->phandle = phandle;
+		hash = pmap_hash(phandle);
+		pm->next = pmap[hash];
+		pmap[hash] = pm;
+	}
 
-	return pms;
+	pm->drc_index = drc_index;
+	pm->gen = pmap_gen;
 }
 
 /**
@@ -197,7 +224,8 @@ static int add_std_phandles(char *parent, char *p)
 		}
 		*pend = '\0';
 
-		drc_index = get_drc_index(path);
+		if (!dt_path_to_drcindex(path + strlen(OFDT_BASE), &drc_index))
+			drc_index = 0;
 		add_phandle_to_list(path + strlen(OFDT_BASE), be32toh(phandle),
 				    drc_index);
 		fclose(fd);
@@ -255,7 +283,8 @@ static int add_drconf_phandles()
 
 	for (i = 0; i < entries; i++) {
 		/* See comment above about rtas reporting drc_indexes. */
-		add_phandle_to_list("LMB", be32toh(mem->drc_index), be32toh(mem->drc_index));
+		add_phandle_to_list(lmb_name, be32toh(mem->drc_index),
+				    be32toh(mem->drc_index));
 		mem++; /* trust your compiler */
 	}
 
@@ -266,40 +295,76 @@ static int add_drconf_phandles()
 /**
  * free_phandles
  *
+ * Drops the nodes the last scan did not see, they left the device tree.
  */
 static void free_phandles()
 {
-	struct pmap_struct *pm;
-
-	while (plist) {
-		pm = plist;
-		plist = plist->next;
+	struct pmap_struct *pm, **prev;
+	int i;
+
+	for (i = 0; i < PMAP_BUCKETS; i++) {
+		prev = &pmap[i];
+		while ((pm = *prev)) {
+			if (pm->gen == pmap_gen) {
+				prev = &pm->next;
+				continue;
+			}
 
-		free(pm->name);
-		free(pm);
+			*prev = pm->next;
+			if (pm->name != lmb_name)
+				free(pm->name);
+			free(pm);
+		}
 	}
 }
 
 /**
  * add_phandles
  *
- * @returns
+ * Rescans the device tree into the phandle map. Nodes already in the
+ * map are kept, so a failed scan leaves it as it was, with whatever
+ * new nodes were found.
+ *
+ * @returns 0 on success, !0 otherwise
  */
 static int add_phandles()
 {
 	int rc;
 
+	pmap_gen++;
+
 	rc = add_std_phandles(OFDT_BASE, NULL);
-	if (rc) {
-		free_phandles();
+	if (rc)
 		return rc;
-	}
 
 	rc = add_drconf_phandles();
 	if (rc)
-		free_phandles();
+		return rc;
 
-	return rc;
+	free_phandles();
+	pmap_valid = 1;
+	return 0;
+}
+
+/**
+ * open_ofdt
+ *
+ * Opens the ofdt file once for all the updates of a devtree_update().
+ * The kernel takes a single command per write(), so updates are still
+ * written one by one.
+ */
+static void open_ofdt(void)
+{
+	ofdt_fd = open(OFDTPATH, O_WRONLY);
+	if (ofdt_fd < 0)
+		dbg("Failed to open %s: %s", OFDTPATH, strerror(errno));
+}
+
+static void close_ofdt(void)
+{
+	if (ofdt_fd >= 0)
+		close(ofdt_fd);
+	ofdt_fd = -1;
 }
 
 /**
@@ -312,19 +377,16 @@ static int add_phandles()
 static int do_update(char *cmd, int len)
 {
 	int rc;
-	int i, fd;
+	int i;
 
-	fd = open(OFDTPATH, O_WRONLY);
-	if (fd <= 0) {
-		dbg("Failed to open %s: %s", OFDTPATH, strerror(errno));
-		rc = errno;
-		return rc;
-	}
+	if (ofdt_fd < 0)
+		return ENOENT;
 
-	if ((rc = write(fd, cmd, len)) != len)
+	if ((rc = write(ofdt_fd, cmd, len)) != len)
 		dbg("Error writing to ofdt file! rc %d errno %d", rc, errno);
 
-	close(fd);
+	if (!debug)
+		return rc;
 
 	/* The reamining code only formats the cmd buffer to make it
 	 * human readable when printed via dbg().
@@ -529,8 +591,9 @@ static void do_node_update(struct pmap_struct *pms, const char *type)
  *
  * @param op
  * @param n
+ * @param rescanned set once the device tree was rescanned for this event
  */
-static void update_nodes(unsigned int *op, unsigned int n)
+static void update_nodes(unsigned int *op, unsigned int n, int *rescanned)
 {
 	int i, len;
 	uint32_t phandle;
@@ -542,6 +605,14 @@ static void update_nodes(unsigned int *op, unsigned int n)
 		dbg("Updating node with phandle %08x", phandle);
 
 		pms = phandle_to_pms(phandle);
+		if (!pms && !*rescanned) {
+			/* A node was added since the map was last scanned */
+			dbg("Unknown phandle %08x, rescanning device tree",
+			    phandle);
+			*rescanned = 1;
+			add_phandles();
+			pms = phandle_to_pms(phandle);
+		}
 		if (!pms)
 			continue;
 
@@ -565,13 +636,18 @@ static void devtree_update(uint scope)
 	int rc;
 	unsigned int wa[1024];
 	unsigned int *op;
+	int rescanned = 0;
 
 	dbg("Updating device_tree");
-	if (add_phandles())
-		return;
+	if (!pmap_valid) {
+		if (add_phandles())
+			return;
+		rescanned = 1;
+	}
 
 	/* First 16 bytes of work area must be initialized to zero */
 	memset(wa, 0x00, 16);
+	open_ofdt();
 
 	do {
 		rc = rtas_update_nodes((char *)wa, -scope);
@@ -597,7 +673,7 @@ static void devtree_update(uint scope)
 				break;
 
 			    case 0x02:
-				update_nodes(op+1, n);
+				update_nodes(op+1, n, &rescanned);
 				break;
 
 			    case 0x03:
@@ -612,13 +688,13 @@ static void devtree_update(uint scope)
 		}
 	} while (rc == 1);
 
-	free_phandles();
+	close_ofdt();
 	dbg("Finished devtree update");
 }
 
 void handle_prrn_event(struct event *re)
 {
-	pid_t pid;
+	char *drmgr_args[] = { "/usr/sbin/drmgr", "-P", prrn_filename, NULL };
 	uint scope = re->rtas_hdr->ext_log_length;
 
 	open_prrn_log();
@@ -627,24 +703,15 @@ void handle_prrn_event(struct event *re)
 
 	devtree_update(scope);
 	close_prrn_log();
+	invalidate_dt_status_index();
+	drc_map_invalidate();
 
-	/* Kick off script to do required hotplug add/remove */
-	pid = fork();
-	if (pid == -1) {
-		unlink(prrn_filename);
-		dbg("Could not exec drmgr PRRN handler.\n");
-		return;
-	}
-
-	if (pid == 0) { /* Child */
-		dbg("Executing drmgr prrn handler.\n");
-		execl("/usr/sbin/drmgr", "/usr/sbin/drmgr", "-P", prrn_filename,
-		      NULL);
+	/*
+	 * Kick off script to do required hotplug add/remove, the
+	 * supervisor reaps it
+	 */
+	if (spawn_helper(HELPER_DRMGR, "/usr/sbin/drmgr", drmgr_args)) {
 		unlink(prrn_filename);
-		/* Should not get here */
-		dbg("Failed PRRN Hotplug exec: %s", strerror(errno));
-		exit(0);
+		dbg("Could not exec drmgr PRRN handler: %s", strerror(errno));
 	}
-
-	/* Nothing to do for the parent, just return */
 }
@@ -25,10 +25,12 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <getopt.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <pthread.h>
 #include <librtas.h>
 #include "rtas_errd.h"
 #include "platform.c"
@@ -120,6 +122,7 @@ handle_rtas_event(struct event *event)
 {
 	int rc = 0;
 	struct rtas_event_exthdr *exthdr;
+	struct timespec ts;
 
 	dbg("Handling RTAS event %d", event->seq_num);
 
@@ -130,10 +133,14 @@ handle_rtas_event(struct event *event)
 	 * the log will be updated with the path to the dump
 	 */
 	dbg("Entering check_platform_dump()");
+	stats_clock(&ts);
 	check_platform_dump(event);
+	stats_stage(STATS_PLATDUMP, &ts);
 
 	/* write the event to the platform file */
+	stats_clock(&ts);
 	rc = print_rtas_event(event);
+	stats_stage(STATS_PRINT, &ts);
 	if (rc <= 0) {
 		log_msg(event, "Could not write RTAS event %d to log file %s",
 			event->seq_num, platform_log);
@@ -203,10 +210,12 @@ handle_rtas_event(struct event *event)
 	if (exthdr->predictive)
 		event->flags |= RE_PREDICTIVE;
 
+	stats_clock(&ts);
 	if (event->rtas_hdr->version == 6)
 		process_v6(event);
 	else
 		process_pre_v6(event);
+	stats_stage(STATS_ANALYSIS, &ts);
 
 	/* Log the event in the servicelog DB */
 	log_event(event);
@@ -234,92 +243,97 @@ handle_rtas_event(struct event *event)
  * read_rtas_event
  * @brief Main routine to retrieve RTAS events from the kernel
  * 
- * Responsible for reading RTAS events from the kernel (via /proc)
- * and calling handle_rtas_event() to process the event.
+ * Responsible for taking the RTAS events read from the kernel (via /proc)
+ * by the reader thread off the event queue and dispatching them to the
+ * threads running handle_rtas_event() to process them.
  */
 int
 read_rtas_events()
 {
-	struct event event = {0};
+	struct event *event;
+	struct event_queue_stats stats;
+	struct timespec ts;
 	ssize_t len;
-	int retries = 0;
+	int rc = 0;
 
-	memset(&event, 0, sizeof(event));
+	start_event_workers();
 
 	while (1) {
+		event = calloc(1, sizeof(*event));
+		if (event == NULL) {
+			log_msg(NULL, "Could not allocate an RTAS event, %s",
+				strerror(errno));
+			rc = -1;
+			break;
+		}
+
 		/*
-		 * Passing a reference to re to the read routine is correct.
+		 * Passing a reference to re to the queue is correct.
 		 * see rtas_errd.h for details.
 		 */
-		len = read_proc_error_log((char *)&event, RTAS_ERROR_LOG_MAX);
+		len = get_queued_event(event);
 		if (len <= 0) {
-			retries++;
-			if (retries >= 3) {
+			free(event);
+
+			if (len < 0) {
 				log_msg(NULL, "Could not read error log file");
-				return -1;
+				rc = -1;
 			}
-			continue;
-		}
 
-		retries = 0;
+			/*
+			 * Otherwise the reader has read the last test event,
+			 * or was stopped on SIGTERM
+			 */
+			break;
+		}
 
-		event.rtas_event = parse_rtas_event(event.event_buf, len);
-		if (event.rtas_event == NULL) {
-			log_msg(&event, "Could not parse RTAS event");
-			return -1;
+		stats_clock(&ts);
+		event->rtas_event = parse_rtas_event(event->event_buf, len);
+		stats_stage(STATS_PARSE, &ts);
+		if (event->rtas_event == NULL) {
+			log_msg(event, "Could not parse RTAS event");
+			free(event);
+			rc = -1;
+			break;
 		}
 
-		event.rtas_hdr = rtas_get_event_hdr_scn(event.rtas_event);
-		if (event.rtas_hdr == NULL) {
-			log_msg(&event, "Could not retrieve event header");
-			cleanup_rtas_event(event.rtas_event);
-			return -1;
+		event->rtas_hdr = rtas_get_event_hdr_scn(event->rtas_event);
+		if (event->rtas_hdr == NULL) {
+			log_msg(event, "Could not retrieve event header");
+			cleanup_rtas_event(event->rtas_event);
+			free(event);
+			rc = -1;
+			break;
 		}
 
-		event.length = event.rtas_event->event_length;
+		event->length = event->rtas_event->event_length;
+		stats_event_type(event->rtas_hdr->type);
 
 		if (scanlog != NULL)
-			event.flags |= RE_SCANLOG_AVAIL;
+			event->flags |= RE_SCANLOG_AVAIL;
 
-                dbg("Received RTAS event %d", event.seq_num);
+		dbg("Received RTAS event %d", event->seq_num);
 
-		/*
-		 * Mark ourselves as not being able to handle SIGHUP
-		 * signals while handling the RTAS event
-		 */
-		d_cfg.flags &= ~RE_CFG_RECFG_SAFE;
-		handle_rtas_event(&event);
-		d_cfg.flags |= RE_CFG_RECFG_SAFE;
+		/* Handled and freed by the worker for its resource */
+		dispatch_event(event);
+	}
 
-		if (d_cfg.flags & RE_CFG_RECEIVED_SIGHUP) {
-			diag_cfg(1, &cfg_log);
-			d_cfg.flags &= ~RE_CFG_RECEIVED_SIGHUP;
-		}
+	/* Let the events already dispatched be handled */
+	stop_event_workers();
 
-		/* cleanup the RTAS event */
-		if (event.loc_codes != NULL)
-			free(event.loc_codes);
-		free_diag_vpd(&event);
-		cleanup_rtas_event(event.rtas_event);
-		memset(&event, 0, sizeof(event));
+	get_event_queue_stats(&stats);
+	dbg("RTAS event queue: %lu events read, %lu dropped, at most %u "
+	    "queued", stats.read, stats.dropped, stats.max_queued);
 
-#ifdef DEBUG
-		/*
-		 * If we are reading a fake rtas event from a test file
-		 * we only want to read it once
-		 */
-		if (testing_finished)
-			break;
-#endif
-	}
-
-	return 0;
+	return rc;
 }
 
 static void print_usage(char *argv0)
 {
 	fprintf(stderr, "Usage: %s [OPTION]\n\n", argv0);
 #ifdef DEBUG
+	fprintf(stderr, "  -b, --bench=N             replay the RTAS test events N times and report\n"
+			"                            events/s and latencies\n");
 	fprintf(stderr, "  -c, --config=FILE         path to config file (default %s)\n",
 		config_file);
 #endif
@@ -329,8 +343,10 @@ static void print_usage(char *argv0)
 		epow_status_file);
 	fprintf(stderr, "  -f, --file=FILE           path to RTAS test file\n");
 #endif
+	fprintf(stderr, "  -g, --getevent=SEQ        print RTAS event SEQ from the platform log and exit\n");
 	fprintf(stderr, "  -h, --help                help (this message)\n");
 #ifdef DEBUG
+	fprintf(stderr, "  -H, --helperdir=DIR       run the helpers (drmgr, lsvpd, ...) from DIR\n");
 	fprintf(stderr, "  -l, --logfile=FILE        path to rtas_errd debug logfile (default %s)\n",
 		rtas_errd_log);
 	fprintf(stderr, "  -m, --msgsfile=FILE       path to syslog\n");
@@ -348,6 +364,12 @@ static struct option longopts[] = {
 	.flag = NULL,
 	.val = 'd'
 },
+{
+	.name = "getevent",
+	.has_arg = 1,
+	.flag = NULL,
+	.val = 'g'
+},
 {
 	.name = "help",
 	.has_arg = 0,
@@ -355,6 +377,12 @@ static struct option longopts[] = {
 	.val = 'h'
 },
 #ifdef DEBUG
+{
+	.name = "bench",
+	.has_arg = 1,
+	.flag = NULL,
+	.val = 'b'
+},
 {
 	.name = "config",
 	.has_arg = 1,
@@ -373,6 +401,12 @@ static struct option longopts[] = {
 	.flag = NULL,
 	.val = 'f'
 },
+{
+	.name = "helperdir",
+	.has_arg = 1,
+	.flag = NULL,
+	.val = 'H'
+},
 {
 	.name = "logfile",
 	.has_arg = 1,
@@ -426,6 +460,7 @@ main(int argc, char *argv[])
 	struct sigaction sigact;
 	int rc = 0;
 	int c;
+	char *get_seq = NULL;
 #ifdef DEBUG
 	int f_flag = 0, s_flag = 0;
 #endif
@@ -446,10 +481,21 @@ main(int argc, char *argv[])
 			case 'd':
 				debug++;
 				break;
+			case 'g': /* print an event from platform_log */
+				get_seq = optarg;
+				break;
 			case 'h':
 				print_usage(argv[0]);
 				return 0;
 #ifdef DEBUG 
+			case 'b': /* replay benchmark */
+				bench_passes = atoi(optarg);
+				if (bench_passes <= 0) {
+					print_usage(argv[0]);
+					return -1;
+				}
+				break;
+
 			case 'c': /* ppc64-diag config file */
 				config_file = optarg;
 				break;
@@ -469,6 +515,10 @@ main(int argc, char *argv[])
 				proc_error_log2 = NULL;
 				break;
 
+			case 'H': /* fake helpers */
+				helper_dir = optarg;
+				break;
+
 			case 'l': /* debug rtas_errd.log file */
 				rtas_errd_log = optarg;
 				break;
@@ -500,6 +550,11 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* Only print an event, using the index of the platform log */
+	if (get_seq != NULL)
+		return print_platform_event(strtol(get_seq, NULL, 0), stdout) ?
+			1 : 0;
+
 	/*
 	 * The debug option can be specified multiple times which will
 	 * indicate the debug level to set for librtas.
@@ -509,9 +564,29 @@ main(int argc, char *argv[])
 	if (debug - 1)
 		rtas_set_debug(debug - 1);
 
+#ifdef DEBUG
+	/*
+	 * A benchmark reports to stdout, and keeps its checkpoint and
+	 * statistics next to its platform log
+	 */
+	if (bench_passes) {
+		static char bench_checkpoint[PATH_MAX];
+		static char bench_stats[PATH_MAX];
+
+		snprintf(bench_checkpoint, sizeof(bench_checkpoint), "%s.ckpt",
+			 platform_log);
+		checkpoint_file = bench_checkpoint;
+		snprintf(bench_stats, sizeof(bench_stats), "%s.stats",
+			 platform_log);
+		stats_file = bench_stats;
+	}
+	else
+#endif
 	if (! debug)
 		daemonize();
 
+	stats_init();
+
 	/* Initialize all the files used by rtas_errd */
 	rc = init_files();
 	if (rc)
@@ -527,16 +602,6 @@ main(int argc, char *argv[])
 		goto error_out;
 	}
 
-	/* Set up a signal handler for SIGHUP to re-read the config file */
-	sigact.sa_handler = (void *)sighup_handler;
-	sigemptyset(&sigact.sa_mask);
-	sigact.sa_flags = SA_RESTART;
-	if (sigaction(SIGHUP, &sigact, NULL)) {
-		log_msg(NULL, "Could not initialize signal handler for "
-			"re-reading the ppc64-diag config file (SIGHUP), %s",
-			strerror(errno));
-	}
-
 	/* Ignore SIGPIPE */
 	sigact.sa_handler = SIG_IGN;
 	sigemptyset(&sigact.sa_mask);
@@ -545,15 +610,24 @@ main(int argc, char *argv[])
 		log_msg(NULL, "Cannot ignore SIGPIPE, %s", strerror(errno));
 	}
 
-	/* Set up a signal handler for SIGCHLD to handle terminating children */
-	setup_sigchld_handler();
+	/*
+	 * Start the supervisor reaping the helpers (drmgr, lsvpd, ...),
+	 * SIGCHLD is left to its default action
+	 */
+	rc = start_supervisor();
+	if (rc)
+		goto error_out;
 
 	/* Read any configuration options from the config file */
 	rc = diag_cfg(1, &cfg_log);
 	if (rc)
 		goto error_out;
 
-	/* Open the servicelog database */
+	/* Open the servicelog database, a benchmark leaves it alone */
+	rc = 0;
+#ifdef DEBUG
+	if (!bench_passes)
+#endif
 	rc = servicelog_open(&slog, 0);
 	if (rc) {
 		log_msg(NULL, "Could not open the servicelog database, events "
@@ -562,6 +636,42 @@ main(int argc, char *argv[])
 		slog = NULL;
 	}
 
+	/* Log the events in the servicelog in batches */
+	start_slog_writer();
+
+	/*
+	 * Re-read the config file on SIGHUP, handle the events already
+	 * read and flush the servicelog batch on SIGTERM, write the
+	 * statistics to stats_file on SIGUSR1
+	 */
+	if (start_signal_waiter() == 0) {
+		sigact.sa_handler = (void *)waiter_signal_handler;
+		sigemptyset(&sigact.sa_mask);
+		sigact.sa_flags = SA_RESTART;
+		if (sigaction(SIGHUP, &sigact, NULL) ||
+		    sigaction(SIGTERM, &sigact, NULL) ||
+		    sigaction(SIGUSR1, &sigact, NULL)) {
+			log_msg(NULL, "Could not initialize signal handler "
+				"for SIGHUP, SIGTERM and SIGUSR1, %s",
+				strerror(errno));
+		}
+	}
+
+	/*
+	 * Start draining the kernel buffer now, the events are handled once
+	 * the RTAS events from syslog have been updated
+	 */
+#ifdef DEBUG
+	if (bench_passes)
+		bench_start();
+#endif
+	rc = start_event_reader();
+	if (rc)
+		goto error_out;
+
+	/* Index the status of the device tree nodes for the analysis */
+	init_dt_status_index();
+
 	/* update RTAS events from syslog */
 	update_rtas_msgs();
 
@@ -588,6 +698,13 @@ main(int argc, char *argv[])
 #endif
 
 	rc = read_rtas_events();
+	stop_supervisor();
+	stop_slog_writer();
+
+#ifdef DEBUG
+	if (bench_passes)
+		bench_report(stdout);
+#endif
 
 error_out:
 	errno = 0;
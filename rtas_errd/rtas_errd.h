@@ -22,11 +22,15 @@
 #ifndef _RTAS_ERRD_H
 #define _RTAS_ERRD_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <librtasevent.h>
 #include <servicelog-1/servicelog.h>
 #include "fru_prev6.h"
 #include "config.h"
+#include "drc_map.h"
 
 extern char *platform_log;
 extern char *messages_log;
@@ -40,17 +44,19 @@ extern char *test_file;
 extern char *scenario_file;
 extern int testing_finished;
 extern int no_drmgr;
+extern int bench_passes;
+extern char *helper_dir;
 /**
  * @def RTAS_ERRD_ARGS 
  * @brief DEBUG args for rtas_errd
  */
-#define RTAS_ERRD_ARGS		"c:de:f:hl:m:p:Rs:"
+#define RTAS_ERRD_ARGS		"b:c:de:f:g:hH:l:m:p:Rs:"
 #else
 /**
  * @def RTAS_ERRD_ARGS
  * @brief standard args for rtas_errd
  */
-#define RTAS_ERRD_ARGS		"dh"
+#define RTAS_ERRD_ARGS		"dg:h"
 #endif
 
 extern int platform_log_fd;
@@ -130,6 +136,8 @@ void close_files(void);
 void _dbg(const char *, ...);
 int print_rtas_event(struct event *);
 int platform_log_write(char *, ...);
+void platform_log_lock(void);
+void platform_log_unlock(void);
 void update_epow_status_file(int);
 int read_proc_error_log(char *, int);
 
@@ -137,6 +145,25 @@ int read_proc_error_log(char *, int);
 void check_scanlog_dump(void);
 void check_platform_dump(struct event *);
 
+/* event_queue.c */
+struct event_queue_stats {
+	unsigned long	read;		/**< events read from the kernel */
+	unsigned long	dropped;	/**< ... lost as the queue was full */
+	unsigned int	queued;		/**< waiting to be handled */
+	unsigned int	max_queued;	/**< high water mark of the queue */
+};
+
+int start_event_reader(void);
+void stop_event_reader(void);
+int get_queued_event(struct event *);
+void get_event_queue_stats(struct event_queue_stats *);
+
+/* event_workers.c */
+void start_event_workers(void);
+void dispatch_event(struct event *);
+void stop_event_workers(void);
+void sighup_reconfig(void);
+
 /* eeh.c */
 void check_eeh(struct event *);
 
@@ -147,7 +174,31 @@ void handle_resource_dealloc(struct event *);
 int handle_rtas_event(struct event *);
 
 /* update.c */
+extern char *checkpoint_file;
 void update_rtas_msgs(void);
+void checkpoint_platform_log(int, off_t);
+char *find_rtas_start(char *, char *);
+char *find_rtas_end(char *, char *);
+int get_rtas_no(char *);
+
+/* platform_index.c */
+/**
+ * @struct platform_index_entry
+ * @brief Where an RTAS event is in the platform log
+ */
+struct platform_index_entry {
+	uint32_t	seq;
+	uint32_t	severity;
+	int64_t		timestamp;	/**< when logged, 0 if unknown,
+					     see scan_platform_log() */
+	uint64_t	offset;
+	uint32_t	length;
+	uint32_t	reserved;
+};
+
+void index_platform_event(struct event *, off_t, int);
+int find_platform_event(int, int, struct platform_index_entry *);
+int print_platform_event(int, FILE *);
 
 /* ela.c */
 int process_pre_v6(struct event *);
@@ -157,7 +208,9 @@ int get_error_fmt(struct event *);
 int process_v6(struct event *);
 
 /* diag_support.c */
-char *get_dt_status(char *);
+void init_dt_status_index(void);
+void invalidate_dt_status_index(void);
+int get_dt_status(char *, char *, size_t);
 char *diag_get_fru_pn(struct event *, char *);
 void free_diag_vpd(struct event *);
 
@@ -174,11 +227,41 @@ int servicelog_sev(int rtas_sev);
 void add_callout(struct event *event, char pri, int type, char *proc,
 		 char *loc, char *pn, char *sn, char *ccin);
 void log_event(struct event *);
+typedef void (*slog_done_fn)(uint64_t, int, void *);
+int start_slog_writer(void);
+void stop_slog_writer(void);
+void queue_slog_event(struct sl_event *, slog_done_fn, void *);
 
 /* signal.c */
-void sighup_handler(int, siginfo_t, void *);
-void restore_sigchld_default(void);
-void setup_sigchld_handler(void);
+void waiter_signal_handler(int, siginfo_t, void *);
+int start_signal_waiter(void);
+
+/* supervisor.c */
+enum helper_type {
+	HELPER_DRMGR,
+	HELPER_LSVPD,
+	HELPER_PLATDUMP,
+	HELPER_EPOW,
+	HELPER_TYPES
+};
+
+struct helper;
+
+struct helper_stats {
+	char		*name;
+	unsigned long	spawned;
+	unsigned long	failed;		/**< could not be started */
+	unsigned long	timed_out;
+	unsigned int	running;
+};
+
+int start_supervisor(void);
+void stop_supervisor(void);
+int run_helper(enum helper_type, char *, char *[]);
+int spawn_helper(enum helper_type, char *, char *[]);
+FILE *helper_popen(enum helper_type, char *[], struct helper **);
+int helper_pclose(FILE *, struct helper *);
+void get_helper_stats(enum helper_type, struct helper_stats *);
 
 /* prrn.c */
 void handle_prrn_event(struct event *);
@@ -186,4 +269,34 @@ void handle_prrn_event(struct event *);
 /* hotplug.c */
 void handle_hotplug_event(struct event *);
 
+/* stats.c */
+enum stats_stage {
+	STATS_QUEUED,		/* waiting in the event queue */
+	STATS_PARSE,		/* parse_rtas_event() */
+	STATS_HANDLE,		/* handle_rtas_event() */
+	STATS_PRINT,		/* print_rtas_event() */
+	STATS_PLATDUMP,		/* check_platform_dump() */
+	STATS_ANALYSIS,		/* process_v6(), process_pre_v6() */
+	STATS_LSVPD,		/* get_diag_vpd() */
+	STATS_SERVICELOG,	/* servicelog_event_log(), notification tools */
+	STATS_STAGES
+};
+
+#define stats_clock(_ts)	clock_gettime(CLOCK_MONOTONIC, (_ts))
+
+extern char *stats_file;
+void stats_init(void);
+double stats_uptime(void);
+void stats_stage(enum stats_stage, struct timespec *);
+uint64_t stats_stage_count(enum stats_stage);
+void stats_event_type(int);
+void print_stats(FILE *);
+int write_stats_file(void);
+
+/* bench.c */
+#ifdef DEBUG
+void bench_start(void);
+void bench_report(FILE *);
+#endif
+
 #endif /* _RTAS_ERRD_H */
@@ -28,6 +28,7 @@
 #include <time.h>
 #include <librtasevent.h>
 #include <sys/wait.h>
+#include <pthread.h>
 #include "rtas_errd.h"
 
 #define bcd_4b_toint(x)	( ((((x) & 0xf000) >> 12) * 1000) + \
@@ -37,6 +38,53 @@
 #define bcd_2b_toint(x)	( ((((x) & 0xf0) >> 4) * 10) +      \
 			  ((((x) & 0xf))))
 
+/**
+ * @var slog_lock
+ * @brief Serializes the use of the servicelog handle
+ */
+static pthread_mutex_t slog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The events are logged in batches by the servicelog writer thread, a
+ * batch is written once SLOG_BATCH_MAX events are queued or the oldest
+ * one has waited SLOG_BATCH_DELAY_MS.  The handlers block once
+ * SLOG_QUEUE_MAX events are waiting.
+ */
+#define SLOG_BATCH_MAX		32
+#define SLOG_BATCH_DELAY_MS	200
+#define SLOG_QUEUE_MAX		(4 * SLOG_BATCH_MAX)
+
+struct slog_request {
+	struct sl_event		*entry;
+	slog_done_fn		done;
+	void			*arg;
+	struct timespec		queued;
+	struct slog_request	*next;
+};
+
+/**
+ * @var slog_writer
+ * @brief Queue of the events waiting for the servicelog writer thread
+ */
+static struct {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;		/* events queued or stop */
+	pthread_cond_t		space;		/* room in the queue */
+	struct slog_request	*head;
+	struct slog_request	**tail;
+	unsigned int		count;
+	int			running;
+	int			stop;
+	int			joined;		/* writer has exited */
+	pthread_cond_t		stopped;	/* ... and been joined */
+	pthread_t		thread;
+} slog_writer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+	.stopped = PTHREAD_COND_INITIALIZER,
+	.tail = &slog_writer.head,
+};
+
 /**
  * get_event_date
  * @brief Retrieve the timestamp from an event
@@ -206,6 +254,236 @@ mem_fail:
 	return;
 }
 
+/**
+ * log_event_done
+ * @brief Report the servicelog key of an RTAS event
+ *
+ * @param key servicelog key of the event
+ * @param rc return code of servicelog_event_log()
+ * @param arg sequence number of the RTAS event
+ */
+static void
+log_event_done(uint64_t key, int rc, void *arg)
+{
+	if (rc == 0)
+		log_msg(NULL, "RTAS event %ld: servicelog key %llu",
+			(long)arg, (long long unsigned int)key);
+}
+
+/**
+ * write_slog_batch
+ * @brief Log a batch of events in the servicelog
+ *
+ * The batch is written with the servicelog handle held, then the
+ * requesters are told about the keys of their events.
+ *
+ * @param batch list of the queued events
+ */
+static void
+write_slog_batch(struct slog_request *batch)
+{
+	struct slog_request *req, *next;
+	uint64_t key[SLOG_BATCH_MAX];
+	int rc[SLOG_BATCH_MAX];
+	struct timespec ts;
+	int i;
+
+	pthread_mutex_lock(&slog_lock);
+	for (req = batch, i = 0; req != NULL; req = req->next, i++) {
+		key[i] = 0;
+		stats_clock(&ts);
+		rc[i] = servicelog_event_log(slog, req->entry, &key[i]);
+		stats_stage(STATS_SERVICELOG, &ts);
+		servicelog_event_free(req->entry);
+
+		if (rc[i])
+			log_msg(NULL, "Could not log RTAS event %ld to "
+				"servicelog.\n%s\n", (long)req->arg,
+				servicelog_error(slog));
+	}
+	pthread_mutex_unlock(&slog_lock);
+
+	dbg("Wrote a batch of %d events to the servicelog", i);
+
+	for (req = batch, i = 0; req != NULL; req = next, i++) {
+		next = req->next;
+		if (req->done)
+			req->done(key[i], rc[i], req->arg);
+		free(req);
+	}
+}
+
+/**
+ * slog_writer_thread
+ * @brief Write the queued events to the servicelog in batches
+ */
+static void *
+slog_writer_thread(void *arg)
+{
+	struct slog_request *batch, **last;
+	struct timespec deadline;
+	unsigned int n;
+
+	pthread_mutex_lock(&slog_writer.lock);
+	while (1) {
+		while (!slog_writer.count && !slog_writer.stop)
+			pthread_cond_wait(&slog_writer.cond, &slog_writer.lock);
+
+		if (!slog_writer.count)
+			break;
+
+		/* Give the batch a chance to fill up */
+		deadline = slog_writer.head->queued;
+		deadline.tv_nsec += SLOG_BATCH_DELAY_MS * 1000000L;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		while (slog_writer.count < SLOG_BATCH_MAX && !slog_writer.stop)
+			if (pthread_cond_timedwait(&slog_writer.cond,
+						   &slog_writer.lock,
+						   &deadline) == ETIMEDOUT)
+				break;
+
+		batch = slog_writer.head;
+		last = &batch;
+		for (n = 0; n < SLOG_BATCH_MAX && *last != NULL; n++)
+			last = &(*last)->next;
+
+		slog_writer.head = *last;
+		if (slog_writer.head == NULL)
+			slog_writer.tail = &slog_writer.head;
+		*last = NULL;
+		slog_writer.count -= n;
+		pthread_cond_broadcast(&slog_writer.space);
+
+		pthread_mutex_unlock(&slog_writer.lock);
+		write_slog_batch(batch);
+		pthread_mutex_lock(&slog_writer.lock);
+	}
+	pthread_mutex_unlock(&slog_writer.lock);
+
+	return NULL;
+}
+
+/**
+ * start_slog_writer
+ * @brief Start the thread logging the events in the servicelog
+ *
+ * If the thread cannot be started the events are logged by the
+ * handler threads as they come.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+start_slog_writer(void)
+{
+	pthread_condattr_t attr;
+	sigset_t set, old_set;
+	int rc;
+
+	if (slog == NULL)
+		return 0;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&slog_writer.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	rc = pthread_create(&slog_writer.thread, NULL, slog_writer_thread,
+			    NULL);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (rc) {
+		log_msg(NULL, "Could not start the servicelog writer thread, "
+			"%s", strerror(rc));
+		return -1;
+	}
+
+	slog_writer.running = 1;
+	return 0;
+}
+
+/**
+ * stop_slog_writer
+ * @brief Flush the queued events to the servicelog and stop the writer
+ *
+ * Safe to call more than once, every caller returns once the queued
+ * events have been written, so that the servicelog can then be closed.
+ */
+void
+stop_slog_writer(void)
+{
+	pthread_mutex_lock(&slog_writer.lock);
+	if (!slog_writer.running) {
+		while (slog_writer.stop && !slog_writer.joined)
+			pthread_cond_wait(&slog_writer.stopped,
+					  &slog_writer.lock);
+		pthread_mutex_unlock(&slog_writer.lock);
+		return;
+	}
+
+	slog_writer.running = 0;
+	slog_writer.stop = 1;
+	pthread_cond_signal(&slog_writer.cond);
+	pthread_cond_broadcast(&slog_writer.space);
+	pthread_mutex_unlock(&slog_writer.lock);
+
+	pthread_join(slog_writer.thread, NULL);
+
+	pthread_mutex_lock(&slog_writer.lock);
+	slog_writer.joined = 1;
+	pthread_cond_broadcast(&slog_writer.stopped);
+	pthread_mutex_unlock(&slog_writer.lock);
+}
+
+/**
+ * queue_slog_event
+ * @brief Queue an event for the servicelog writer
+ *
+ * The entry is freed once logged.  The key of the event is returned
+ * through done, called from the writer thread, once its batch has been
+ * written.  Without a writer the event is logged right away.
+ *
+ * @param entry servicelog event to log
+ * @param done function told about the key of the event, may be NULL
+ * @param arg sequence number of the RTAS event, passed to done
+ */
+void
+queue_slog_event(struct sl_event *entry, slog_done_fn done, void *arg)
+{
+	struct slog_request *req;
+
+	req = calloc(1, sizeof(*req));
+	if (req == NULL) {
+		log_msg(NULL, "Memory allocation failed");
+		servicelog_event_free(entry);
+		return;
+	}
+
+	req->entry = entry;
+	req->done = done;
+	req->arg = arg;
+	clock_gettime(CLOCK_MONOTONIC, &req->queued);
+
+	pthread_mutex_lock(&slog_writer.lock);
+	while (slog_writer.count >= SLOG_QUEUE_MAX && slog_writer.running)
+		pthread_cond_wait(&slog_writer.space, &slog_writer.lock);
+
+	if (!slog_writer.running) {
+		pthread_mutex_unlock(&slog_writer.lock);
+		write_slog_batch(req);
+		return;
+	}
+
+	*slog_writer.tail = req;
+	slog_writer.tail = &req->next;
+	if (++slog_writer.count == 1 || slog_writer.count == SLOG_BATCH_MAX)
+		pthread_cond_signal(&slog_writer.cond);
+	pthread_mutex_unlock(&slog_writer.lock);
+}
+
 /**
  * log_event
  * @brief log the event in the servicelog DB
@@ -216,8 +494,7 @@ void
 log_event(struct event *event)
 {
 	struct rtas_dump_scn *scn_dump;
-	uint64_t key;
-	int rc, txtlen;
+	int txtlen;
 
 	/* If the DB isn't available, do nothing */
 	if (slog == NULL)
@@ -278,13 +555,8 @@ log_event(struct event *event)
 		}
 	}
 
-	/* Log the event in the servicelog */
-	rc = servicelog_event_log(slog, event->sl_entry, &key);
-	servicelog_event_free(event->sl_entry);
-
-	if (rc)
-		log_msg(event, "Could not log event to servicelog.\n%s\n",
-			servicelog_error(slog));
-	else
-		log_msg(event, "servicelog key %llu", key);
+	/* The entry now belongs to the servicelog writer */
+	queue_slog_event(event->sl_entry, log_event_done,
+			 (void *)(long)event->seq_num);
+	event->sl_entry = NULL;
 }
@@ -20,90 +20,120 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "rtas_errd.h"
 
 /**
- * sighup_handler
- * @brief signal handler for SIGHUP
- *
- * The SIGHUP signal will cause the rtas_errd daemon to re-read
- * the configuration file.  If it is currently safe to re-configure
- * ourselves we do, otherwise we set a flag to indicate that a
- * re-configuration needs to occur at the next "safe" place
+ * @var signal_pipe
+ * @brief Pipe passing the signals from the handler to the waiter thread
  */
-void
-sighup_handler(int sig, siginfo_t siginfo, void *context)
-{
-	if (d_cfg.flags & RE_CFG_RECFG_SAFE)
-		diag_cfg(1, &cfg_log);
-	else
-		d_cfg.flags |= RE_CFG_RECEIVED_SIGHUP;
-}
+static int signal_pipe[2] = {-1, -1};
 
 /**
- * sigchld_handler
- * @brief SIGCHLD handler.
+ * waiter_signal_handler
+ * @brief signal handler for SIGHUP, SIGTERM and SIGUSR1
  *
- * Cleanup child process when it exited.
+ * Re-reading the configuration file, stopping the event reader or
+ * writing the statistics is not async-signal-safe, the handler only passes the signal on to the
+ * waiter thread.
  */
-static void
-sigchld_handler(int sig)
+void
+waiter_signal_handler(int sig, siginfo_t siginfo, void *context)
 {
-	/* Wait for all dead processes.
-	 * We use a non-blocking call to be sure this signal handler will not
-	 * block if a child was cleaned up in another part of the program.
-	 */
-	while (waitpid(-1, NULL, WNOHANG) > 0) {
-	}
+	int saved_errno = errno;
+	char c = sig;
+	ssize_t rc;
+
+	/* The pipe only fills up if the waiter is stuck, drop the signal */
+	rc = write(signal_pipe[1], &c, 1);
+	(void)rc;
+
+	errno = saved_errno;
 }
 
 /**
- * restore_sigchld_default
- * @brief restore child signal handler
+ * signal_waiter
+ * @brief Act on the signals passed on by waiter_signal_handler()
  *
- * Restores child signal handler to default action.
+ * SIGHUP re-reads the configuration file, once no event is being
+ * handled.  SIGUSR1 writes the statistics to stats_file.  SIGTERM stops the
+ * reader, main() then handles the events already read, flushes the
+ * servicelog and exits.
  */
-void
-restore_sigchld_default(void)
+static void *
+signal_waiter(void *arg)
 {
-	struct sigaction old_sigact;
-	struct sigaction sigact;
-
-	sigaction(SIGCHLD, NULL, &old_sigact);
-	if (old_sigact.sa_handler != SIG_DFL ) {
-		sigact.sa_handler = SIG_DFL;
-		sigemptyset(&sigact.sa_mask);
-		sigact.sa_flags = SA_RESTART;
-		if (sigaction(SIGCHLD, &sigact, NULL)) {
-			log_msg(NULL, "Could not restore SIGCHLD signal "
-				"handler to default action, %s",
-				strerror(errno));
+	char c;
+
+	while (1) {
+		if (read(signal_pipe[0], &c, 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (c == SIGHUP) {
+			sighup_reconfig();
+			continue;
+		}
+
+		if (c == SIGUSR1) {
+			write_stats_file();
+			continue;
+		}
+
+		if (c == SIGTERM) {
+			log_msg(NULL, "Received SIGTERM, handling the RTAS "
+				"events already read before exiting");
+			stop_event_reader();
 		}
 	}
+
+	return NULL;
 }
 
 /**
- * setup_sigchld_handler
- * @brief setup child signal handler
+ * start_signal_waiter
+ * @brief Start the thread handling the signals for waiter_signal_handler()
  *
- * Setup custom child signal handler to cleanup
- * child processes when it exited.
+ * @return 0 on success, -1 on failure
  */
-void
-setup_sigchld_handler(void)
+int
+start_signal_waiter(void)
 {
-	struct sigaction sigact;
-	sigact.sa_handler = (void *)sigchld_handler;
-	sigemptyset(&sigact.sa_mask);
-	sigact.sa_flags = SA_RESTART;
-	if (sigaction(SIGCHLD, &sigact, NULL)) {
-		log_msg(NULL, "Could not initialize signal handler for"
-			"cleaning up child processes, %s", strerror(errno));
+	pthread_t thread;
+	sigset_t set, old_set;
+	int rc;
+
+	if (pipe(signal_pipe)) {
+		log_msg(NULL, "Could not create the signal pipe, %s",
+			strerror(errno));
+		return -1;
+	}
+	fcntl(signal_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(signal_pipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK);
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	rc = pthread_create(&thread, NULL, signal_waiter, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (rc) {
+		log_msg(NULL, "Could not start the signal waiter thread, %s",
+			strerror(rc));
+		close(signal_pipe[0]);
+		close(signal_pipe[1]);
+		return -1;
 	}
+
+	pthread_detach(thread);
+	return 0;
 }
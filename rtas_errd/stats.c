@@ -0,0 +1,320 @@
+/**
+ * @file stats.c
+ * @brief Latency histograms and counters of the RTAS event path
+ *
+ * Every stage an RTAS event goes through is timed with the monotonic
+ * clock into a histogram with power of two buckets.  The counters are
+ * updated with relaxed atomics, there is no lock on the event path.
+ * They are written to stats_file on SIGUSR1.
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "rtas_errd.h"
+
+/**
+ * @def STATS_BUCKETS
+ * @brief Buckets of a latency histogram
+ *
+ * Bucket 0 counts the stages that took less than 1us, bucket i > 0 those
+ * that took [2^(i-1), 2^i) us.  The last one is open ended (~18 min).
+ */
+#define STATS_BUCKETS	32
+
+/**
+ * @var stats_file
+ * @brief File the statistics are written to on SIGUSR1
+ */
+char *stats_file = "/run/rtas_errd.stats";
+
+/**
+ * @struct stats_hist
+ * @brief Latency histogram of a stage of the event path
+ */
+struct stats_hist {
+	uint64_t	count;
+	uint64_t	total_ns;
+	uint64_t	max_ns;
+	uint64_t	buckets[STATS_BUCKETS];
+};
+
+static struct stats_hist stats_hists[STATS_STAGES];
+
+static const char *stats_stage_names[STATS_STAGES] = {
+	[STATS_QUEUED]		= "queued",
+	[STATS_PARSE]		= "parse",
+	[STATS_HANDLE]		= "handle",
+	[STATS_PRINT]		= "print",
+	[STATS_PLATDUMP]	= "platdump",
+	[STATS_ANALYSIS]	= "analysis",
+	[STATS_LSVPD]		= "lsvpd",
+	[STATS_SERVICELOG]	= "servicelog",
+};
+
+/* RTAS events received, by type */
+static uint64_t stats_event_types[256];
+
+static const char *event_type_names[256] = {
+	[RTAS_HDR_TYPE_CACHE_PARITY]		= "cache_parity",
+	[RTAS_HDR_TYPE_RESOURCE_DEALLOC]	= "resource_dealloc",
+	[RTAS_HDR_TYPE_EPOW]			= "epow",
+	[RTAS_HDR_TYPE_PLATFORM_ERROR]		= "platform_error",
+	[RTAS_HDR_TYPE_PLATFORM_INFO]		= "platform_info",
+	[RTAS_HDR_TYPE_DUMP_NOTIFICATION]	= "dump_notification",
+	[RTAS_HDR_TYPE_PRRN]			= "prrn",
+	[RTAS_HDR_TYPE_HOTPLUG]			= "hotplug",
+};
+
+static struct timespec stats_start_ts;
+
+static uint64_t
+elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000ULL +
+		end->tv_nsec - start->tv_nsec;
+}
+
+/**
+ * stats_init
+ * @brief Start the clock of the statistics
+ */
+void
+stats_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &stats_start_ts);
+}
+
+/**
+ * stats_uptime
+ * @brief Seconds since stats_init()
+ */
+double
+stats_uptime(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return elapsed_ns(&stats_start_ts, &now) / 1e9;
+}
+
+/**
+ * stats_stage
+ * @brief Account for a stage of the event path
+ *
+ * @param stage stage of the event path that just completed
+ * @param start time the stage started at, see stats_clock()
+ */
+void
+stats_stage(enum stats_stage stage, struct timespec *start)
+{
+	struct stats_hist *h = &stats_hists[stage];
+	struct timespec now;
+	uint64_t ns, us, max;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = elapsed_ns(start, &now);
+
+	us = ns / 1000;
+	i = us ? 64 - __builtin_clzll(us) : 0;
+	if (i >= STATS_BUCKETS)
+		i = STATS_BUCKETS - 1;
+
+	__atomic_fetch_add(&h->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+	while (ns > max &&
+	       !__atomic_compare_exchange_n(&h->max_ns, &max, ns, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * stats_stage_count
+ * @brief Number of times a stage of the event path completed
+ */
+uint64_t
+stats_stage_count(enum stats_stage stage)
+{
+	return __atomic_load_n(&stats_hists[stage].count, __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_event_type
+ * @brief Count an RTAS event received
+ *
+ * @param type type of the event, from its RTAS header
+ */
+void
+stats_event_type(int type)
+{
+	__atomic_fetch_add(&stats_event_types[type & 0xff], 1,
+			   __ATOMIC_RELAXED);
+}
+
+/**
+ * stats_percentile
+ * @brief Upper bound of the bucket holding a percentile of a histogram
+ *
+ * @return the bound in us, 0 if the stage never ran
+ */
+static uint64_t
+stats_percentile(uint64_t *buckets, uint64_t count, int pct)
+{
+	uint64_t seen = 0, rank;
+	int i;
+
+	if (count == 0)
+		return 0;
+
+	rank = (count * pct + 99) / 100;
+	for (i = 0; i < STATS_BUCKETS - 1; i++) {
+		seen += buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	return 1ULL << i;
+}
+
+/**
+ * print_stats
+ * @brief Print the histograms and counters
+ *
+ * The counters are read without stopping the event path, a stage may be
+ * counted in one field and not yet in another.
+ *
+ * @param fp stream to print to
+ */
+void
+print_stats(FILE *fp)
+{
+	struct event_queue_stats qstats;
+	struct helper_stats hstats;
+	uint64_t buckets[STATS_BUCKETS];
+	uint64_t count, total, n;
+	char name[32];
+	int i, j;
+
+	fprintf(fp, "uptime %.0f s\n\n", stats_uptime());
+
+	fprintf(fp, "%-11s %10s %10s %10s %10s %10s %10s\n", "stage",
+		"count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+	for (i = 0; i < STATS_STAGES; i++) {
+		struct stats_hist *h = &stats_hists[i];
+
+		for (j = 0; j < STATS_BUCKETS; j++)
+			buckets[j] = __atomic_load_n(&h->buckets[j],
+						     __ATOMIC_RELAXED);
+		count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+		total = __atomic_load_n(&h->total_ns, __ATOMIC_RELAXED);
+
+		fprintf(fp, "%-11s %10llu %10.1f %10llu %10llu %10llu %10.1f\n",
+			stats_stage_names[i], (unsigned long long)count,
+			count ? total / 1e3 / count : 0,
+			(unsigned long long)stats_percentile(buckets, count, 50),
+			(unsigned long long)stats_percentile(buckets, count, 90),
+			(unsigned long long)stats_percentile(buckets, count, 99),
+			__atomic_load_n(&h->max_ns, __ATOMIC_RELAXED) / 1e3);
+	}
+
+	fprintf(fp, "\nevents by type\n");
+	for (i = 0; i < 256; i++) {
+		n = __atomic_load_n(&stats_event_types[i], __ATOMIC_RELAXED);
+		if (n == 0)
+			continue;
+		if (event_type_names[i] != NULL)
+			snprintf(name, sizeof(name), "%s", event_type_names[i]);
+		else
+			snprintf(name, sizeof(name), "type_0x%02x", i);
+		fprintf(fp, "  %-20s %llu\n", name, (unsigned long long)n);
+	}
+
+	get_event_queue_stats(&qstats);
+	fprintf(fp, "\nevent queue: read %lu dropped %lu queued %u "
+		"max_queued %u\n", qstats.read, qstats.dropped,
+		qstats.queued, qstats.max_queued);
+
+	fprintf(fp, "\nhelpers\n");
+	for (i = 0; i < HELPER_TYPES; i++) {
+		get_helper_stats(i, &hstats);
+		fprintf(fp, "  %-20s spawned %lu failed %lu timed_out %lu "
+			"running %u\n", hstats.name, hstats.spawned,
+			hstats.failed, hstats.timed_out, hstats.running);
+	}
+
+	fprintf(fp, "\nhistograms, events per bucket, bucket i < 2^i us\n");
+	for (i = 0; i < STATS_STAGES; i++) {
+		fprintf(fp, "  %-11s", stats_stage_names[i]);
+		for (j = 0; j < STATS_BUCKETS; j++)
+			fprintf(fp, " %llu", (unsigned long long)
+				__atomic_load_n(&stats_hists[i].buckets[j],
+						__ATOMIC_RELAXED));
+		fprintf(fp, "\n");
+	}
+}
+
+/**
+ * write_stats_file
+ * @brief Replace stats_file with the current statistics
+ *
+ * The file is written aside and renamed, readers never see it partly
+ * written.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+write_stats_file(void)
+{
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", stats_file);
+	unlink(tmp);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		log_msg(NULL, "Could not open %s, %s", tmp, strerror(errno));
+		return -1;
+	}
+
+	print_stats(fp);
+	fchmod(fileno(fp), 0444);
+	rc = fclose(fp);
+
+	if (rc == 0)
+		rc = rename(tmp, stats_file);
+	if (rc) {
+		log_msg(NULL, "Could not write %s, %s", stats_file,
+			strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
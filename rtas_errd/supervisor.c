@@ -0,0 +1,649 @@
+/**
+ * @file supervisor.c
+ * @brief Supervisor of the helper programs run by rtas_errd
+ *
+ * Copyright (C) 2015 IBM Corporation
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#define _GNU_SOURCE	/* pipe2() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "rtas_errd.h"
+
+extern char **environ;
+
+/**
+ * @def HELPER_KILL_GRACE
+ * @brief Seconds a timed out helper is given to exit on SIGTERM
+ */
+#define HELPER_KILL_GRACE	10
+
+/**
+ * @def HELPER_POLL_MS
+ * @brief How often helpers are polled when pidfds are not available
+ */
+#define HELPER_POLL_MS		1000
+
+/**
+ * @struct helper_class
+ * @brief Limits applying to a kind of helper
+ */
+struct helper_class {
+	char		*name;
+	int		timeout;	/**< seconds, 0 for none */
+	int		max_running;	/**< helpers of this kind run at once */
+	int		devtree;	/**< may change the device tree */
+	int		running;
+	unsigned long	spawned;
+	unsigned long	failed;		/**< could not be started */
+	unsigned long	timed_out;
+};
+
+/*
+ * drmgr takes a system wide lock, running several of them at once only
+ * has them wait for one another. The EPOW script may be shutting the
+ * system down and is never timed out.
+ */
+static struct helper_class helper_classes[HELPER_TYPES] = {
+	[HELPER_DRMGR]		= { "drmgr",			600,	1, 1 },
+	[HELPER_LSVPD]		= { "lsvpd",			120,	2, 0 },
+	[HELPER_PLATDUMP]	= { "extract_platdump",		1800,	1, 0 },
+	[HELPER_EPOW]		= { "rc.powerfail",		0,	8, 0 },
+};
+
+/**
+ * @struct helper
+ * @brief A helper program started by rtas_errd
+ */
+struct helper {
+	enum helper_type	type;
+	pid_t			pid;
+	int			pidfd;		/**< -1 if not available */
+	struct timespec		deadline;	/**< 0 for none */
+	int			killed;		/**< signal sent on timeout */
+	int			done;
+	int			status;		/**< as from waitpid() */
+	int			detached;	/**< nobody waits for it */
+	struct helper		*next;
+};
+
+static struct helper *helpers;
+static pthread_mutex_t helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t helper_cond = PTHREAD_COND_INITIALIZER;
+
+#ifdef DEBUG
+/**
+ * @var helper_dir
+ * @brief Directory of fake helpers run instead of the real ones
+ */
+char *helper_dir = NULL;
+#endif
+
+static pthread_t supervisor_thread;
+static int supervisor_epfd = -1;
+static int supervisor_wakefd = -1;
+static int supervisor_stop;
+
+/**
+ * open_pidfd
+ * @brief Get a file descriptor that polls readable once pid exits
+ *
+ * @return the pidfd, -1 if the kernel is too old to provide one
+ */
+static int
+open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static void
+wake_supervisor(void)
+{
+	uint64_t one = 1;
+
+	if (write(supervisor_wakefd, &one, sizeof(one)) < 0)
+		dbg("Could not wake the helper supervisor, %s",
+		    strerror(errno));
+}
+
+/**
+ * reap_helper
+ * @brief Collect the exit status of a helper, if it has exited
+ *
+ * Called with helper_lock held. A detached helper is freed here, the
+ * caller must not use it afterwards.
+ *
+ * @return 1 if the helper has exited, 0 otherwise
+ */
+static int
+reap_helper(struct helper *h, struct helper **prev)
+{
+	struct helper_class *hc = &helper_classes[h->type];
+	int status;
+	pid_t pid;
+
+	do {
+		pid = waitpid(h->pid, &status, WNOHANG);
+	} while (pid == -1 && errno == EINTR);
+
+	if (pid == 0)
+		return 0;
+	if (pid == -1)
+		status = -1;
+
+	if (h->pidfd >= 0) {
+		epoll_ctl(supervisor_epfd, EPOLL_CTL_DEL, h->pidfd, NULL);
+		close(h->pidfd);
+		h->pidfd = -1;
+	}
+
+	/* drmgr added or removed resources, or tried to */
+	if (hc->devtree) {
+		invalidate_dt_status_index();
+		drc_map_invalidate();
+	}
+
+	h->done = 1;
+	h->status = status;
+	hc->running--;
+	pthread_cond_broadcast(&helper_cond);
+
+	if (h->detached) {
+		if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+			log_msg(NULL, "%s (pid %d) failed, status %d",
+				hc->name, h->pid, status);
+		else
+			dbg("%s (pid %d) exited", hc->name, h->pid);
+
+		*prev = h->next;
+		free(h);
+	}
+
+	return 1;
+}
+
+/**
+ * timeout_helper
+ * @brief Stop a helper that has run for too long
+ *
+ * The process group of the helper is sent SIGTERM first, then SIGKILL
+ * if it is still there HELPER_KILL_GRACE seconds later, so that nothing
+ * it started keeps the pipe to its output open.
+ */
+static void
+timeout_helper(struct helper *h, struct timespec *now)
+{
+	struct helper_class *hc = &helper_classes[h->type];
+
+	if (!h->killed) {
+		hc->timed_out++;
+		log_msg(NULL, "%s (pid %d) did not complete in %d seconds, "
+			"stopping it", hc->name, h->pid, hc->timeout);
+		kill(-h->pid, SIGTERM);
+		h->killed = SIGTERM;
+		h->deadline.tv_sec = now->tv_sec + HELPER_KILL_GRACE;
+		h->deadline.tv_nsec = now->tv_nsec;
+	} else {
+		log_msg(NULL, "%s (pid %d) did not exit on SIGTERM, killing "
+			"it", hc->name, h->pid);
+		kill(-h->pid, SIGKILL);
+		h->killed = SIGKILL;
+		h->deadline.tv_sec = 0;
+	}
+}
+
+/**
+ * supervise_helpers
+ * @brief Reap the helpers that have exited and time out the others
+ *
+ * Called with helper_lock held.
+ *
+ * @return milliseconds until the next deadline, -1 if there is none
+ */
+static int
+supervise_helpers(void)
+{
+	struct helper *h, **prev;
+	struct timespec now;
+	long ms, next = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	prev = &helpers;
+	while ((h = *prev) != NULL) {
+		if (h->done) {
+			prev = &h->next;
+			continue;
+		}
+
+		/* Without a pidfd there is no notification, poll */
+		if (h->pidfd < 0 && reap_helper(h, prev)) {
+			if (*prev != h)
+				continue;
+			prev = &h->next;
+			continue;
+		}
+		if (h->pidfd < 0 && (next < 0 || next > HELPER_POLL_MS))
+			next = HELPER_POLL_MS;
+
+		if (h->deadline.tv_sec) {
+			if (now.tv_sec > h->deadline.tv_sec ||
+			    (now.tv_sec == h->deadline.tv_sec &&
+			     now.tv_nsec >= h->deadline.tv_nsec))
+				timeout_helper(h, &now);
+
+			if (h->deadline.tv_sec) {
+				ms = (h->deadline.tv_sec - now.tv_sec) * 1000 +
+				     (h->deadline.tv_nsec - now.tv_nsec) /
+				     1000000 + 1;
+				if (next < 0 || ms < next)
+					next = ms;
+			}
+		}
+
+		prev = &h->next;
+	}
+
+	return next;
+}
+
+/**
+ * supervisor
+ * @brief Supervisor thread, waits for helpers to exit or time out
+ */
+static void *
+supervisor(void *arg)
+{
+	struct epoll_event events[16];
+	struct helper *h, **prev;
+	uint64_t val;
+	int i, n, timeout;
+
+	pthread_mutex_lock(&helper_lock);
+	timeout = supervise_helpers();
+	pthread_mutex_unlock(&helper_lock);
+
+	while (1) {
+		n = epoll_wait(supervisor_epfd, events, 16, timeout);
+		if (n == -1 && errno != EINTR) {
+			log_msg(NULL, "Helper supervisor failed, %s",
+				strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&helper_lock);
+		if (supervisor_stop) {
+			pthread_mutex_unlock(&helper_lock);
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			/* A new helper was started */
+			if (events[i].data.ptr == NULL) {
+				while (read(supervisor_wakefd, &val,
+					    sizeof(val)) > 0)
+					;
+				continue;
+			}
+
+			/* The helper may have been reaped by a poll */
+			for (prev = &helpers; (h = *prev) != NULL;
+			     prev = &h->next) {
+				if (h == events[i].data.ptr) {
+					if (!h->done)
+						reap_helper(h, prev);
+					break;
+				}
+			}
+		}
+
+		timeout = supervise_helpers();
+		pthread_mutex_unlock(&helper_lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * start_supervisor
+ * @brief Start the thread supervising the helper programs
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+start_supervisor(void)
+{
+	struct epoll_event ev;
+	sigset_t set, old_set;
+	int rc;
+
+	supervisor_epfd = epoll_create1(EPOLL_CLOEXEC);
+	supervisor_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (supervisor_epfd == -1 || supervisor_wakefd == -1) {
+		log_msg(NULL, "Could not set up the helper supervisor, %s",
+			strerror(errno));
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(supervisor_epfd, EPOLL_CTL_ADD, supervisor_wakefd,
+		      &ev)) {
+		log_msg(NULL, "Could not set up the helper supervisor, %s",
+			strerror(errno));
+		return -1;
+	}
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old_set);
+	rc = pthread_create(&supervisor_thread, NULL, supervisor, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+	if (rc) {
+		log_msg(NULL, "Could not start the helper supervisor thread, "
+			"%s", strerror(rc));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * stop_supervisor
+ * @brief Stop the supervisor thread
+ *
+ * Helpers still running (the EPOW script) are left alone.
+ */
+void
+stop_supervisor(void)
+{
+	pthread_mutex_lock(&helper_lock);
+	supervisor_stop = 1;
+	pthread_mutex_unlock(&helper_lock);
+
+	wake_supervisor();
+	pthread_join(supervisor_thread, NULL);
+}
+
+/**
+ * start_helper
+ * @brief Start a helper program under supervision
+ *
+ * Waits for a slot if as many helpers of this kind as allowed are
+ * already running. The helper runs in its own process group, with the
+ * default signal dispositions and an empty signal mask, whatever the
+ * calling thread blocks.
+ *
+ * @param type kind of helper
+ * @param path path of the program
+ * @param argv arguments, argv[0] first
+ * @param out_fd if >= 0, made the standard output of the helper
+ * @param detached if set, the helper is reaped without being waited for
+ * @return the helper, NULL on failure
+ */
+static struct helper *
+start_helper(enum helper_type type, char *path, char *argv[], int out_fd,
+	     int detached)
+{
+	struct helper_class *hc = &helper_classes[type];
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	struct epoll_event ev;
+	struct helper *h;
+	sigset_t set;
+	int rc;
+#ifdef DEBUG
+	char fake_path[PATH_MAX];
+
+	/* The helpers are named after their program */
+	if (helper_dir != NULL) {
+		snprintf(fake_path, sizeof(fake_path), "%s/%s", helper_dir,
+			 hc->name);
+		path = fake_path;
+	}
+#endif
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL)
+		return NULL;
+
+	h->type = type;
+	h->detached = detached;
+
+	pthread_mutex_lock(&helper_lock);
+	while (hc->running >= hc->max_running)
+		pthread_cond_wait(&helper_cond, &helper_lock);
+	hc->running++;
+	pthread_mutex_unlock(&helper_lock);
+
+	posix_spawnattr_init(&attr);
+	sigemptyset(&set);
+	posix_spawnattr_setsigmask(&attr, &set);
+	sigfillset(&set);
+	posix_spawnattr_setsigdefault(&attr, &set);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+				 POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+	posix_spawn_file_actions_init(&actions);
+	if (out_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, out_fd,
+						 STDOUT_FILENO);
+
+	rc = posix_spawn(&h->pid, path, &actions, &attr, argv, environ);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if (rc) {
+		pthread_mutex_lock(&helper_lock);
+		hc->running--;
+		hc->failed++;
+		pthread_cond_broadcast(&helper_cond);
+		pthread_mutex_unlock(&helper_lock);
+
+		free(h);
+		errno = rc;
+		return NULL;
+	}
+
+	dbg("Started %s (pid %d)", hc->name, h->pid);
+
+	h->pidfd = open_pidfd(h->pid);
+	if (h->pidfd >= 0)
+		fcntl(h->pidfd, F_SETFD, FD_CLOEXEC);
+
+	if (hc->timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &h->deadline);
+		h->deadline.tv_sec += hc->timeout;
+	}
+
+	pthread_mutex_lock(&helper_lock);
+	if (h->pidfd >= 0) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = h;
+		if (epoll_ctl(supervisor_epfd, EPOLL_CTL_ADD, h->pidfd, &ev)) {
+			close(h->pidfd);
+			h->pidfd = -1;
+		}
+	}
+	h->next = helpers;
+	helpers = h;
+	hc->spawned++;
+	pthread_mutex_unlock(&helper_lock);
+
+	/* Have the supervisor take the new deadline into account */
+	wake_supervisor();
+
+	return h;
+}
+
+/**
+ * wait_helper
+ * @brief Wait for a helper to exit and release it
+ *
+ * @return the status of the helper as from waitpid(), -1 if it could
+ * not be obtained
+ */
+static int
+wait_helper(struct helper *h)
+{
+	struct helper **prev;
+	int status;
+
+	pthread_mutex_lock(&helper_lock);
+	while (!h->done)
+		pthread_cond_wait(&helper_cond, &helper_lock);
+
+	for (prev = &helpers; *prev != h; prev = &(*prev)->next)
+		;
+	*prev = h->next;
+	status = h->status;
+	pthread_mutex_unlock(&helper_lock);
+
+	free(h);
+	return status;
+}
+
+/**
+ * run_helper
+ * @brief Run a helper program and wait for it to exit
+ *
+ * The helper is stopped if it runs past the timeout of its kind, the
+ * caller then gets the status of the killed helper.
+ *
+ * @param type kind of helper
+ * @param path path of the program
+ * @param argv arguments, argv[0] first
+ * @return the status of the helper as from waitpid(), -1 if it could
+ * not be run
+ */
+int
+run_helper(enum helper_type type, char *path, char *argv[])
+{
+	struct helper *h;
+
+	h = start_helper(type, path, argv, -1, 0);
+	if (h == NULL)
+		return -1;
+
+	return wait_helper(h);
+}
+
+/**
+ * spawn_helper
+ * @brief Start a helper program without waiting for it
+ *
+ * The supervisor reaps the helper and logs its failure, if it fails.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+spawn_helper(enum helper_type type, char *path, char *argv[])
+{
+	return start_helper(type, path, argv, -1, 1) ? 0 : -1;
+}
+
+/**
+ * helper_popen
+ * @brief Start a helper program and read its output
+ *
+ * @param type kind of helper
+ * @param argv arguments, argv[0] being the path of the program
+ * @param hp set to the helper, to be passed to helper_pclose()
+ * @return stream to read the output of the helper from, NULL on failure
+ */
+FILE *
+helper_popen(enum helper_type type, char *argv[], struct helper **hp)
+{
+	int pipefd[2];
+	FILE *fp;
+
+	if (pipe2(pipefd, O_CLOEXEC) == -1)
+		return NULL;
+
+	*hp = start_helper(type, argv[0], argv, pipefd[1], 0);
+	close(pipefd[1]);
+	if (*hp == NULL) {
+		close(pipefd[0]);
+		return NULL;
+	}
+
+	fp = fdopen(pipefd[0], "r");
+	if (fp == NULL) {
+		close(pipefd[0]);
+		wait_helper(*hp);
+		return NULL;
+	}
+
+	return fp;
+}
+
+/**
+ * helper_pclose
+ * @brief Close the output of a helper started with helper_popen()
+ *
+ * @return the status of the helper as from waitpid(), -1 if it could
+ * not be obtained
+ */
+int
+helper_pclose(FILE *fp, struct helper *h)
+{
+	fclose(fp);
+	return wait_helper(h);
+}
+
+/**
+ * get_helper_stats
+ * @brief Get the counters of a kind of helper
+ *
+ * @param type kind of helper
+ * @param stats filled in with the counters
+ */
+void
+get_helper_stats(enum helper_type type, struct helper_stats *stats)
+{
+	struct helper_class *hc = &helper_classes[type];
+
+	pthread_mutex_lock(&helper_lock);
+	stats->name = hc->name;
+	stats->spawned = hc->spawned;
+	stats->failed = hc->failed;
+	stats->timed_out = hc->timed_out;
+	stats->running = hc->running;
+	pthread_mutex_unlock(&helper_lock);
+}
@@ -11,6 +11,11 @@
  * syslog and /var/log/platform. If they are not equal, we process
  * RTAS events from syslog until they are equal.
  *
+ * Both logs only grow between two starts, so how far they were scanned
+ * (and written, for /var/log/platform) is checkpointed to checkpoint_file
+ * and the next search resumes from there. The whole logs are only scanned
+ * again if they were rotated or the checkpoint does not match them.
+ *
  * Copyright (C) 2004 IBM Corporation
  *
  * This program is free software; you can redistribute it and/or
@@ -73,6 +78,33 @@ char *messages_log = NULL;
  */
 static int msgs_log_fd = -1;
 
+/**
+ * @var checkpoint_file
+ * @brief Where the search resumes from on the next start
+ */
+char *checkpoint_file = "/var/log/rtas_errd.ckpt";
+static int checkpoint_fd = -1;
+
+/**
+ * @struct rtas_checkpoint
+ * @brief How far platform_log and messages_log have been dealt with
+ */
+struct rtas_checkpoint {
+	unsigned long long	log_ino;
+	long long		log_offset;	/**< just past the last event */
+	int			log_seq;	/**< ... and its number */
+	unsigned long long	msgs_ino;
+	long long		msgs_offset;	/**< where to resume */
+};
+
+/*
+ * Written in place on every event, fixed width so that a record always
+ * overwrites the previous one entirely
+ */
+#define CHECKPOINT_FMT	"platform %20llu %20lld %11d messages %20llu %20lld\n"
+
+static struct rtas_checkpoint checkpoint;
+
 /**
  * setup_bc
  * @brief Initalize the bad character array for a Boyer-Moore search
@@ -196,6 +228,164 @@ get_rtas_no(char *ptr)
 	return strtoul(ptr, NULL, 10);
 }
 
+/**
+ * write_checkpoint
+ * @brief Save the checkpoint to checkpoint_file
+ *
+ * Called with platform_log_lock() held.
+ */
+static void
+write_checkpoint(void)
+{
+	char buf[128];
+	int len;
+
+	if (checkpoint_fd < 0) {
+		checkpoint_fd = open(checkpoint_file, O_RDWR | O_CREAT,
+				     S_IRUSR | S_IWUSR);
+		if (checkpoint_fd < 0) {
+			dbg("Could not open %s, %s", checkpoint_file,
+			    strerror(errno));
+			return;
+		}
+	}
+
+	len = snprintf(buf, sizeof(buf), CHECKPOINT_FMT, checkpoint.log_ino,
+		       checkpoint.log_offset, checkpoint.log_seq,
+		       checkpoint.msgs_ino, checkpoint.msgs_offset);
+	if (pwrite(checkpoint_fd, buf, len, 0) != len)
+		dbg("Could not write %s, %s", checkpoint_file,
+		    strerror(errno));
+}
+
+/**
+ * read_checkpoint
+ * @brief Load the checkpoint saved by the previous run
+ *
+ * @return 0 on success, -1 if there is no usable checkpoint
+ */
+static int
+read_checkpoint(void)
+{
+	char buf[128];
+	int fd, len;
+
+	fd = open(checkpoint_file, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	if (sscanf(buf, CHECKPOINT_FMT, &checkpoint.log_ino,
+		   &checkpoint.log_offset, &checkpoint.log_seq,
+		   &checkpoint.msgs_ino, &checkpoint.msgs_offset) != 5) {
+		memset(&checkpoint, 0, sizeof(checkpoint));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * checkpoint_platform_log
+ * @brief Record that an RTAS event was written to platform_log
+ *
+ * Called with platform_log_lock() held, right after the event was written.
+ *
+ * @param seq number of the RTAS event
+ * @param offset end of the event in platform_log
+ */
+void
+checkpoint_platform_log(int seq, off_t offset)
+{
+	struct stat sbuf;
+
+	if (offset < 0 || fstat(platform_log_fd, &sbuf) < 0)
+		return;
+
+	checkpoint.log_ino = sbuf.st_ino;
+	checkpoint.log_offset = offset;
+	checkpoint.log_seq = seq;
+	write_checkpoint();
+}
+
+/**
+ * checkpoint_messages_log
+ * @brief Record where the next search of messages_log resumes from
+ */
+static void
+checkpoint_messages_log(ino_t ino, off_t offset)
+{
+	platform_log_lock();
+	checkpoint.msgs_ino = ino;
+	checkpoint.msgs_offset = offset;
+	write_checkpoint();
+	platform_log_unlock();
+}
+
+/**
+ * platform_checkpoint_valid
+ * @brief Check that the checkpoint matches platform_log
+ *
+ * The checkpointed offset has to be in the same file, right after the
+ * end of the checkpointed event.
+ *
+ * @param sbuf status of platform_log
+ * @return 1 if the search can resume from the checkpoint, 0 otherwise
+ */
+static int
+platform_checkpoint_valid(struct stat *sbuf)
+{
+	char marker[64], buf[64];
+	int len;
+
+	if (checkpoint.log_ino != sbuf->st_ino || checkpoint.log_offset <= 0 ||
+	    checkpoint.log_offset > sbuf->st_size)
+		return 0;
+
+	len = snprintf(marker, sizeof(marker),
+		       "RTAS: %d -------- RTAS event end ----------\n",
+		       checkpoint.log_seq);
+	if (checkpoint.log_offset < len)
+		return 0;
+
+	if (pread(platform_log_fd, buf, len,
+		  checkpoint.log_offset - len) != len)
+		return 0;
+
+	return !memcmp(buf, marker, len);
+}
+
+/**
+ * map_log
+ * @brief Map the end of a log, from offset on
+ *
+ * @param fd file descriptor of the log
+ * @param offset where the part to map starts
+ * @param size size of the log
+ * @param map filled in with the start of the mapping, for munmap()
+ * @param map_len filled in with the length of the mapping
+ * @return pointer to offset in the mapping, NULL on failure
+ */
+static char *
+map_log(int fd, off_t offset, off_t size, char **map, size_t *map_len)
+{
+	off_t base = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+
+	*map_len = size - base;
+	*map = mmap(0, *map_len, PROT_READ, MAP_PRIVATE, fd, base);
+	if (*map == MAP_FAILED) {
+		*map = NULL;
+		return NULL;
+	}
+
+	return *map + (offset - base);
+}
+
 /**
  * update_rtas_msgs
  * @brief Update RTAS messages in the platform log
@@ -209,10 +399,13 @@ update_rtas_msgs(void)
 	struct stat	log_sbuf, msgs_sbuf;
 	char		*log_mmap = NULL, *log_mmap_end;
 	char		*msgs_mmap = NULL, *msgs_mmap_end;
+	size_t		log_map_len = 0, msgs_map_len = 0;
 	char		*rtas_msgs_end, *rtas_msgs_start, *msgs_p;
-	char		*log_p;
-	char		*last_p;
-	int		last_rtas_log_no, last_rtas_msgs_no, cur_rtas_no;
+	char		*log_start, *log_p, *msgs_start, *msgs_resume;
+	char		*last_p, *end_p;
+	off_t		log_offset = 0, msgs_offset = 0;
+	int		last_rtas_log_no = 0, last_rtas_msgs_no, cur_rtas_no;
+	int		have_checkpoint;
 
 	messages_log = "/var/log/messages";
 	if (access(messages_log, R_OK)) {
@@ -239,17 +432,6 @@ update_rtas_msgs(void)
 		goto cleanup;
 	}
 
-	if ((msgs_mmap = mmap(0, msgs_sbuf.st_size, PROT_READ, MAP_PRIVATE,
-			      msgs_log_fd, 0)) == (char *)-1) {
-		log_msg(NULL, "Cannot map %s to update RTAS events",
-			messages_log);
-		msgs_mmap = NULL;
-		goto cleanup;
-	}
-
-        msgs_p = msgs_mmap;
-	msgs_mmap_end = msgs_mmap + msgs_sbuf.st_size;
-
 	if ((fstat(platform_log_fd, &log_sbuf)) < 0) {
 		log_msg(NULL, "Cannot get status of %s to update RTAS events",
 			platform_log);
@@ -260,36 +442,77 @@ update_rtas_msgs(void)
 	if (log_sbuf.st_size == 0)
 		goto cleanup;
 
-	if ((log_mmap = mmap(0, log_sbuf.st_size, PROT_READ, MAP_PRIVATE,
-			     platform_log_fd, 0)) == (char *)-1) {
-		log_msg(NULL, "Cannot map %s to update RTAS events, %s",
-			platform_log, strerror(errno));
-		log_mmap = NULL;
-		goto cleanup;
-	}
-
-	log_p = log_mmap;
-	log_mmap_end = log_mmap + log_sbuf.st_size;
+	have_checkpoint = !read_checkpoint();
 
 	/* find the last RTAS event in /var/log/platform */
-	last_p = NULL;
-	log_p = find_rtas_start(log_p, log_mmap_end);
-	while (log_p != NULL) {
-		last_p = log_p;
-		log_p = find_rtas_start(log_p + sizeof(RTAS_START),
-					log_mmap_end);
+	if (have_checkpoint && platform_checkpoint_valid(&log_sbuf)) {
+		log_offset = checkpoint.log_offset;
+		last_rtas_log_no = checkpoint.log_seq;
+		dbg("Resuming the search of %s at offset %lld, event %d",
+		    platform_log, (long long)log_offset, last_rtas_log_no);
 	}
 
-	if (last_p == NULL)
-		last_rtas_log_no = 0;
-	else
-		last_rtas_log_no = get_rtas_no(last_p);
+	if (log_offset < log_sbuf.st_size) {
+		log_start = map_log(platform_log_fd, log_offset,
+				    log_sbuf.st_size, &log_mmap, &log_map_len);
+		if (log_start == NULL) {
+			log_msg(NULL, "Cannot map %s to update RTAS events, "
+				"%s", platform_log, strerror(errno));
+			goto cleanup;
+		}
+		log_mmap_end = log_mmap + log_map_len;
+
+		last_p = NULL;
+		log_p = find_rtas_start(log_start, log_mmap_end);
+		while (log_p != NULL) {
+			last_p = log_p;
+			log_p = find_rtas_start(log_p + sizeof(RTAS_START),
+						log_mmap_end);
+		}
+
+		if (last_p != NULL) {
+			last_rtas_log_no = get_rtas_no(last_p);
+
+			/* The next search resumes after that event */
+			end_p = find_rtas_end(last_p, log_mmap_end);
+			if (end_p != NULL)
+				end_p = memchr(end_p, '\n',
+					       log_mmap_end - end_p);
+			if (end_p != NULL) {
+				platform_log_lock();
+				checkpoint_platform_log(last_rtas_log_no,
+					log_offset + (end_p + 1 - log_start));
+				platform_log_unlock();
+			}
+		}
 
-	/* We're finished with /var/log/platform; unamp it */
-	munmap(log_mmap, log_sbuf.st_size);
-	log_mmap = NULL;
+		/* We're finished with /var/log/platform; unamp it */
+		munmap(log_mmap, log_map_len);
+		log_mmap = NULL;
+	}
 
 	/* find the last RTAS event in syslog */
+	if (have_checkpoint && checkpoint.msgs_ino == msgs_sbuf.st_ino &&
+	    checkpoint.msgs_offset <= msgs_sbuf.st_size) {
+		msgs_offset = checkpoint.msgs_offset;
+		dbg("Resuming the search of %s at offset %lld", messages_log,
+		    (long long)msgs_offset);
+	}
+
+	if (msgs_offset == msgs_sbuf.st_size)
+		goto cleanup;
+
+	msgs_start = map_log(msgs_log_fd, msgs_offset, msgs_sbuf.st_size,
+			     &msgs_mmap, &msgs_map_len);
+	if (msgs_start == NULL) {
+		log_msg(NULL, "Cannot map %s to update RTAS events",
+			messages_log);
+		goto cleanup;
+	}
+
+	msgs_p = msgs_start;
+	msgs_mmap_end = msgs_mmap + msgs_map_len;
+
 	last_p = NULL;
 	msgs_p = find_rtas_start(msgs_p, msgs_mmap_end);
 	while (msgs_p != NULL) {
@@ -298,15 +521,24 @@ update_rtas_msgs(void)
 					 msgs_mmap_end);
 	}
 
+	/*
+	 * The next search resumes at the line of the last RTAS event, it
+	 * may not have been completely logged yet, or after the last
+	 * complete line if there is no event.
+	 */
+	msgs_resume = last_p ? last_p : msgs_mmap_end;
+	while (msgs_resume > msgs_start && msgs_resume[-1] != '\n')
+		msgs_resume--;
+
 	if (last_p == NULL) {
 		dbg("%s does not contain any RTAS events", messages_log);
-		goto cleanup;
+		goto checkpoint;
 	}
 
 	last_rtas_msgs_no = get_rtas_no(last_p);
 
 	if (last_rtas_log_no >= last_rtas_msgs_no)
-		goto cleanup;
+		goto checkpoint;
 
 	/*
 	 *  If we get here we know there are some events that have not
@@ -320,7 +552,7 @@ update_rtas_msgs(void)
 	 * can process them in order.
 	 */
 	cur_rtas_no = 0;
-	rtas_msgs_start = msgs_mmap;
+	rtas_msgs_start = msgs_start;
 	while (cur_rtas_no <= last_rtas_log_no) {
 		rtas_msgs_start =
 			find_rtas_start(rtas_msgs_start + strlen(RTAS_START),
@@ -392,9 +624,13 @@ update_rtas_msgs(void)
 		rtas_msgs_end = find_rtas_end(rtas_msgs_start, msgs_mmap_end);
 	}
 
+checkpoint:
+	checkpoint_messages_log(msgs_sbuf.st_ino,
+				msgs_offset + (msgs_resume - msgs_start));
+
 cleanup:
 	if (msgs_mmap)
-		munmap(msgs_mmap, msgs_sbuf.st_size);
+		munmap(msgs_mmap, msgs_map_len);
 	if (msgs_log_fd != -1)
 		close(msgs_log_fd);
 
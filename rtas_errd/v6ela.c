@@ -322,8 +322,9 @@ report_menugoal(struct event *event, struct rtas_priv_hdr_scn *privhdr,
 	char *msg = NULL;
 	int offset = 0;
 	uint menu_num = 0;
-        long time_loc;
-        struct tm *date = NULL;
+        time_t time_loc;
+        struct tm tm, *date = NULL;
+	char tod[26];
 
 	memset(buffer, 0, sizeof(buffer));
 
@@ -363,8 +364,9 @@ report_menugoal(struct event *event, struct rtas_priv_hdr_scn *privhdr,
 					} else if (epow->event_modifier == 3) {
 						msg = MSGMENUG159;
 						menu_num = 651159;
-						time_loc = time((long *)0);
-						date = localtime(&time_loc);
+						time_loc = time(NULL);
+						date = localtime_r(&time_loc,
+								   &tm);
 					}
 					break;
 				case 4:
@@ -377,7 +379,7 @@ report_menugoal(struct event *event, struct rtas_priv_hdr_scn *privhdr,
 
 			if (date != NULL)
 				offset += sprintf(buffer + offset, msg,
-						  asctime(date));
+						  asctime_r(date, tod));
 			else
 				offset += sprintf(buffer + offset, "%s", msg);
 		}
@@ -94,6 +94,14 @@ CFLAGS += -g -DDEBUG
 # Build with common directory included
 CFLAGS += -I$(COMMON_DIR)
 
+# zlib is optional, platform dumps can only be compressed when it is found
+HAVE_ZLIB := $(shell printf '\043include <zlib.h>\n' | \
+		$(CC) $(CPPFLAGS) -E - >/dev/null 2>&1 && echo yes)
+ifeq ($(HAVE_ZLIB),yes)
+CFLAGS += -DHAVE_ZLIB
+ZLIB_LIBS = -lz
+endif
+
 # Include ncurses directory
 CFLAGS += -I $(INC_DIR)/ncurses
 